@@ -0,0 +1,209 @@
+// Held actions, see action.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "key_iter.h"
+#include "layer.h"
+#include "action.h"
+#include "macro.h"
+
+static key_action_t s_held[ACTION_KEY_COUNT];
+static key_action_t s_virtual[ACTION_VIRTUAL_KEY_COUNT];
+static uint64_t s_keycode_keys[KEY_WORDS];    // holding KEY_ACTION_KEY
+static uint64_t s_modifier_keys[KEY_WORDS];   // holding KEY_ACTION_MODIFIER
+static uint8_t  s_modifiers;                  // modifier byte of s_modifier_keys
+static uint64_t s_mouse_keys[KEY_WORDS];      // holding KEY_ACTION_MOUSE
+static uint64_t s_consumer_keys[KEY_WORDS];   // holding KEY_ACTION_CONSUMER
+static uint8_t  s_consumer_last;   // latest consumer key press
+
+// Consumer page usage of each consumer_key_t
+static uint16_t const s_consumer_usage[CONSUMER_KEY_COUNT] = {
+  [CONSUMER_KEY_MUTE]            = HID_USAGE_CONSUMER_MUTE,
+  [CONSUMER_KEY_VOLUME_UP]       = HID_USAGE_CONSUMER_VOLUME_INCREMENT,
+  [CONSUMER_KEY_VOLUME_DOWN]     = HID_USAGE_CONSUMER_VOLUME_DECREMENT,
+  [CONSUMER_KEY_PLAY_PAUSE]      = HID_USAGE_CONSUMER_PLAY_PAUSE,
+  [CONSUMER_KEY_STOP]            = HID_USAGE_CONSUMER_STOP,
+  [CONSUMER_KEY_NEXT_TRACK]      = HID_USAGE_CONSUMER_SCAN_NEXT,
+  [CONSUMER_KEY_PREV_TRACK]      = HID_USAGE_CONSUMER_SCAN_PREVIOUS,
+  [CONSUMER_KEY_BRIGHTNESS_UP]   = HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT,
+  [CONSUMER_KEY_BRIGHTNESS_DOWN] = HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT,
+  [CONSUMER_KEY_MAIL]            = HID_USAGE_CONSUMER_AL_EMAIL_READER,
+  [CONSUMER_KEY_CALCULATOR]      = HID_USAGE_CONSUMER_AL_CALCULATOR,
+  [CONSUMER_KEY_MY_COMPUTER]     = HID_USAGE_CONSUMER_AL_LOCAL_BROWSER,
+  [CONSUMER_KEY_WWW_SEARCH]      = HID_USAGE_CONSUMER_AC_SEARCH,
+  [CONSUMER_KEY_WWW_HOME]        = HID_USAGE_CONSUMER_AC_HOME,
+  [CONSUMER_KEY_WWW_BACK]        = HID_USAGE_CONSUMER_AC_BACK,
+  [CONSUMER_KEY_WWW_FORWARD]     = HID_USAGE_CONSUMER_AC_FORWARD,
+  [CONSUMER_KEY_WWW_REFRESH]     = HID_USAGE_CONSUMER_AC_REFRESH,
+};
+
+// @brief Modifier byte from the held modifier keys (usually 0 - 2 of them)
+static void action_update_modifiers(void)
+{
+  uint8_t modifiers = 0;
+
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    uint64_t keys = s_modifier_keys[word];
+    uint key;
+    while (key_iter_next(&keys, &key)) {
+      modifiers |= (uint8_t) (1u << (s_held[64 * word + key].code - HID_KEY_CONTROL_LEFT));
+    }
+  }
+  s_modifiers = modifiers;
+}
+
+void action_init(void)
+{
+  memset(s_held, 0, sizeof(s_held));
+  memset(s_virtual, 0, sizeof(s_virtual));
+  memset(s_keycode_keys, 0, sizeof(s_keycode_keys));
+  memset(s_modifier_keys, 0, sizeof(s_modifier_keys));
+  s_modifiers = 0;
+  memset(s_mouse_keys, 0, sizeof(s_mouse_keys));
+  memset(s_consumer_keys, 0, sizeof(s_consumer_keys));
+  s_consumer_last = 0;
+
+  layer_init();
+}
+
+// @brief Key of the virtual range of the first word
+static bool action_virtual(uint key)
+{
+  return key >= ACTION_VIRTUAL_KEY_FIRST && key < ACTION_VIRTUAL_KEY_FIRST + ACTION_VIRTUAL_KEY_COUNT;
+}
+
+key_action_t action_resolve(uint key)
+{
+  if (action_virtual(key)) return s_virtual[key - ACTION_VIRTUAL_KEY_FIRST];
+  return layer_action(key);
+}
+
+void action_bind_virtual(uint key, key_action_t action)
+{
+  if (action_virtual(key)) {
+    s_virtual[key - ACTION_VIRTUAL_KEY_FIRST] = action;
+  }
+}
+
+void action_press(uint key, key_action_t action)
+{
+  uint word = key / 64;
+  uint64_t bit = 1ULL << (key % 64);
+
+  // A key holds one action at a time
+  if (s_held[key].type > KEY_ACTION_NONE) action_release(key);
+
+  s_held[key] = action;
+
+  switch (action.type)
+  {
+    case KEY_ACTION_KEY:
+      s_keycode_keys[word] |= bit;
+      layer_key_used();
+      break;
+
+    case KEY_ACTION_MODIFIER:
+      s_modifier_keys[word] |= bit;
+      action_update_modifiers();
+      layer_key_used();
+      break;
+
+    case KEY_ACTION_LAYER_MOMENTARY:
+    case KEY_ACTION_LAYER_TOGGLE:
+    case KEY_ACTION_LAYER_ONESHOT:
+    case KEY_ACTION_LAYER_DEFAULT:
+      layer_press(action);
+      break;
+
+    case KEY_ACTION_MACRO:
+      macro_play(action.code);
+      layer_key_used();
+      break;
+
+    case KEY_ACTION_MOUSE:
+      s_mouse_keys[word] |= bit;
+      layer_key_used();
+      break;
+
+    case KEY_ACTION_CONSUMER:
+      s_consumer_keys[word] |= bit;
+      s_consumer_last = (uint8_t) key;
+      layer_key_used();
+      break;
+
+    default:
+      break;
+  }
+}
+
+void action_release(uint key)
+{
+  uint word = key / 64;
+  uint64_t bit = 1ULL << (key % 64);
+  key_action_t action = s_held[key];
+
+  s_held[key] = (key_action_t) { KEY_ACTION_NONE, 0 };
+
+  switch (action.type)
+  {
+    case KEY_ACTION_KEY:
+      s_keycode_keys[word] &= ~bit;
+      break;
+
+    case KEY_ACTION_MODIFIER:
+      s_modifier_keys[word] &= ~bit;
+      action_update_modifiers();
+      break;
+
+    case KEY_ACTION_MOUSE:
+      s_mouse_keys[word] &= ~bit;
+      break;
+
+    case KEY_ACTION_CONSUMER:
+      s_consumer_keys[word] &= ~bit;
+      break;
+
+    default:
+      layer_release(action);
+      break;
+  }
+}
+
+uint64_t action_keycode_keys(uint word)
+{
+  return s_keycode_keys[word];
+}
+
+uint8_t action_modifiers(void)
+{
+  return s_modifiers;
+}
+
+uint64_t action_mouse_keys(uint word)
+{
+  return s_mouse_keys[word];
+}
+
+uint16_t action_consumer_usage(void)
+{
+  uint key = s_consumer_last;
+
+  // Back to the lowest key still held once the latest one is released
+  if (!((s_consumer_keys[key / 64] >> (key % 64)) & 1)) {
+    uint word = 0;
+    while (word < KEY_WORDS && s_consumer_keys[word] == 0) word++;
+    if (word == KEY_WORDS) return 0;
+    key = 64 * word + (uint) __builtin_ctzll(s_consumer_keys[word]);
+  }
+
+  uint8_t code = s_held[key].code;
+  return (code < CONSUMER_KEY_COUNT) ? s_consumer_usage[code] : 0;
+}
+
+key_action_t action_held(uint key)
+{
+  return s_held[key];
+}
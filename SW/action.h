@@ -0,0 +1,56 @@
+// Held actions (core0)
+// A key's action is looked up once, on press, and kept until its release, so
+// a layer change while the key is down still releases the keycode it pressed.
+// The HID report is built from the held actions, not from the key state.
+//
+// Key positions 0 .. NUM_ROWS * NUM_COLS - 1 are matrix keys; the remaining
+// bits of the first 64-bit key word (ACTION_VIRTUAL_KEY_FIRST ..) are free for
+// engines that emit an action without a matrix key of their own. With
+// SPLIT_LINK the other half's matrix keys follow in the second word
+// (SPLIT_KEY_FIRST .., split_link.h); the key masks below are per word.
+
+#ifndef ACTION_H_
+#define ACTION_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+#include "matrix_scan.h"
+#include "keymap.h"
+
+#define ACTION_KEY_COUNT          (64 * KEY_WORDS)
+#define ACTION_VIRTUAL_KEY_FIRST  (NUM_ROWS * NUM_COLS)
+#define ACTION_VIRTUAL_KEY_COUNT  (64 - ACTION_VIRTUAL_KEY_FIRST)
+
+// @brief Release everything and reset the layer state
+void action_init(void);
+
+// @brief Action a key press resolves to right now
+// Matrix keys: the effective keymap (layer_action()), virtual keys: their binding
+key_action_t action_resolve(uint key);
+
+// @brief Set the action a virtual key presses, before sending its press
+void action_bind_virtual(uint key, key_action_t action);
+
+// @brief Press a key with its resolved action (see action_resolve()), released by action_release()
+void action_press(uint key, key_action_t action);
+
+// @brief Release whatever action the key is holding
+void action_release(uint key);
+
+// @brief Keys of one key state word currently holding a KEY_ACTION_KEY action
+uint64_t action_keycode_keys(uint word);
+
+// @brief Modifier byte of the held modifier actions
+uint8_t action_modifiers(void);
+
+// @brief Keys of one key state word currently holding a KEY_ACTION_MOUSE action (see mouse_keys.h)
+uint64_t action_mouse_keys(uint word);
+
+// @brief Consumer control usage of the held consumer keys, 0 if none
+// The report carries one usage: the latest press wins while it is held.
+uint16_t action_consumer_usage(void);
+
+// @brief Action held by a key (valid while the key is held)
+key_action_t action_held(uint key);
+
+#endif /* ACTION_H_ */
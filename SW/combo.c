@@ -0,0 +1,192 @@
+// Combo (chord) keys, see combo.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "action.h"
+#include "combo.h"
+#include "keymap.h"
+
+static combo_output_t s_output;
+
+// Held back member key presses, in arrival order
+static key_event_t s_buffer[COMBO_KEYS_MAX];
+static uint        s_buffered;
+static uint64_t    s_pending_keys;
+static uint64_t    s_candidates;    // keys sharing a combo with every pending key
+
+// Sent combos, one per virtual key
+typedef struct
+{
+  uint64_t held;      // member keys still down
+  bool     pressed;   // combo action not released yet
+} combo_active_t;
+
+static combo_active_t s_active[ACTION_VIRTUAL_KEY_COUNT];
+
+static combo_stats_t s_stats;
+
+static void combo_wait_stat(uint32_t time_us)
+{
+  uint32_t wait = time_us - s_buffer[0].time_us;
+  if (wait > s_stats.max_wait_us) s_stats.max_wait_us = wait;
+}
+
+// @brief Send the held back presses unchanged
+static void combo_flush(uint32_t time_us)
+{
+  if (s_buffered == 0) return;
+
+  combo_wait_stat(time_us);
+  s_stats.failed++;
+
+  key_event_t replay[COMBO_KEYS_MAX];
+  uint count = s_buffered;
+  memcpy(replay, s_buffer, count * sizeof(key_event_t));
+  s_buffered = 0;
+  s_pending_keys = 0;
+
+  for (uint i = 0; i < count; ++i) {
+    s_output(&replay[i]);
+  }
+}
+
+// @brief Send the combo matching the held back presses, or flush them
+static void combo_decide(uint32_t time_us)
+{
+  key_combo_t const* combo = keymap_combo_match(s_pending_keys);
+  if (combo == NULL) {
+    combo_flush(time_us);
+    return;
+  }
+
+  uint slot = 0;
+  while (slot < ACTION_VIRTUAL_KEY_COUNT && s_active[slot].held) slot++;
+  if (slot == ACTION_VIRTUAL_KEY_COUNT) {
+    s_stats.overflows++;
+    combo_flush(time_us);
+    return;
+  }
+
+  combo_wait_stat(time_us);
+  s_stats.combos++;
+
+  s_active[slot].held = s_pending_keys;
+  s_active[slot].pressed = true;
+  s_buffered = 0;
+  s_pending_keys = 0;
+
+  uint key = ACTION_VIRTUAL_KEY_FIRST + slot;
+  action_bind_virtual(key, combo->action);
+
+  key_event_t event = { .time_us = time_us, .key = (uint8_t) key, .pressed = 1 };
+  s_output(&event);
+}
+
+// @brief Mask bit of a key, none for the other half's keys (in no combo, they pass through)
+static inline uint64_t combo_key_bit(uint key)
+{
+  return (key < 64) ? (1ULL << key) : 0;
+}
+
+// @brief Release a member key of a sent combo
+// @return false if the key is in no sent combo
+static bool combo_release(key_event_t const* event)
+{
+  uint64_t bit = combo_key_bit(event->key);
+
+  for (uint slot = 0; slot < ACTION_VIRTUAL_KEY_COUNT; ++slot)
+  {
+    combo_active_t* active = &s_active[slot];
+    if (!(active->held & bit)) continue;
+
+    active->held &= ~bit;
+    if (active->pressed) {
+      active->pressed = false;
+      key_event_t release = { .time_us = event->time_us, .key = (uint8_t) (ACTION_VIRTUAL_KEY_FIRST + slot), .pressed = 0 };
+      s_output(&release);
+    }
+    return true;
+  }
+
+  return false;
+}
+
+void combo_init(combo_output_t output)
+{
+  s_output = output;
+  s_buffered = 0;
+  s_pending_keys = 0;
+  memset(s_active, 0, sizeof(s_active));
+  memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void combo_event(key_event_t const* event)
+{
+  uint64_t bit = combo_key_bit(event->key);
+
+  // The term may have passed before combo_task() saw it
+  int32_t term_us = (int32_t) keymap_setting(KEYMAP_SETTING_COMBO_TERM_US);
+  if (s_buffered && (int32_t) (event->time_us - s_buffer[0].time_us) >= term_us) {
+    combo_decide(s_buffer[0].time_us + (uint32_t) term_us);
+  }
+
+  if (!event->pressed)
+  {
+    // Released while held back: a quick chord still counts, anything else goes out as keys
+    // Another key released meanwhile: the held back presses go out ahead of it
+    if (s_pending_keys & bit) {
+      combo_decide(event->time_us);
+    } else {
+      combo_flush(event->time_us);
+    }
+
+    if (!combo_release(event)) s_output(event);
+    return;
+  }
+
+  if (!(keymap_combo_keys() & bit)) {
+    combo_flush(event->time_us);
+    s_output(event);
+    return;
+  }
+
+  uint64_t candidates = keymap_combo_partners(event->key);
+  if (s_buffered) candidates &= s_candidates;
+
+  // No combo holds every pending key and this one: the old ones go out, this starts over
+  uint64_t keys = s_pending_keys | bit;
+  if ((keys & ~candidates) || s_buffered == COMBO_KEYS_MAX) {
+    combo_flush(event->time_us);
+    keys = bit;
+    candidates = keymap_combo_partners(event->key);
+  }
+
+  s_buffer[s_buffered++] = *event;
+  s_pending_keys = keys;
+  s_candidates = candidates;
+
+  // Nothing larger can match any more
+  if (candidates == keys) {
+    combo_decide(event->time_us);
+  }
+}
+
+void combo_task(uint32_t now_us)
+{
+  if (s_buffered && (int32_t) (now_us - s_buffer[0].time_us) >= (int32_t) keymap_setting(KEYMAP_SETTING_COMBO_TERM_US)) {
+    combo_decide(now_us);
+  }
+}
+
+uint64_t combo_keys(void)
+{
+  return keymap_combo_keys();
+}
+
+combo_stats_t const* combo_stats(void)
+{
+  return &s_stats;
+}
@@ -0,0 +1,62 @@
+// Combo (chord) keys (core0)
+// Pressing all member keys of a combo (2 to 4 keys, keymap.json "combos")
+// within COMBO_TERM_US of the first one sends the combo action instead of
+// the keys. Presses of combo member keys are held back until:
+//   - the pressed keys match a combo and no larger combo can still match
+//     -> combo press on a virtual key (ACTION_VIRTUAL_KEY_FIRST ..)
+//   - COMBO_TERM_US after the first press, or a held back key is released
+//     -> combo press if they match one
+//   - a key outside every candidate combo is pressed, another key is
+//     released, or the term passes / a held back key is released without a match
+//     -> the held back presses go out unchanged, in order
+// The combo is released with its first released member key, the other
+// members' releases are dropped.
+//
+// Combos are bitmasks in the key state layout (row * NUM_COLS + col), sorted
+// by lowest member key: a transition only compares the pending mask against
+// the combos starting at its lowest key, and the per-scan cost is one time
+// check, whatever the number of combos.
+
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+#include "key_event.h"
+
+// Default of KEYMAP_SETTING_COMBO_TERM_US
+#ifndef COMBO_TERM_US
+#define COMBO_TERM_US   50000
+#endif
+
+// Longest setting, the term is compared as a signed time difference
+#define COMBO_TERM_LIMIT_US  1000000
+
+// Most member keys of one combo (keymap_gen.py checks it)
+#define COMBO_KEYS_MAX  4
+
+typedef void (*combo_output_t)(key_event_t const* event);
+
+typedef struct
+{
+  uint32_t combos;        // combo presses sent
+  uint32_t failed;        // held back presses sent unchanged
+  uint32_t max_wait_us;   // first member press -> decision, worst case
+  uint32_t overflows;     // chords sent as keys for lack of a free virtual key
+} combo_stats_t;
+
+// @brief Reset, transitions go on to output (tap_hold_event())
+void combo_init(combo_output_t output);
+
+// @brief Feed a debounced key transition
+void combo_event(key_event_t const* event);
+
+// @brief Decide held back keys whose combo term has passed
+void combo_task(uint32_t now_us);
+
+// @brief Keys that are members of a combo
+uint64_t combo_keys(void);
+
+combo_stats_t const* combo_stats(void);
+
+#endif /* COMBO_H_ */
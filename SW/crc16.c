@@ -0,0 +1,18 @@
+// CRC-16/CCITT, see crc16.h
+
+#include "crc16.h"
+
+uint16_t crc16(uint16_t crc, uint8_t const* data, uint32_t len)
+{
+  // A nibble at a time: a 32 byte table instead of 512
+  static uint16_t const table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+  };
+
+  for (uint32_t i = 0; i < len; ++i) {
+    crc = (uint16_t) ((crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)]);
+    crc = (uint16_t) ((crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0f)]);
+  }
+  return crc;
+}
@@ -0,0 +1,13 @@
+// CRC-16/CCITT (polynomial 0x1021, no reflection), shared by the flash store
+// records (store.c) and the split link frames (split_link.c)
+
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+// @brief Continue crc over data, start with 0xffff
+uint16_t crc16(uint16_t crc, uint8_t const* data, uint32_t len);
+
+#endif /* CRC16_H_ */
@@ -0,0 +1,76 @@
+// Bit-parallel per-key debounce, see debounce.h
+
+#include <string.h>
+
+#include "debounce.h"
+
+void debounce_init(debounce_t* db, debounce_mode_t mode, uint8_t samples)
+{
+  memset(db, 0, sizeof(*db));
+
+  for (uint key = 0; key < 64; ++key) {
+    debounce_set_key(db, key, mode, samples);
+  }
+}
+
+void debounce_set_key(debounce_t* db, uint key, debounce_mode_t mode, uint8_t samples)
+{
+  uint64_t bit = 1ULL << key;
+
+  if (samples < 1) samples = 1;
+  if (samples > DEBOUNCE_MAX_SAMPLES) samples = DEBOUNCE_MAX_SAMPLES;
+
+  if (mode == DEBOUNCE_EAGER) {
+    db->eager |= bit;
+  } else {
+    db->eager &= ~bit;
+  }
+
+  for (uint n = 0; n < DEBOUNCE_COUNTER_BITS; ++n) {
+    // restart any count in progress with the new setting
+    db->cnt[n] &= ~bit;
+
+    if (samples & (1u << n)) {
+      db->limit[n] |= bit;
+    } else {
+      db->limit[n] &= ~bit;
+    }
+  }
+}
+
+uint64_t debounce_update(debounce_t* db, uint64_t raw)
+{
+  uint64_t const eager    = db->eager;
+  uint64_t const deferred = ~eager;
+  uint64_t const diff     = raw ^ db->stable;
+
+  uint64_t locked = 0;
+  for (uint n = 0; n < DEBOUNCE_COUNTER_BITS; ++n) {
+    locked |= db->cnt[n];
+  }
+
+  // Deferred keys that are back at the stable level restart their count
+  uint64_t const reset = deferred & ~diff;
+  // Deferred keys count differing samples, eager keys count lock-out samples
+  uint64_t const inc   = (deferred & diff) | (eager & (locked | diff));
+
+  uint64_t carry = inc;
+  uint64_t equal = ~0ULL;
+  for (uint n = 0; n < DEBOUNCE_COUNTER_BITS; ++n) {
+    uint64_t c = db->cnt[n] & ~reset;
+    db->cnt[n] = c ^ carry;
+    carry &= c;
+    equal &= ~(db->cnt[n] ^ db->limit[n]);
+  }
+
+  // Counted up to N this sample
+  uint64_t const done = inc & equal;
+  for (uint n = 0; n < DEBOUNCE_COUNTER_BITS; ++n) {
+    db->cnt[n] &= ~done;
+  }
+
+  // Deferred keys commit at N, eager keys commit on the first unlocked edge
+  db->stable ^= (deferred & done) | (eager & diff & ~locked);
+
+  return db->stable;
+}
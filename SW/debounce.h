@@ -0,0 +1,47 @@
+// Bit-parallel per-key debounce
+// All 64 keys are processed at once with vertical counters: counter bit n of
+// every key lives in cnt[n], so one scan costs a fixed handful of word ops.
+//
+// Modes (per key):
+// - DEBOUNCE_EAGER    : report the first edge immediately, then ignore the key
+//                       for N samples (the edge sample included)
+// - DEBOUNCE_DEFERRED : report a change only after N consecutive samples that
+//                       differ from the debounced state
+
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+// Counter width, max samples per key = (1 << DEBOUNCE_COUNTER_BITS) - 1
+#define DEBOUNCE_COUNTER_BITS  5
+#define DEBOUNCE_MAX_SAMPLES   ((1u << DEBOUNCE_COUNTER_BITS) - 1)
+
+typedef enum
+{
+  DEBOUNCE_EAGER = 0,
+  DEBOUNCE_DEFERRED
+} debounce_mode_t;
+
+typedef struct
+{
+  uint64_t stable;                           // debounced key state
+  uint64_t eager;                            // keys in DEBOUNCE_EAGER mode
+  uint64_t cnt[DEBOUNCE_COUNTER_BITS];       // vertical counter planes
+  uint64_t limit[DEBOUNCE_COUNTER_BITS];     // per-key N as bit planes
+} debounce_t;
+
+// @brief Reset state and apply one mode / sample count to every key
+void debounce_init(debounce_t* db, debounce_mode_t mode, uint8_t samples);
+
+// @brief Change the mode / sample count of one key
+// @param key key state bit position (row * NUM_COLS + col)
+// @param samples 1..DEBOUNCE_MAX_SAMPLES, clamped
+void debounce_set_key(debounce_t* db, uint key, debounce_mode_t mode, uint8_t samples);
+
+// @brief Feed one raw matrix sample
+// @return debounced key state
+uint64_t debounce_update(debounce_t* db, uint64_t raw);
+
+#endif /* DEBOUNCE_H_ */
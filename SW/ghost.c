@@ -0,0 +1,111 @@
+// Ghost key filter, see ghost.h
+
+#include "ghost.h"
+
+#if GHOST_DETECT
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "keymap_table.h"   // KEYMAP_DIODELESS_MASK, generated from keymap.json
+
+#define ROW_COL_MASK  ((1u << NUM_COLS) - 1)
+
+// Keys whose switch may conduct backwards
+#if KEYMAP_DIODELESS_MASK
+#define GHOST_SUSPECT_MASK  KEYMAP_DIODELESS_MASK
+#else
+#define GHOST_SUSPECT_MASK  ((1ULL << (NUM_ROWS * NUM_COLS)) - 1)
+#endif
+
+// Samples a rectangle's keys stay held after it is gone: a corner bouncing
+// while it is pressed or released can drop out of many samples in a row
+#define GHOST_SETTLE_SAMPLES  8
+
+static uint64_t s_sample = 0;   // previous sample
+static uint64_t s_state = 0;    // previous result
+static uint64_t s_region = 0;   // keys of the rectangles since the last settled sample
+static uint s_settle = 0;       // samples left until s_region is released
+static ghost_stats_t s_stats;
+
+void ghost_init(void)
+{
+  s_sample = 0;
+  s_state = 0;
+  s_region = 0;
+  s_settle = 0;
+  s_stats = (ghost_stats_t) { 0 };
+}
+
+ghost_stats_t const* ghost_stats(void)
+{
+  return &s_stats;
+}
+
+uint64_t ghost_filter(uint64_t sample)
+{
+  // Checked on this sample and the previous one together: a corner that
+  // bounces can be open when its own column is sampled and closed when the
+  // phantom's column is, leaving the phantom without its rectangle.
+  uint64_t prev = s_sample;
+  uint64_t seen = sample | prev;
+  s_sample = sample;
+
+  // A phantom shares its column with a key down: with one key at most
+  // there is nothing to check. Almost every sample stops here.
+  if ((seen & (seen - 1)) == 0 && s_settle == 0) {
+    s_state = sample;
+    return sample;
+  }
+
+  // Column mask per row, straight out of the packed state, and the columns
+  // with keys down in two rows or more
+  uint32_t rows[NUM_ROWS];
+  uint32_t suspect[NUM_ROWS];
+  uint32_t once = 0;
+  uint32_t twice = 0;
+  for (uint row = 0; row < NUM_ROWS; ++row) {
+    rows[row]    = (uint32_t) (seen >> (row * NUM_COLS)) & ROW_COL_MASK;
+    suspect[row] = (uint32_t) (GHOST_SUSPECT_MASK >> (row * NUM_COLS)) & ROW_COL_MASK;
+    twice |= once & rows[row];
+    once  |= rows[row];
+  }
+
+  // Two rows sharing two or more columns (common & (common - 1) != 0, no
+  // popcount needed), with a corner that may lack its diode
+  uint64_t ambiguous = 0;
+  for (uint i = 0; i < NUM_ROWS - 1; ++i) {
+    for (uint j = i + 1; j < NUM_ROWS; ++j) {
+      uint32_t common = rows[i] & rows[j];
+      if ((common & (common - 1)) && (common & (suspect[i] | suspect[j]))) {
+        ambiguous |= ((uint64_t) common << (i * NUM_COLS)) | ((uint64_t) common << (j * NUM_COLS));
+      }
+    }
+  }
+
+  // A new key sharing its column with a key down may be a phantom whose
+  // other two corners bounced open when their own column was sampled: it
+  // waits until a rectangle shows up or the region settles
+  uint64_t fresh = sample & ~prev & ~s_state;
+  if (fresh && (seen & GHOST_SUSPECT_MASK)) {
+    for (uint row = 0; row < NUM_ROWS; ++row) {
+      ambiguous |= (uint64_t) (rows[row] & twice) << (row * NUM_COLS) & fresh;
+    }
+  }
+
+  if (ambiguous) {
+    s_stats.frames++;
+    s_region |= ambiguous;
+    s_settle = GHOST_SETTLE_SAMPLES;
+  } else if (s_settle && --s_settle == 0) {
+    s_region = 0;
+  }
+
+  uint64_t state = (sample & ~s_region) | (s_state & s_region);
+  if (state != sample) s_stats.held++;
+
+  s_state = state;
+  return state;
+}
+
+#endif // GHOST_DETECT
@@ -0,0 +1,55 @@
+// Ghost key filter (core1)
+// Without a working diode on every switch, three keys on the corners of a
+// rectangle (two rows sharing two columns) make the fourth corner read as
+// pressed too. A frame with such a rectangle cannot tell the phantom from a
+// real fourth key, so every key down on the shared columns of those two rows
+// keeps its previous state until the rectangle has been gone for a few
+// samples. A new key sharing its column with a key down waits as long, in
+// case its rectangle is hidden by a bouncing corner.
+//
+// Built only with GHOST_DETECT=1 (CMake option GHOST_DETECT); otherwise
+// ghost_filter() is an empty inline. Only rectangles with a corner in
+// KEYMAP_DIODELESS_MASK (keymap.json "diodeless", matrix positions from the
+// KLE layout) are held back; with no switch listed every key is suspect.
+
+#ifndef GHOST_H_
+#define GHOST_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+#ifndef GHOST_DETECT
+#define GHOST_DETECT  0
+#endif
+
+typedef struct
+{
+  uint32_t frames;   // samples with a rectangle
+  uint32_t held;     // samples in which a key down was held back
+} ghost_stats_t;
+
+#if GHOST_DETECT
+
+// @brief Forget the previous state, call on core1 before the first sample
+void ghost_init(void);
+
+// @brief Filter one matrix sample
+// @return the sample, keys of an ambiguous rectangle at their previous state
+uint64_t ghost_filter(uint64_t sample);
+
+ghost_stats_t const* ghost_stats(void);
+
+#else
+
+static inline void ghost_init(void)
+{
+}
+
+static inline uint64_t ghost_filter(uint64_t sample)
+{
+  return sample;
+}
+
+#endif
+
+#endif /* GHOST_H_ */
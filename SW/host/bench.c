@@ -0,0 +1,884 @@
+// kb_bench: end-to-end latency benchmark on the host simulation
+//
+// Generates bouncy keystrokes, runs them through the firmware (sim.h) and
+// matches every NKRO report bit change with the physical transition that
+// caused it. Latency = host receive time - first contact edge.
+// Prints p50/p99/max latency, reports per second, spurious transitions and
+// scheduler misses per scenario, then the host cost of one matrix scan and
+// of building a report by walking the matrix vs key_iter_next(), and the
+// simulated time of one scan with no key and with a key down.
+// Power (power.h): presses after SCAN_SLOW_AFTER_US idle (slow scan rate),
+// and presses during USB suspend, timed edge -> tud_remote_wakeup() and
+// edge -> report once the host has resumed, with the share of time core1
+// spent at the slow rate / asleep.
+// Combos: a combo key held back while Shift is released must still reach
+// the host first.
+// Ghost keys: three corners of a rectangle held on a matrix without diodes,
+// a report of the fourth counts as spurious (filtered with GHOST_DETECT=1).
+// The firmware's own per-stage histograms (latency.h) are printed alongside
+// as log2 bucket upper bounds, to cross-check the on-device numbers, and with
+// SOF_SYNC the USB frame phase lock (sof_sync.h): poll offset, scan lead and
+// the average debounce commit -> poll wait.
+// Split link (SPLIT_LINK=1, split_link.h): the same typing on this half and
+// on the other half, whose samples come over the simulated UART; the p50
+// difference is the latency the link adds. Then again with byte errors, with
+// the frames retransmitted and the keys missed.
+//
+// usage: kb_bench [keystrokes] [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "pico/time.h"
+
+#include "usb_descriptors.h"
+#include "matrix_scan.h"
+#include "debounce.h"
+#include "keyboard.h"
+#include "combo.h"
+#include "keymap.h"
+#include "mouse_keys.h"
+#include "latency.h"
+#include "power.h"
+#include "ghost.h"
+#include "sof_sync.h"
+#include "split_link.h"
+#include "key_iter_bench.h"
+#include "sim.h"
+
+#define MAX_BOUNCES      4
+#define BOUNCE_MAX_US    1500    // chatter settles within this, below the debounce time
+#define SETTLE_US        50000   // idle time after a scenario
+#define MATRIX_KEYS      (NUM_ROWS * NUM_COLS)   // key state bit positions of this half
+#define BENCH_KEYS       KEYMAP_KEYS             // and of the other half, SPLIT_LINK builds
+
+//--------------------------------------------------------------------+
+// Scenario generation
+//--------------------------------------------------------------------+
+
+static uint32_t s_rng = 1;
+
+static uint32_t rand_next(void)
+{
+  // xorshift32, deterministic across hosts
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return s_rng;
+}
+
+static uint32_t rand_range(uint32_t lo, uint32_t hi)
+{
+  return lo + rand_next() % (hi - lo + 1);
+}
+
+// Keys with a unique plain keycode on the base layer
+// Combo members are left out, they wait for COMBO_TERM_US by design
+static uint8_t s_keys[MATRIX_KEYS];
+static uint    s_key_count = 0;
+static uint8_t s_key_of_kc[256];
+static bool    s_is_key[BENCH_KEYS];
+#if SPLIT_LINK
+static uint8_t s_left_keys[MATRIX_KEYS];   // the same, on the other half
+static uint    s_left_key_count = 0;
+#endif
+
+static void keys_init(void)
+{
+  bool used[256] = { false };
+
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    uint8_t kc = keyboard_keycode(0, key);
+    if (kc == 0 || kc >= HID_KEY_CONTROL_LEFT || used[kc] || (key < 64 && ((combo_keys() >> key) & 1))) continue;
+
+    used[kc] = true;
+    s_key_of_kc[kc] = (uint8_t) key;
+    s_is_key[key] = true;
+#if SPLIT_LINK
+    if (key >= SPLIT_KEY_FIRST) {
+      s_left_keys[s_left_key_count++] = (uint8_t) key;
+      continue;
+    }
+#endif
+    s_keys[s_key_count++] = (uint8_t) key;
+  }
+}
+
+// Expected transitions per key, in order
+typedef struct
+{
+  uint64_t* time_us;
+  bool*     pressed;
+  uint      head, tail;
+} expect_fifo_t;
+
+static expect_fifo_t s_expect[BENCH_KEYS];
+
+// @brief Add a physical transition with random bounce
+static void key_transition(uint64_t t_us, uint key, bool closed)
+{
+  uint bounces = rand_range(0, MAX_BOUNCES);
+  uint64_t t = t_us;
+
+  sim_key_edge(t, key, closed);
+  for (uint i = 0; i < bounces; ++i) {
+    t += rand_range(20, BOUNCE_MAX_US / (2 * MAX_BOUNCES));
+    sim_key_edge(t, key, !closed);
+    t += rand_range(20, BOUNCE_MAX_US / (2 * MAX_BOUNCES));
+    sim_key_edge(t, key, closed);
+  }
+
+  expect_fifo_t* fifo = &s_expect[key];
+  fifo->time_us[fifo->head] = t_us;
+  fifo->pressed[fifo->head] = closed;
+  fifo->head++;
+}
+
+// @brief One key at a time out of keys[], like slow typing
+static uint64_t typing(uint64_t start_us, uint count, uint8_t const* keys, uint key_count)
+{
+  uint64_t t = start_us;
+
+  for (uint i = 0; i < count; ++i) {
+    uint key = keys[rand_range(0, key_count - 1)];
+    uint64_t hold = rand_range(30000, 120000);
+
+    key_transition(t, key, true);
+    key_transition(t + hold, key, false);
+    t += hold + rand_range(10000, 80000);
+  }
+
+  return t;
+}
+
+static uint64_t scenario_typing(uint64_t start_us, uint count)
+{
+  return typing(start_us, count, s_keys, s_key_count);
+}
+
+#if SPLIT_LINK
+// @brief Typing on the other half
+static uint64_t scenario_left(uint64_t start_us, uint count)
+{
+  return typing(start_us, count, s_left_keys, s_left_key_count);
+}
+#endif
+
+// @brief Overlapping keystrokes: press the next key before releasing the last
+static uint64_t scenario_rolls(uint64_t start_us, uint count)
+{
+  uint64_t t = start_us;
+  uint prev = MATRIX_KEYS;
+
+  for (uint i = 0; i < count; ++i) {
+    uint key;
+    do {
+      key = s_keys[rand_range(0, s_key_count - 1)];
+    } while (key == prev);
+
+    key_transition(t, key, true);
+    uint64_t overlap = rand_range(5000, 30000);
+    if (prev != MATRIX_KEYS) key_transition(t + overlap, prev, false);
+
+    prev = key;
+    t += overlap + rand_range(15000, 60000);
+  }
+
+  if (prev != MATRIX_KEYS) key_transition(t, prev, false);
+
+  return t;
+}
+
+// @brief Single keystrokes, each after the scan rate has dropped to SCAN_SLOW_PERIOD_US
+static uint64_t scenario_idle(uint64_t start_us, uint count)
+{
+  uint64_t t = start_us;
+
+  for (uint i = 0; i < count; ++i) {
+    uint key = s_keys[rand_range(0, s_key_count - 1)];
+    uint64_t hold = rand_range(30000, 120000);
+
+    t += SCAN_SLOW_AFTER_US + rand_range(0, 1000000);
+    key_transition(t, key, true);
+    key_transition(t + hold, key, false);
+    t += hold;
+  }
+
+  return t;
+}
+
+// @brief Three corners of a rectangle held together
+// Run with sim_diodeless(): the fourth corner reads as pressed while all three
+// are down, any report of it counts as spurious.
+static uint64_t scenario_ghost(uint64_t start_us, uint count)
+{
+  uint64_t t = start_us;
+
+  // count keystrokes, three per rectangle
+  for (uint i = 0; i + 3 <= count; i += 3) {
+    uint corners[4];
+    bool usable;
+    do {
+      uint r1 = rand_range(0, NUM_ROWS - 1), r2 = rand_range(0, NUM_ROWS - 1);
+      uint c1 = rand_range(0, NUM_COLS - 1), c2 = rand_range(0, NUM_COLS - 1);
+      corners[0] = r1 * NUM_COLS + c1;
+      corners[1] = r1 * NUM_COLS + c2;
+      corners[2] = r2 * NUM_COLS + c1;
+      corners[3] = r2 * NUM_COLS + c2;
+
+      usable = (r1 != r2) && (c1 != c2);
+      for (uint c = 0; c < 4; ++c) usable = usable && s_is_key[corners[c]];
+    } while (!usable);
+
+    // Any three of the four, pressed and released in a random order
+    uint phantom = rand_range(0, 3);
+    uint64_t press = t, release = t + rand_range(100000, 200000);
+    for (uint c = 0; c < 4; ++c) {
+      if (c == phantom) continue;
+      press   += rand_range(10000, 40000);
+      release += rand_range(10000, 40000);
+      key_transition(press, corners[c], true);
+      key_transition(release, corners[c], false);
+    }
+    t = release + rand_range(30000, 80000);
+  }
+
+  return t;
+}
+
+//--------------------------------------------------------------------+
+// Report matching
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint32_t* press;
+  uint32_t* release;
+  uint      press_count, release_count, capacity;
+  uint      reports;
+  uint      spurious;
+} bench_result_t;
+
+static bench_result_t s_result;
+static uint8_t s_host_bitmap[NKRO_KEYCODE_COUNT / 8];
+
+// Aux reports seen by the host (bench_mouse())
+typedef struct
+{
+  int32_t   x, y;            // cursor motion summed
+  uint      reports;         // mouse reports
+  bool      first;           // next mouse report starts a stroke
+  uint64_t  last_us;         // time of the last mouse report
+  uint32_t* interval;        // between mouse reports while moving
+  uint      interval_count, interval_capacity;
+  int       last_dx;         // x of the last report
+  uint      step_change_max; // |x - last x| between reports while moving
+  uint      consumer;        // consumer control reports
+  uint16_t  usage;           // last consumer usage
+} bench_aux_t;
+
+static bench_aux_t s_aux;
+
+// Held back combo key against a modifier (bench_combo())
+typedef struct
+{
+  uint8_t   kc;              // combo key checked, 0 = off
+  uint8_t   modifier;        // KEYBOARD_MODIFIER_* that must still be down
+  uint8_t   chord_kc;        // the combo's keycode, not a scripted key
+  uint      presses;         // reports with kc newly set
+  uint      wrong;           // ... after the modifier was already released
+} bench_combo_t;
+
+static bench_combo_t s_combo;
+
+static void on_aux_report(uint64_t time_us, uint8_t report_id, uint8_t const* data, uint16_t len)
+{
+  if (report_id == REPORT_ID_CONSUMER_CONTROL && len == sizeof(uint16_t)) {
+    s_aux.consumer++;
+    s_aux.usage = (uint16_t) (data[0] | (data[1] << 8));
+    return;
+  }
+  if (report_id != REPORT_ID_MOUSE || len != sizeof(hid_mouse_report_t)) return;
+
+  hid_mouse_report_t const* report = (hid_mouse_report_t const*) data;
+  if (!s_aux.first && s_aux.interval_count < s_aux.interval_capacity) {
+    s_aux.interval[s_aux.interval_count++] = (uint32_t) (time_us - s_aux.last_us);
+    uint change = (uint) abs(report->x - s_aux.last_dx);
+    if (change > s_aux.step_change_max) s_aux.step_change_max = change;
+  }
+  s_aux.x += report->x;
+  s_aux.y += report->y;
+  s_aux.reports++;
+  s_aux.first = false;
+  s_aux.last_us = time_us;
+  s_aux.last_dx = report->x;
+}
+
+static void on_report(uint64_t time_us, uint8_t instance, uint8_t report_id,
+                      uint8_t const* data, uint16_t len)
+{
+  if (instance == HID_INSTANCE_AUX) {
+    on_aux_report(time_us, report_id, data, len);
+    return;
+  }
+  if (instance != HID_INSTANCE_NKRO || len != sizeof(hid_nkro_report_t)) return;
+
+  hid_nkro_report_t const* report = (hid_nkro_report_t const*) data;
+  s_result.reports++;
+
+  if (s_combo.kc != 0) {
+    uint8_t bit = (uint8_t) (1u << (s_combo.kc & 7));
+    if ((report->bitmap[s_combo.kc >> 3] & bit) && !(s_host_bitmap[s_combo.kc >> 3] & bit)) {
+      s_combo.presses++;
+      if (!(report->modifier & s_combo.modifier)) s_combo.wrong++;
+    }
+  }
+
+  for (uint i = 0; i < sizeof(s_host_bitmap); ++i)
+  {
+    uint8_t changed = report->bitmap[i] ^ s_host_bitmap[i];
+    while (changed)
+    {
+      uint bit = (uint) __builtin_ctz(changed);
+      changed &= changed - 1;
+
+      uint kc = i * 8 + bit;
+      bool pressed = (report->bitmap[i] >> bit) & 1;
+      if (s_combo.kc != 0 && kc == s_combo.chord_kc) continue;
+      expect_fifo_t* fifo = &s_expect[s_key_of_kc[kc]];
+
+      // A ghost key can report a key ahead of its own scripted press
+      if (fifo->tail == fifo->head || fifo->pressed[fifo->tail] != pressed ||
+          fifo->time_us[fifo->tail] > time_us) {
+        s_result.spurious++;
+        continue;
+      }
+
+      uint32_t latency = (uint32_t) (time_us - fifo->time_us[fifo->tail]);
+      fifo->tail++;
+      if (pressed) {
+        s_result.press[s_result.press_count++] = latency;
+      } else {
+        s_result.release[s_result.release_count++] = latency;
+      }
+    }
+    s_host_bitmap[i] = report->bitmap[i];
+  }
+}
+
+static int u32_compare(void const* a, void const* b)
+{
+  uint32_t x = *(uint32_t const*) a;
+  uint32_t y = *(uint32_t const*) b;
+  return (x > y) - (x < y);
+}
+
+static void print_latency(char const* name, uint32_t* samples, uint count)
+{
+  if (count == 0) {
+    printf("  %-8s  no samples\n", name);
+    return;
+  }
+
+  qsort(samples, count, sizeof(uint32_t), u32_compare);
+  printf("  %-8s  p50 %6u us  p99 %6u us  max %6u us  (n=%u)\n", name,
+         samples[count / 2], samples[(count * 99) / 100], samples[count - 1], count);
+}
+
+// @brief Upper bound of the log2 bucket holding the given fraction of the samples
+static uint32_t hist_bound_us(latency_hist_t const* hist, double fraction)
+{
+  uint32_t total = 0;
+  for (uint i = 0; i < LATENCY_BUCKETS; ++i) total += hist->buckets[i];
+
+  uint32_t seen = 0;
+  for (uint i = 0; i < LATENCY_BUCKETS - 1; ++i) {
+    seen += hist->buckets[i];
+    if (seen > total * fraction) return 1u << i;
+  }
+  return hist->max_us;
+}
+
+static void print_device_latency(void)
+{
+  static char const* const names[LATENCY_STAGE_COUNT] = { "debounce", "handoff", "queue", "usb", "e2e" };
+  latency_stats_t const* stats = latency_stats();
+
+  printf("  device    p50 bucket <");
+  for (uint stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+    printf(" %s %u", names[stage], hist_bound_us(&stats->stages[stage], 0.5));
+  }
+  printf(" us, e2e max %u us, queue depth max events %u reports %u\n",
+         stats->stages[LATENCY_END_TO_END].max_us, stats->event_queue_max, stats->report_queue_max);
+}
+
+// @brief Clear the results and expected transitions for up to count keystrokes
+static void results_reset(uint count)
+{
+  free(s_result.press);
+  free(s_result.release);
+  memset(&s_result, 0, sizeof(s_result));
+  s_result.capacity = 2 * count + 2;
+  s_result.press    = calloc(s_result.capacity, sizeof(uint32_t));
+  s_result.release  = calloc(s_result.capacity, sizeof(uint32_t));
+
+  // Every keystroke could land on the same key
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    expect_fifo_t* fifo = &s_expect[key];
+    free(fifo->time_us);
+    free(fifo->pressed);
+    fifo->time_us = calloc(s_result.capacity, sizeof(uint64_t));
+    fifo->pressed = calloc(s_result.capacity, sizeof(bool));
+    fifo->head = fifo->tail = 0;
+  }
+}
+
+static void run_scenario(char const* name, uint64_t (*scenario)(uint64_t, uint), uint count)
+{
+  results_reset(count);
+
+  uint stage_count[2];
+  sched_stage_t const* stages[2] = { sim_stages(0, &stage_count[0]), sim_stages(1, &stage_count[1]) };
+  uint misses_before = 0;
+  for (uint c = 0; c < 2; ++c) {
+    for (uint i = 0; i < stage_count[c]; ++i) misses_before += stages[c][i].misses;
+  }
+
+  latency_clear();
+  uint64_t slow_scan_before = power_stats()->slow_scan_us;
+#if SOF_SYNC
+  sof_sync_stats_t sync_before = *sof_sync_stats();
+#endif
+
+  uint64_t start_us = sim_now() + SETTLE_US;
+  uint64_t end_us = scenario(start_us, count) + SETTLE_US;
+  sim_run_until(end_us);
+
+  uint misses = 0;
+  for (uint c = 0; c < 2; ++c) {
+    for (uint i = 0; i < stage_count[c]; ++i) misses += stages[c][i].misses;
+  }
+
+  uint pending = 0;
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    pending += s_expect[key].head - s_expect[key].tail;
+  }
+
+  double seconds = (double) (end_us - start_us) / 1e6;
+  printf("%s: %u keystrokes, %.1f s simulated\n", name, count, seconds);
+  print_latency("press", s_result.press, s_result.press_count);
+  print_latency("release", s_result.release, s_result.release_count);
+  printf("  reports   %.1f /s  spurious %u  missed %u  sched misses %u\n",
+         s_result.reports / seconds, s_result.spurious, pending, misses - misses_before);
+  print_device_latency();
+
+#if SOF_SYNC
+  sof_sync_stats_t const* sync = sof_sync_stats();
+  uint32_t phase_count = sync->phase_count - sync_before.phase_count;
+  if (phase_count != 0) {
+    printf("  usb sync  poll at SOF +%u us, scan lead %u us, commit -> poll avg %.0f us (n=%u)\n",
+           sync->poll_offset_us, SOF_SYNC_REPORT_LEAD_US + SOF_SYNC_GUARD_US + sync->scan_us,
+           (double) (sync->phase_sum_us - sync_before.phase_sum_us) / phase_count, phase_count);
+  }
+#endif
+
+  uint64_t slow_scan_us = power_stats()->slow_scan_us - slow_scan_before;
+  if (slow_scan_us != 0) {
+    printf("  power     scan at %u us for %.1f%% of the time\n", SCAN_SLOW_PERIOD_US,
+           100.0 * (double) slow_scan_us / (double) (end_us - start_us));
+  }
+}
+
+// @brief Keystrokes during USB suspend, each wakes the host
+static void bench_suspend(uint count)
+{
+  results_reset(count);
+  uint32_t* wakeup = calloc(count, sizeof(uint32_t));
+  uint wakeups = 0;
+
+  power_stats_t before = *power_stats();
+  uint64_t start_us = sim_now();
+  uint64_t suspended_us = 0;
+
+  for (uint i = 0; i < count; ++i) {
+    uint64_t suspend_us = sim_now();
+    sim_usb_suspend(true);
+
+    uint key = s_keys[rand_range(0, s_key_count - 1)];
+    uint64_t t = suspend_us + rand_range(10000, 50000);
+    key_transition(t, key, true);
+    key_transition(t + SIM_RESUME_US + rand_range(30000, 120000), key, false);
+
+    sim_run_until(t + SIM_RESUME_US + 200000);
+
+    uint64_t wakeup_us = sim_remote_wakeup_time();
+    if (wakeup_us >= t) {
+      wakeup[wakeups++] = (uint32_t) (wakeup_us - t);
+      suspended_us += wakeup_us + SIM_RESUME_US - suspend_us;
+    }
+  }
+
+  power_stats_t const* after = power_stats();
+  uint pending = 0;
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    pending += s_expect[key].head - s_expect[key].tail;
+  }
+
+  printf("suspend: %u keystrokes, %.1f s simulated, %.1f s suspended\n", count,
+         (double) (sim_now() - start_us) / 1e6, (double) suspended_us / 1e6);
+  print_latency("wakeup", wakeup, wakeups);
+  print_latency("press", s_result.press, s_result.press_count);
+  print_latency("release", s_result.release, s_result.release_count);
+  printf("  power     core1 asleep %.1f%% of the suspended time, %u sleeps, %u row edge wakes, "
+         "device wake latency max %u us, missed %u\n",
+         suspended_us ? 100.0 * (double) (after->sleep_us - before.sleep_us) / (double) suspended_us : 0.0,
+         after->sleeps - before.sleeps, after->wakes - before.wakes, after->wake_latency_max_us, pending);
+
+  free(wakeup);
+}
+
+// @brief Cursor distance (px) of a movement key held for held_us, from the
+// acceleration curve in the keymap settings (mouse_keys.h), plus the nudge
+static double mouse_expected_px(double held_us)
+{
+  double min = keymap_setting(KEYMAP_SETTING_MOUSE_SPEED_MIN);
+  double max = keymap_setting(KEYMAP_SETTING_MOUSE_SPEED_MAX);
+  double accel = keymap_setting(KEYMAP_SETTING_MOUSE_ACCEL_US) / 1e6;
+  double curve = keymap_setting(KEYMAP_SETTING_MOUSE_CURVE);
+  double t = held_us / 1e6;
+
+  if (max <= min) return 1.0 + min * t;
+  double ramp = (t < accel) ? t : accel;
+  double px = min * ramp + (max - min) * accel / (curve + 1) * pow(ramp / accel, curve + 1);
+  if (t > accel) px += max * (t - accel);
+  return 1.0 + px;
+}
+
+// @brief Mouse keys held under MO(1) while typing through the layer, then a consumer key tap
+// Prints the mouse report interval and the largest jump of the per-report
+// step while moving, the distance against the acceleration curve, and the
+// latency of the keystrokes typed meanwhile (the keyboard endpoint is separate).
+// Binds MS_RIGHT / MS_DOWN / VOLUME_UP on layer 1 (O / I / F12) for the
+// scenario, the default keymap has none.
+static void bench_mouse(uint count)
+{
+  uint layer_key = MATRIX_KEYS;
+  for (uint key = 0; key < MATRIX_KEYS; ++key) {
+    key_action_t base = keymap_action(0, key);
+    if (base.type == KEY_ACTION_LAYER_MOMENTARY && base.code == 1) layer_key = key;
+  }
+  uint right = s_key_of_kc[HID_KEY_O], down = s_key_of_kc[HID_KEY_I], volume = s_key_of_kc[HID_KEY_F12];
+  if (layer_key == MATRIX_KEYS || !s_is_key[right] || !s_is_key[down] || !s_is_key[volume] ||
+      !keymap_set_action(1, right, (key_action_t) { KEY_ACTION_MOUSE, MOUSE_KEY_RIGHT }) ||
+      !keymap_set_action(1, down, (key_action_t) { KEY_ACTION_MOUSE, MOUSE_KEY_DOWN }) ||
+      !keymap_set_action(1, volume, (key_action_t) { KEY_ACTION_CONSUMER, CONSUMER_KEY_VOLUME_UP })) {
+    printf("mouse: keymap.json has no MO(1), or no O / I / F12 to bind on layer 1\n");
+    return;
+  }
+
+  // Keys typed meanwhile must fall through layer 1
+  uint8_t keys[MATRIX_KEYS];
+  uint key_count = 0;
+  for (uint i = 0; i < s_key_count; ++i) {
+    if ((keymap_transparent(1, 0) >> s_keys[i]) & 1) keys[key_count++] = s_keys[i];
+  }
+
+  results_reset(2 * count);
+  free(s_aux.interval);
+  memset(&s_aux, 0, sizeof(s_aux));
+  s_aux.interval_capacity = count * 2000;
+  s_aux.interval = calloc(s_aux.interval_capacity, sizeof(uint32_t));
+
+  uint64_t t = sim_now() + SETTLE_US;
+  uint64_t start_us = t;
+  double error_max = 0;
+  uint consumer_bad = 0;
+
+  for (uint i = 0; i < count; ++i) {
+    bool diagonal = (i & 1) != 0;
+    uint64_t hold = rand_range(200000, 1200000);
+
+    sim_key_edge(t, layer_key, true);
+    uint64_t move = t + 30000;
+    sim_key_edge(move, right, true);
+    if (diagonal) sim_key_edge(move, down, true);
+
+    for (uint k = 0; k < 2; ++k) {
+      uint key = keys[rand_range(0, key_count - 1)];
+      uint64_t press = move + rand_range(20000, hold / 2 - 60000) + k * (hold / 2);
+      key_transition(press, key, true);
+      key_transition(press + rand_range(30000, 50000), key, false);
+    }
+
+    sim_key_edge(move + hold, right, false);
+    if (diagonal) sim_key_edge(move + hold, down, false);
+
+    // Run the stroke, intervals only between its own reports
+    int32_t x0 = s_aux.x, y0 = s_aux.y;
+    s_aux.first = true;
+    sim_run_until(move + hold + 20000);
+
+    double expected = mouse_expected_px((double) hold) * (diagonal ? 46341.0 / 65536.0 : 1.0);
+    double error = fabs((s_aux.x - x0) - expected);
+    if (diagonal && s_aux.y - y0 != s_aux.x - x0) error = fmax(error, abs((s_aux.y - y0) - (s_aux.x - x0)));
+    if (error > error_max) error_max = error;
+
+    uint consumer0 = s_aux.consumer;
+    uint64_t tap = move + hold + 30000;
+    sim_key_edge(tap, volume, true);
+    sim_run_until(tap + 20000);
+    if (s_aux.usage != HID_USAGE_CONSUMER_VOLUME_INCREMENT) consumer_bad++;
+    sim_key_edge(tap + 50000, volume, false);
+    sim_key_edge(tap + 80000, layer_key, false);
+    sim_run_until(tap + 100000);
+    if (s_aux.usage != 0 || s_aux.consumer - consumer0 != 2) consumer_bad++;
+
+    t = tap + 100000 + rand_range(50000, 150000);
+  }
+  sim_run_until(t);
+
+  uint pending = 0;
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    pending += s_expect[key].head - s_expect[key].tail;
+  }
+
+  double seconds = (double) (t - start_us) / 1e6;
+  printf("mouse: %u strokes, %.1f s simulated\n", count, seconds);
+  print_latency("press", s_result.press, s_result.press_count);
+  print_latency("release", s_result.release, s_result.release_count);
+  print_latency("interval", s_aux.interval, s_aux.interval_count);
+  printf("  mouse     step change max %u px/report, distance error max %.1f px, %u reports not taken\n",
+         s_aux.step_change_max, error_max, mouse_keys_stats()->busy);
+  printf("  consumer  %u reports, %u taps wrong, spurious %u  missed %u\n",
+         s_aux.consumer, consumer_bad, s_result.spurious, pending);
+
+  key_action_t transparent = { KEY_ACTION_TRANSPARENT, 0 };
+  keymap_set_action(1, right, transparent);
+  keymap_set_action(1, down, transparent);
+  keymap_set_action(1, volume, transparent);
+}
+
+// @brief Shift held, a combo key pressed, Shift released while the combo key is held back
+// The combo key's press must reach the host before the Shift release (a
+// capital letter), then a whole chord. Binds a combo on J + K in a spare slot
+// for the scenario, the default keymap has none.
+static void bench_combo(uint count)
+{
+  uint shift = MATRIX_KEYS;
+  for (uint key = 0; key < MATRIX_KEYS; ++key) {
+    key_action_t base = keymap_action(0, key);
+    if (base.type == KEY_ACTION_MODIFIER && base.code == HID_KEY_SHIFT_RIGHT) shift = key;
+  }
+  uint j = s_key_of_kc[HID_KEY_J], k = s_key_of_kc[HID_KEY_K];
+  uint slot = keymap_combo_slots() - 1;
+  key_combo_t combo = { (1ULL << j) | (1ULL << k), { KEY_ACTION_KEY, HID_KEY_ESCAPE } };
+  if (shift == MATRIX_KEYS || !s_is_key[j] || !s_is_key[k] || !keymap_set_combo(slot, combo)) {
+    printf("combo: keymap.json has no SHIFT_RIGHT / J / K, or no spare combo slot\n");
+    return;
+  }
+
+  results_reset(count);
+  memset(&s_combo, 0, sizeof(s_combo));
+  s_combo.kc = HID_KEY_J;
+  s_combo.modifier = KEYBOARD_MODIFIER_RIGHTSHIFT;
+  s_combo.chord_kc = HID_KEY_ESCAPE;
+  combo_stats_t before = *combo_stats();
+
+  uint64_t t = sim_now() + SETTLE_US;
+  uint64_t start_us = t;
+  uint32_t term_us = keymap_setting(KEYMAP_SETTING_COMBO_TERM_US);
+
+  for (uint i = 0; i < count; ++i) {
+    // The release lands inside the term, while J is held back
+    sim_key_edge(t, shift, true);
+    uint64_t press = t + 20000;
+    key_transition(press, j, true);
+    sim_key_edge(press + rand_range(5000, term_us / 2), shift, false);
+    key_transition(press + rand_range(80000, 120000), j, false);
+    t = press + 200000;
+
+    // J + K together: ESCAPE, neither key reaches the host
+    sim_key_edge(t, j, true);
+    sim_key_edge(t + rand_range(0, term_us / 2), k, true);
+    sim_key_edge(t + 80000, j, false);
+    sim_key_edge(t + 90000, k, false);
+    t += 200000 + rand_range(0, 50000);
+  }
+  sim_run_until(t);
+
+  uint pending = 0;
+  for (uint key = 0; key < BENCH_KEYS; ++key) {
+    pending += s_expect[key].head - s_expect[key].tail;
+  }
+
+  combo_stats_t const* stats = combo_stats();
+  printf("combo: %u strokes, %.1f s simulated\n", count, (double) (t - start_us) / 1e6);
+  print_latency("press", s_result.press, s_result.press_count);
+  printf("  order     %u J presses, %u after the Shift release, %u chords sent, spurious %u  missed %u\n",
+         s_combo.presses, s_combo.wrong, stats->combos - before.combos, s_result.spurious, pending);
+
+  s_combo.kc = 0;
+  keymap_set_combo(slot, (key_combo_t) { 0, { 0, 0 } });
+}
+
+#if SPLIT_LINK
+static void print_split_stats(char const* name, split_link_stats_t const* stats, split_link_stats_t const* before)
+{
+  printf("  %-8s  frames tx %u rx %u, deltas %u fulls %u, crc errors %u, out of sequence %u, "
+         "retransmits %u, tx full %u, link down %u, syncs %u\n", name,
+         stats->frames_tx - before->frames_tx, stats->frames_rx - before->frames_rx,
+         stats->deltas - before->deltas, stats->fulls - before->fulls,
+         stats->crc_errors - before->crc_errors, stats->sequence - before->sequence,
+         stats->retransmits - before->retransmits, stats->tx_full - before->tx_full,
+         stats->link_down - before->link_down, stats->syncs - before->syncs);
+}
+
+// @brief Typing on this half, then on the other half, then the other half over a noisy link
+// The left half's syncs are its scan phase corrections
+static void bench_split(uint count)
+{
+  static uint32_t const errors[] = { 0, 2000 };
+
+  run_scenario("split, this half", scenario_typing, count);
+  uint32_t local_p50 = s_result.press_count ? s_result.press[s_result.press_count / 2] : 0;
+
+  for (uint i = 0; i < TU_ARRAY_SIZE(errors); ++i) {
+    split_link_stats_t right = *split_link_stats(keyboard_split_link());
+    split_link_stats_t left = *split_link_stats(sim_split_left());
+    char name[64];
+    snprintf(name, sizeof(name), "split, other half, %u byte errors per million", errors[i]);
+
+    sim_split_byte_errors(errors[i]);
+    run_scenario(name, scenario_left, count);
+    sim_split_byte_errors(0);
+
+    uint32_t p50 = s_result.press_count ? s_result.press[s_result.press_count / 2] : 0;
+    printf("  link      +%d us press p50 over this half, %u byte frame at %u baud = %u us\n",
+           (int) (p50 - local_p50), SPLIT_FRAME_HEAD + 2 + 2, SPLIT_BAUD, SPLIT_BYTES_US(SPLIT_FRAME_HEAD + 2 + 2));
+    print_split_stats("right", split_link_stats(keyboard_split_link()), &right);
+    print_split_stats("left", split_link_stats(sim_split_left()), &left);
+  }
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Scan cost
+//--------------------------------------------------------------------+
+
+static double host_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static uint64_t host_now_ns(void)
+{
+  return (uint64_t) host_ns();
+}
+
+static void bench_key_iter(uint iterations)
+{
+  key_iter_bench_result_t results[KEY_ITER_BENCH_CASES];
+  key_iter_bench_run(results, host_now_ns, iterations);
+
+  printf("report build, ns per report\n  keys    walk  sparse\n");
+  for (uint i = 0; i < KEY_ITER_BENCH_CASES; ++i) {
+    printf("  %4u  %6u  %6u\n", results[i].pressed, results[i].walk_ns, results[i].sparse_ns);
+  }
+}
+
+static void bench_scan(uint iterations)
+{
+  uint64_t state = 0;
+  double t0 = host_ns();
+  for (uint i = 0; i < iterations; ++i) {
+    matrix_scan_read(&state);
+  }
+  double t1 = host_ns();
+
+  printf("scan: %.1f ns per matrix_scan_read() on the host (mock GPIO, %u runs)\n",
+         (t1 - t0) / iterations, iterations);
+}
+
+// @brief Simulated time of one matrix_scan_read() (settle delays), idle and with a key held
+static void bench_scan_time(void)
+{
+  uint64_t state;
+  uint64_t t0 = time_us_64();
+  matrix_scan_read(&state);
+  uint64_t t1 = time_us_64();
+
+  uint key = s_keys[0];
+  sim_key_edge(sim_now(), key, true);
+  sim_run_until(sim_now() + SETTLE_US);
+
+  uint64_t t2 = time_us_64();
+  matrix_scan_read(&state);
+  uint64_t t3 = time_us_64();
+
+  sim_key_edge(sim_now(), key, false);
+  sim_run_until(sim_now() + SETTLE_US);
+
+  printf("scan: %u us per matrix_scan_read() idle, %u us with a key down (idle probe %s)\n",
+         (uint) (t1 - t0), (uint) (t3 - t2), MATRIX_SCAN_IDLE_PROBE ? "on" : "off");
+
+  matrix_timing_t const* timing = matrix_scan_timing();
+  printf("settle: %s, column delays %u us per scan (fixed %u us), %u calibrations, %u failed lines\n",
+         MATRIX_SCAN_CALIBRATE ? "calibrated" : "fixed", timing->scan_us,
+         NUM_COLS * (MATRIX_SETTLE_US + MATRIX_RECOVER_US), timing->runs, timing->failures);
+  printf("  settle/recover us:");
+  for (uint col = 0; col < NUM_COLS; ++col) printf(" %u/%u", timing->settle_us[col], timing->recover_us[col]);
+  printf("\n  row rise us:");
+  for (uint row = 0; row < NUM_ROWS; ++row) printf(" %u", timing->row_rise_us[row]);
+  printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+  uint count = (argc > 1) ? (uint) strtoul(argv[1], NULL, 0) : 2000;
+  s_rng = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : 1;
+  if (s_rng == 0) s_rng = 1;
+
+  printf("scan %s, debounce %s %uus, periods scan/debounce/report %u/%u/%u us\n",
+         MATRIX_SCAN_WORD_PARALLEL ? "word-parallel" : "per-pin",
+         (DEBOUNCE_MODE == DEBOUNCE_EAGER) ? "eager" : "deferred", DEBOUNCE_TIME_US,
+         SCAN_PERIOD_US, DEBOUNCE_PERIOD_US, REPORT_PERIOD_US);
+
+  // One row slower than the others, the calibration has to cover it
+  sim_line_timing(row_pins[NUM_ROWS - 1], 2 * SIM_ROW_RISE_US, 0);
+
+  // The keymap is loaded by sim_init()
+  sim_init(on_report);
+  keys_init();
+
+  run_scenario("typing", scenario_typing, count);
+  run_scenario("rolls", scenario_rolls, count);
+  run_scenario("idle", scenario_idle, count / 10);
+
+  sim_diodeless((1ULL << MATRIX_KEYS) - 1);
+  run_scenario("ghost", scenario_ghost, count / 10);
+  sim_diodeless(0);
+#if GHOST_DETECT
+  printf("  ghost     %u samples with a rectangle, %u with a key held back\n",
+         ghost_stats()->frames, ghost_stats()->held);
+#else
+  printf("  ghost     no filter (GHOST_DETECT=0), the spurious transitions are ghost keys\n");
+#endif
+  bench_suspend(count / 10);
+  bench_mouse(count / 50);
+  bench_combo(count / 20);
+#if SPLIT_LINK
+  bench_split(count / 2);
+#endif
+
+  bench_scan_time();
+  bench_scan(100000);
+  bench_key_iter(1000000);
+
+  return 0;
+}
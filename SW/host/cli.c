@@ -0,0 +1,497 @@
+// kb_cli: raw HID configuration client (protocol in raw_hid.h)
+// Talks to the keyboard through /dev/hidrawN, or to the host simulation
+// linked into this binary when no device is given.
+//
+// usage: kb_cli [-d /dev/hidrawN] [command ...]
+// Without a command, one command per line is read from stdin.
+//
+// Commands:
+//   info                              sizes, signature, capabilities
+//   dump [layer]                      non-transparent keys as "layer row col type code"
+//                                     (row "L<n>": the other half's row n, split builds)
+//   load <file>                       write the keys listed in a dump file
+//   set-key <layer> <row> <col> <type> <code>
+//   setting <id> [value]              read or change a setting (keymap_setting_t)
+//   counters                          telemetry counters once
+//   stream <interval_ms> <count>      count streamed counter reports, then stop
+//   latency [clear]                   per-stage latency histograms (LATENCY_STATS builds)
+//   timing                            matrix settle delays, measured and programmed (us)
+//   sync                              USB frame phase lock: poll offset, commit -> poll latency
+//   split                             link to the other half: state and frame counters
+//   reset                             back to the generated keymap
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tusb.h"
+
+#include "usb_descriptors.h"
+#include "matrix_scan.h"
+#include "keymap.h"
+#include "raw_hid.h"
+#include "latency.h"
+#include "sim.h"
+
+#define REPLY_TIMEOUT_MS  1000
+
+static char const* const s_counter_names[RAW_HID_COUNTER_COUNT] = {
+  "uptime_ms", "key_events", "reports", "reports_dropped", "taps", "holds",
+  "combos", "store_seq", "store_programs", "store_erases", "store_failures",
+  "events_dropped", "event_queue_max", "report_queue_max", "wake_latency_max_us",
+};
+
+static char const* const s_latency_names[LATENCY_STAGE_COUNT] = {
+  "debounce", "handoff", "queue", "usb", "end-to-end",
+};
+
+// RAW_HID_GET_SPLIT counters, split_link_stats_t order
+static char const* const s_split_names[] = {
+  "frames_tx", "frames_rx", "deltas", "fulls", "crc_errors",
+  "sequence", "retransmits", "tx_full", "link_down", "syncs",
+};
+
+//--------------------------------------------------------------------+
+// Transport: hidraw device or the simulation
+//--------------------------------------------------------------------+
+
+static int s_fd = -1;
+
+// Raw IN reports received from the simulation, not read yet
+#define SIM_IN_QUEUE_SIZE  32
+static uint8_t s_sim_in[SIM_IN_QUEUE_SIZE][RAW_HID_SIZE];
+static uint s_sim_in_head = 0, s_sim_in_tail = 0;
+
+static void sim_report(uint64_t time_us, uint8_t instance, uint8_t report_id,
+                       uint8_t const* data, uint16_t len)
+{
+  (void) time_us;
+  (void) report_id;
+
+  if (instance != HID_INSTANCE_RAW || s_sim_in_head - s_sim_in_tail >= SIM_IN_QUEUE_SIZE) return;
+  memcpy(s_sim_in[s_sim_in_head++ % SIM_IN_QUEUE_SIZE], data, (len < RAW_HID_SIZE) ? len : RAW_HID_SIZE);
+}
+
+static bool transport_write(uint8_t const request[RAW_HID_SIZE])
+{
+  if (s_fd < 0) return sim_hid_out(HID_INSTANCE_RAW, request, RAW_HID_SIZE);
+
+  // hidraw: report number 0 first, the interface has no report IDs
+  uint8_t buf[1 + RAW_HID_SIZE] = { 0 };
+  memcpy(buf + 1, request, RAW_HID_SIZE);
+  return write(s_fd, buf, sizeof(buf)) == (ssize_t) sizeof(buf);
+}
+
+// @return false on timeout
+static bool transport_read(uint8_t report[RAW_HID_SIZE], uint timeout_ms)
+{
+  if (s_fd < 0) {
+    uint64_t end_us = sim_now() + timeout_ms * 1000ull;
+    while (s_sim_in_tail == s_sim_in_head && sim_now() < end_us) {
+      sim_run_until(sim_now() + SIM_USB_FRAME_US);
+    }
+    if (s_sim_in_tail == s_sim_in_head) return false;
+
+    memcpy(report, s_sim_in[s_sim_in_tail++ % SIM_IN_QUEUE_SIZE], RAW_HID_SIZE);
+    return true;
+  }
+
+  struct pollfd pfd = { .fd = s_fd, .events = POLLIN };
+  if (poll(&pfd, 1, (int) timeout_ms) <= 0) return false;
+  return read(s_fd, report, RAW_HID_SIZE) > 0;
+}
+
+// @brief Send a request and wait for its reply (streamed reports are skipped)
+// @return reply status, -1 on a transport error or timeout
+static int transact(uint8_t request[RAW_HID_SIZE], uint8_t reply[RAW_HID_SIZE])
+{
+  static uint8_t seq = 0;
+
+  // Sequence 0 marks unsolicited reports
+  if (++seq == 0) seq = 1;
+  request[1] = seq;
+
+  if (!transport_write(request)) {
+    fprintf(stderr, "write failed\n");
+    return -1;
+  }
+
+  do {
+    if (!transport_read(reply, REPLY_TIMEOUT_MS)) {
+      fprintf(stderr, "no reply to command 0x%02x\n", request[0]);
+      return -1;
+    }
+  } while (reply[0] != request[0] || reply[1] != seq);
+
+  if (reply[2] != RAW_HID_OK) {
+    fprintf(stderr, "command 0x%02x: %s\n", request[0],
+            (reply[2] == RAW_HID_ERR_COMMAND) ? "unknown command" : "bad argument");
+  }
+  return reply[2];
+}
+
+//--------------------------------------------------------------------+
+// Commands
+//--------------------------------------------------------------------+
+
+static uint16_t get_u16(uint8_t const* p)
+{
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(uint8_t const* p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+typedef struct
+{
+  uint8_t layers, rows, cols;
+  bool split;   // RAW_HID_CAP_SPLIT
+} board_info_t;
+
+static bool get_info(board_info_t* info, bool print)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_INFO }, reply[RAW_HID_SIZE];
+  if (transact(request, reply) != RAW_HID_OK) return false;
+
+  info->rows = reply[4];
+  info->cols = reply[5];
+  info->layers = reply[6];
+  info->split = (get_u32(&reply[16]) & RAW_HID_CAP_SPLIT) != 0;
+
+  if (print) {
+    printf("protocol %u, %ux%u matrix, %u layers, %u tap-hold slots, %u combo slots, %u macros, %u settings\n",
+           reply[3], reply[4], reply[5], reply[6], reply[7], reply[8] | (reply[9] << 8), reply[10], reply[11]);
+    printf("signature %08x, capabilities %08x\n", get_u32(&reply[12]), get_u32(&reply[16]));
+  }
+  return true;
+}
+
+static bool print_counters(uint8_t const reply[RAW_HID_SIZE])
+{
+  for (uint i = 0; i < RAW_HID_COUNTER_COUNT; ++i) {
+    printf("%s%s %u", i ? ", " : "", s_counter_names[i], get_u32(&reply[3 + 4 * i]));
+  }
+  printf("\n");
+  return true;
+}
+
+// @brief Key of a row ("3", or "L3" for the other half) and column
+static bool parse_key(board_info_t const* info, char const* row_text, uint col, uint* key)
+{
+  bool left = (row_text[0] == 'L' || row_text[0] == 'l');
+  char* end;
+  uint row = strtoul(row_text + left, &end, 0);
+
+  if (end == row_text + left || *end != '\0' || (left && !info->split) ||
+      row >= info->rows || col >= info->cols) return false;
+
+  *key = (left ? SPLIT_KEY_FIRST : 0) + row * info->cols + col;
+  return true;
+}
+
+// The other half's keys (split builds) follow this half's at SPLIT_KEY_FIRST
+static bool cmd_dump(board_info_t const* info, int only_layer)
+{
+  uint keys = info->rows * info->cols;
+
+  for (uint layer = 0; layer < info->layers; ++layer) {
+    if (only_layer >= 0 && layer != (uint) only_layer) continue;
+
+    for (uint half = 0; half < (info->split ? 2u : 1u); ++half) {
+      uint base = half ? SPLIT_KEY_FIRST : 0;
+
+      for (uint first = 0; first < keys; first += RAW_HID_KEYMAP_MAX) {
+        uint count = (keys - first < RAW_HID_KEYMAP_MAX) ? keys - first : RAW_HID_KEYMAP_MAX;
+        uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_KEYMAP, 0, layer, base + first, count }, reply[RAW_HID_SIZE];
+        if (transact(request, reply) != RAW_HID_OK) return false;
+
+        for (uint i = 0; i < count; ++i) {
+          uint8_t type = reply[6 + 2 * i], code = reply[7 + 2 * i];
+          if (type == KEY_ACTION_TRANSPARENT) continue;
+          printf("%u %s%u %u %u 0x%02x\n", layer, half ? "L" : "", (first + i) / info->cols, (first + i) % info->cols,
+                 type, code);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// @brief Write one run of consecutive keys
+static bool set_keys(uint layer, uint first, uint count, uint8_t const* entries)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_SET_KEYMAP, 0, layer, first, count }, reply[RAW_HID_SIZE];
+  memcpy(&request[5], entries, 2 * count);
+  return transact(request, reply) == RAW_HID_OK;
+}
+
+// Dump lines are grouped into runs of consecutive keys, one request per run
+static bool cmd_load(board_info_t const* info, char const* path)
+{
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    return false;
+  }
+
+  uint8_t entries[2 * RAW_HID_KEYMAP_MAX];
+  uint run_layer = 0, run_first = 0, run_count = 0, written = 0;
+  bool ok = true;
+  char line[128];
+
+  while (ok && fgets(line, sizeof(line), in))
+  {
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+
+    uint layer, col, type, code, key;
+    char row[16], c;
+    if (sscanf(line, " %c", &c) != 1) continue;
+    if (sscanf(line, "%u %15s %u %u %i", &layer, row, &col, &type, &code) != 5 ||
+        layer >= info->layers || !parse_key(info, row, col, &key))
+    {
+      fprintf(stderr, "%s: bad line: %s", path, line);
+      ok = false;
+      break;
+    }
+
+    if (run_count && (layer != run_layer || key != run_first + run_count || run_count == RAW_HID_KEYMAP_MAX)) {
+      ok = set_keys(run_layer, run_first, run_count, entries);
+      written += run_count;
+      run_count = 0;
+    }
+    if (run_count == 0) {
+      run_layer = layer;
+      run_first = key;
+    }
+    entries[2 * run_count] = (uint8_t) type;
+    entries[2 * run_count + 1] = (uint8_t) code;
+    run_count++;
+  }
+
+  if (ok && run_count) {
+    ok = set_keys(run_layer, run_first, run_count, entries);
+    written += run_count;
+  }
+
+  fclose(in);
+  if (ok) printf("%u keys written\n", written);
+  return ok;
+}
+
+static bool cmd_stream(uint interval_ms, uint count)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_STREAM_COUNTERS, 0, interval_ms, interval_ms >> 8 }, reply[RAW_HID_SIZE];
+  if (transact(request, reply) != RAW_HID_OK) return false;
+
+  bool ok = true;
+  for (uint i = 0; i < count; ++i) {
+    do {
+      ok = transport_read(reply, interval_ms + REPLY_TIMEOUT_MS);
+    } while (ok && !(reply[0] == RAW_HID_GET_COUNTERS && reply[1] == 0));
+    if (!ok) {
+      fprintf(stderr, "counter stream stopped\n");
+      break;
+    }
+    print_counters(reply);
+  }
+
+  uint8_t stop[RAW_HID_SIZE] = { RAW_HID_STREAM_COUNTERS };
+  return transact(stop, reply) == RAW_HID_OK && ok;
+}
+
+// One row per stage: sample count, then "<upper bound>:<count>" per non-empty log2 bucket
+static bool cmd_latency(bool clear)
+{
+  for (uint stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+    uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_LATENCY, 0, stage, clear && stage == LATENCY_STAGE_COUNT - 1 };
+    uint8_t reply[RAW_HID_SIZE];
+    if (transact(request, reply) != RAW_HID_OK) return false;
+
+    uint32_t total = 0;
+    for (uint i = 0; i < LATENCY_BUCKETS; ++i) total += get_u32(&reply[4 + 4 * i]);
+
+    printf("%-10s n %-6u max %5u us ", s_latency_names[stage], total, get_u32(&reply[4 + 4 * LATENCY_BUCKETS]));
+    for (uint i = 0; i < LATENCY_BUCKETS; ++i) {
+      uint32_t count = get_u32(&reply[4 + 4 * i]);
+      if (count == 0) continue;
+      if (i == LATENCY_BUCKETS - 1) {
+        printf(" >=%u:%u", 1u << (i - 1), count);
+      } else {
+        printf(" <%u:%u", 1u << i, count);
+      }
+    }
+    printf("\n");
+  }
+  return true;
+}
+
+// Per column: programmed settle / recover, then the measured times they came from
+static bool cmd_timing(void)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_SCAN_TIMING }, reply[RAW_HID_SIZE];
+  if (transact(request, reply) != RAW_HID_OK) return false;
+
+  uint cols = reply[3], rows = reply[4];
+  uint8_t const* settle   = &reply[5];
+  uint8_t const* recover  = settle + cols;
+  uint8_t const* col_fall = recover + cols;
+  uint8_t const* col_rise = col_fall + cols;
+  uint8_t const* row_rise = col_rise + cols;
+  uint8_t const* tail     = row_rise + rows;
+
+  printf("col settle recover  fall rise\n");
+  for (uint col = 0; col < cols; ++col) {
+    printf("%3u %6u %7u  %4u %4u\n", col, settle[col], recover[col], col_fall[col], col_rise[col]);
+  }
+  printf("row rise");
+  for (uint row = 0; row < rows; ++row) printf(" %u", row_rise[row]);
+  printf("\nscan %u us, %u calibrations, %u lines failed (255 = did not settle)\n",
+         tail[0] | (tail[1] << 8), tail[2] | (tail[3] << 8), tail[4] | (tail[5] << 8));
+  return true;
+}
+
+// Where the host polls in the frame and how long a debounced change waits for it
+static bool cmd_sync(void)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_USB_SYNC }, reply[RAW_HID_SIZE];
+  if (transact(request, reply) != RAW_HID_OK) return false;
+
+  printf("frames %u, polls %u, poll at SOF +%u us, full scan %u us\n",
+         get_u32(&reply[3]), get_u32(&reply[7]), get_u16(&reply[11]), get_u16(&reply[13]));
+  printf("commit -> poll avg %u us, max %u us (n=%u)\n",
+         get_u16(&reply[19]), get_u16(&reply[21]), get_u32(&reply[15]));
+  return true;
+}
+
+// Link to the other half, as seen by this one
+static bool cmd_split(board_info_t const* info)
+{
+  uint8_t request[RAW_HID_SIZE] = { RAW_HID_GET_SPLIT }, reply[RAW_HID_SIZE];
+
+  if (!info->split) {
+    fprintf(stderr, "no split link (firmware built without SPLIT_LINK)\n");
+    return false;
+  }
+  if (transact(request, reply) != RAW_HID_OK) return false;
+
+  printf("link %s\n", reply[3] ? "up" : "down");
+  for (uint i = 0; i < sizeof(s_split_names) / sizeof(s_split_names[0]); ++i) {
+    printf("%s%s %u", i ? ", " : "", s_split_names[i], get_u32(&reply[4 + 4 * i]));
+  }
+  printf("\n");
+  return true;
+}
+
+static bool run_command(int argc, char* argv[])
+{
+  static board_info_t info;
+  static bool info_valid = false;
+
+  if (argc == 0) return true;
+  char const* cmd = argv[0];
+
+  if (strcmp(cmd, "info") == 0) {
+    return (info_valid = get_info(&info, true));
+  }
+  if (!info_valid && !(info_valid = get_info(&info, false))) return false;
+
+  uint8_t request[RAW_HID_SIZE] = { 0 }, reply[RAW_HID_SIZE];
+
+  if (strcmp(cmd, "dump") == 0) {
+    return cmd_dump(&info, (argc > 1) ? atoi(argv[1]) : -1);
+  }
+  if (strcmp(cmd, "load") == 0 && argc == 2) {
+    return cmd_load(&info, argv[1]);
+  }
+  if (strcmp(cmd, "set-key") == 0 && argc == 6) {
+    uint key;
+    uint8_t entry[2] = { strtoul(argv[4], NULL, 0), strtoul(argv[5], NULL, 0) };
+    if (!parse_key(&info, argv[2], strtoul(argv[3], NULL, 0), &key)) {
+      fprintf(stderr, "no such key: %s %s\n", argv[2], argv[3]);
+      return false;
+    }
+    return set_keys(strtoul(argv[1], NULL, 0), key, 1, entry);
+  }
+  if (strcmp(cmd, "setting") == 0 && (argc == 2 || argc == 3)) {
+    uint8_t id = strtoul(argv[1], NULL, 0);
+    if (argc == 3) {
+      uint32_t value = strtoul(argv[2], NULL, 0);
+      request[0] = RAW_HID_SET_SETTING;
+      request[2] = id;
+      for (uint i = 0; i < 4; ++i) request[3 + i] = (uint8_t) (value >> (8 * i));
+      return transact(request, reply) == RAW_HID_OK;
+    }
+    request[0] = RAW_HID_GET_SETTING;
+    request[2] = id;
+    if (transact(request, reply) != RAW_HID_OK) return false;
+    printf("setting %u = %u\n", id, get_u32(&reply[4]));
+    return true;
+  }
+  if (strcmp(cmd, "counters") == 0) {
+    request[0] = RAW_HID_GET_COUNTERS;
+    return transact(request, reply) == RAW_HID_OK && print_counters(reply);
+  }
+  if (strcmp(cmd, "stream") == 0 && argc == 3) {
+    return cmd_stream(strtoul(argv[1], NULL, 0), strtoul(argv[2], NULL, 0));
+  }
+  if (strcmp(cmd, "latency") == 0) {
+    return cmd_latency(argc > 1 && strcmp(argv[1], "clear") == 0);
+  }
+  if (strcmp(cmd, "timing") == 0) {
+    return cmd_timing();
+  }
+  if (strcmp(cmd, "sync") == 0) {
+    return cmd_sync();
+  }
+  if (strcmp(cmd, "split") == 0) {
+    return cmd_split(&info);
+  }
+  if (strcmp(cmd, "reset") == 0) {
+    request[0] = RAW_HID_RESET_KEYMAP;
+    return transact(request, reply) == RAW_HID_OK;
+  }
+
+  fprintf(stderr, "unknown command or arguments: %s\n", cmd);
+  return false;
+}
+
+int main(int argc, char* argv[])
+{
+  int arg = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+    if ((s_fd = open(argv[2], O_RDWR)) < 0) {
+      perror(argv[2]);
+      return 1;
+    }
+    arg = 3;
+  } else {
+    sim_init(sim_report);
+  }
+
+  bool ok = true;
+  if (arg < argc) {
+    ok = run_command(argc - arg, argv + arg);
+  } else {
+    char line[256];
+    while (ok && fgets(line, sizeof(line), stdin)) {
+      char* words[8];
+      int count = 0;
+      for (char* word = strtok(line, " \t\r\n"); word && count < 8; word = strtok(NULL, " \t\r\n")) {
+        if (word[0] == '#') break;
+        words[count++] = word;
+      }
+      ok = run_command(count, words);
+    }
+  }
+
+  if (s_fd >= 0) close(s_fd);
+  return ok ? 0 : 1;
+}
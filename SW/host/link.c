@@ -0,0 +1,307 @@
+// kb_link: split link protocol (split_link.h) over a real byte stream
+//
+// Self test (default): both ends in this process, the left one writing to a
+// socket pair, or with -p to a pseudo-terminal in raw mode, the right one
+// reading the other side of it. A virtual clock steps one scan period at a
+// time: the right end polls and sends its SYNC, then the left end polls and
+// sends a random walk of key samples. With -e that many bytes per million are
+// corrupted (one bit) on their way, both ways. Every state the right end
+// takes must be one the left end sent; its lag behind the left end is
+// counted in scan periods. After a quiet spell the right end must hold the
+// last sample, or the exit status is 1.
+//
+// One end against a serial port (a USB serial adapter wired to the other
+// half, or one side of a socat pty pair with another kb_link on the other):
+// the left end walks one key across its matrix every 100 ms, the right end
+// prints every state it takes and the link counters once a second.
+//
+// usage: kb_link [-p] [-e errors_per_million] [samples]
+//        kb_link -d <tty> left|right [seconds]
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pico/time.h"
+#include "scheduler.h"
+#include "split_link.h"
+
+#define LINK_PERIOD_US    250
+#define LINK_KEYS         60           // this matrix, NUM_ROWS * NUM_COLS
+#define LINK_HISTORY      1024         // samples looked back at, a power of 2
+
+//--------------------------------------------------------------------+
+// Clock: virtual for the self test, monotonic against a device
+//--------------------------------------------------------------------+
+
+static bool     s_real_time = false;
+static uint64_t s_now_us = 0;
+
+uint64_t time_us_64(void)
+{
+  if (!s_real_time) return s_now_us;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+//--------------------------------------------------------------------+
+// Port: a non-blocking file descriptor, bit errors on the way out
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  int      fd;
+  uint32_t errors;      // per million bytes written
+  uint32_t corrupted;
+} link_fd_t;
+
+static uint32_t s_rng = 1;
+
+static uint32_t rand_next(void)
+{
+  // xorshift32, deterministic across hosts
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return s_rng;
+}
+
+static uint fd_read(void* ctx, uint8_t* buf, uint len)
+{
+  link_fd_t* port = ctx;
+  ssize_t count = read(port->fd, buf, len);
+  return (count > 0) ? (uint) count : 0;
+}
+
+static uint fd_write(void* ctx, uint8_t const* buf, uint len)
+{
+  link_fd_t* port = ctx;
+  uint8_t out[SPLIT_TX_SIZE];
+
+  if (len > sizeof(out)) len = sizeof(out);
+  for (uint i = 0; i < len; ++i) {
+    out[i] = buf[i];
+    if (port->errors != 0 && rand_next() % 1000000 < port->errors) {
+      out[i] ^= (uint8_t) (1u << (rand_next() & 7));
+      port->corrupted++;
+    }
+  }
+
+  ssize_t count = write(port->fd, out, len);
+  return (count > 0) ? (uint) count : 0;
+}
+
+static bool fd_raw(int fd)
+{
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) return false;
+  cfmakeraw(&tio);
+#ifdef B3000000
+  if (SPLIT_BAUD == 3000000) cfsetspeed(&tio, B3000000);
+#endif
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+// @brief Wait up to timeout_ms for bytes to read (a pty hands them over late)
+static void fd_wait(int fd, int timeout_ms)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  poll(&pfd, 1, timeout_ms);
+}
+
+static void print_stats(char const* name, split_link_t const* link)
+{
+  split_link_stats_t const* stats = split_link_stats(link);
+  printf("  %-6s %s, frames tx %u rx %u, deltas %u fulls %u, crc errors %u, out of sequence %u, "
+         "retransmits %u, tx full %u, link down %u, syncs %u\n", name, split_link_up(link) ? "up" : "down",
+         stats->frames_tx, stats->frames_rx, stats->deltas, stats->fulls, stats->crc_errors,
+         stats->sequence, stats->retransmits, stats->tx_full, stats->link_down, stats->syncs);
+}
+
+//--------------------------------------------------------------------+
+// Self test
+//--------------------------------------------------------------------+
+
+static int self_test(bool pty, uint32_t errors, uint samples)
+{
+  int fds[2];
+
+  if (pty) {
+    fds[0] = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fds[0] < 0 || grantpt(fds[0]) != 0 || unlockpt(fds[0]) != 0) {
+      perror("posix_openpt");
+      return 1;
+    }
+    fds[1] = open(ptsname(fds[0]), O_RDWR | O_NOCTTY);
+    if (fds[1] < 0 || !fd_raw(fds[0]) || !fd_raw(fds[1])) {
+      perror(ptsname(fds[0]));
+      return 1;
+    }
+  } else if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return 1;
+  }
+  for (uint i = 0; i < 2; ++i) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+
+  link_fd_t right_fd = { fds[0], errors, 0 }, left_fd = { fds[1], errors, 0 };
+  split_port_t const right_port = { fd_read, fd_write, &right_fd };
+  split_port_t const left_port = { fd_read, fd_write, &left_fd };
+  split_link_t right, left;
+  split_link_init(&right, &right_port, SPLIT_ROLE_CONTROLLER, time_us_32());
+  split_link_init(&left, &left_port, SPLIT_ROLE_PERIPHERAL, time_us_32());
+
+  static uint64_t history[LINK_HISTORY];
+  uint64_t sample = 0, held = 0;
+  uint changes = 0, next_period = 0, lag_max = 0, wrong = 0;
+  uint quiet = 2 * SPLIT_KEEPALIVE_US / LINK_PERIOD_US;
+
+  for (uint step = 0; step < samples + quiet; ++step)
+  {
+    s_now_us += LINK_PERIOD_US;
+
+    // Right: scan start, merge what came in, SYNC
+    if (pty) fd_wait(fds[0], 2);
+    split_link_poll(&right, time_us_32());
+    split_link_sync(&right, LINK_PERIOD_US);
+
+    uint64_t state = split_link_state(&right);
+    if (state != held) {
+      held = state;
+      uint lag = 0;
+      while (lag < LINK_HISTORY && lag <= step && history[(step - lag) % LINK_HISTORY] != state) lag++;
+      if (lag == LINK_HISTORY || lag > step) {
+        wrong++;
+      } else {
+        if (lag <= 1) next_period++;
+        if (lag > lag_max) lag_max = lag;
+      }
+    }
+
+    // Left: take the SYNC, scan, send
+    if (pty) fd_wait(fds[1], 2);
+    split_link_poll(&left, time_us_32());
+    if (step < samples && rand_next() % 4 == 0) {
+      sample ^= 1ULL << (rand_next() % LINK_KEYS);
+      changes++;
+    }
+    history[step % LINK_HISTORY] = sample;
+    split_link_send(&left, sample, time_us_32());
+  }
+
+  bool ok = (held == sample && wrong == 0 && split_link_up(&right));
+  printf("%s, %u periods of %u us, %u sample changes, %u byte errors per million (%u bytes hit)\n",
+         pty ? "pty" : "socket pair", samples, LINK_PERIOD_US, changes, errors,
+         right_fd.corrupted + left_fd.corrupted);
+  printf("  states %u in the next period, lag max %u periods, %u never sent, last sample %s\n",
+         next_period, lag_max, wrong, (held == sample) ? "held" : "LOST");
+  print_stats("right", &right);
+  print_stats("left", &left);
+
+  close(fds[0]);
+  close(fds[1]);
+  return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------+
+// One end against a device
+//--------------------------------------------------------------------+
+
+static split_link_t  s_link;
+static uint32_t      s_walk_key = 0;
+static uint32_t      s_walk_us = 0;
+
+// Left: a key walking across the matrix
+static void walk_task(void)
+{
+  uint32_t now_us = time_us_32();
+  if (now_us - s_walk_us >= 100000) {
+    s_walk_us = now_us;
+    s_walk_key = (s_walk_key + 1) % LINK_KEYS;
+  }
+  split_link_send(&s_link, 1ULL << s_walk_key, now_us);
+}
+
+static int device(char const* path, bool left, uint seconds)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || !fd_raw(fd)) {
+    perror(path);
+    return 1;
+  }
+
+  s_real_time = true;
+  link_fd_t port_fd = { fd, 0, 0 };
+  split_port_t const port = { fd_read, fd_write, &port_fd };
+  split_link_init(&s_link, &port, left ? SPLIT_ROLE_PERIPHERAL : SPLIT_ROLE_CONTROLLER, time_us_32());
+
+  sched_stage_t stages[] = {
+    { .name = "scan", .fn = left ? walk_task : NULL, .period_us = LINK_PERIOD_US },
+  };
+  scheduler_init(stages, 1);
+
+  uint64_t start_us = time_us_64();
+  uint64_t end_us = start_us + (uint64_t) seconds * 1000000;
+  uint64_t print_us = start_us + 1000000;
+  uint64_t held = 0;
+
+  while (seconds == 0 || time_us_64() < end_us)
+  {
+    if (left) {
+      split_link_poll(&s_link, time_us_32());
+      split_link_align(&s_link, &stages[0], 0);
+      scheduler_run(stages, 1);
+    } else if (time_us_64() >= stages[0].next_us) {
+      stages[0].next_us += LINK_PERIOD_US;
+      split_link_poll(&s_link, time_us_32());
+      split_link_sync(&s_link, LINK_PERIOD_US);
+      if (split_link_state(&s_link) != held) {
+        held = split_link_state(&s_link);
+        printf("%10.3f s  %016llx\n", (time_us_64() - start_us) / 1e6, (unsigned long long) held);
+      }
+    }
+
+    if (time_us_64() >= print_us) {
+      print_us += 1000000;
+      print_stats(left ? "left" : "right", &s_link);
+    }
+    usleep(20);
+  }
+
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  bool pty = false;
+  uint32_t errors = 0;
+  int arg = 1;
+
+  if (argc > 3 && strcmp(argv[1], "-d") == 0) {
+    return device(argv[2], strcmp(argv[3], "left") == 0, (argc > 4) ? (uint) strtoul(argv[4], NULL, 0) : 0);
+  }
+
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (strcmp(argv[arg], "-p") == 0) {
+      pty = true;
+    } else if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc) {
+      errors = (uint32_t) strtoul(argv[++arg], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: kb_link [-p] [-e errors_per_million] [samples]\n"
+                      "       kb_link -d <tty> left|right [seconds]\n");
+      return 2;
+    }
+  }
+  uint samples = (arg < argc) ? (uint) strtoul(argv[arg], NULL, 0) : 20000;
+
+  return self_test(pty, errors, samples);
+}
@@ -0,0 +1,11 @@
+// Host build stand-in for the TinyUSB board support API
+
+#ifndef MOCK_BSP_BOARD_API_H_
+#define MOCK_BSP_BOARD_API_H_
+
+#include "pico/types.h"
+
+void board_led_write(bool state);
+uint32_t board_millis(void);
+
+#endif /* MOCK_BSP_BOARD_API_H_ */
@@ -0,0 +1,34 @@
+// Host build stand-in for hardware/clocks.h
+// Only the sleep clock enables, backed by RAM in sim.c
+
+#ifndef MOCK_HARDWARE_CLOCKS_H_
+#define MOCK_HARDWARE_CLOCKS_H_
+
+#include "pico/types.h"
+
+typedef struct
+{
+  uint32_t sleep_en0;
+  uint32_t sleep_en1;
+} clocks_hw_t;
+
+extern clocks_hw_t* const clocks_hw;
+
+#define CLOCKS_SLEEP_EN0_BITS                              0xffffffffu
+#define CLOCKS_SLEEP_EN0_CLK_SYS_CLOCKS_BITS               (1u << 0)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_BUSCTRL_BITS              (1u << 3)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_BUSFABRIC_BITS            (1u << 4)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_IO_BITS                   (1u << 8)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_VREG_AND_CHIP_RESET_BITS  (1u << 10)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_PADS_BITS                 (1u << 11)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_PLL_SYS_BITS              (1u << 14)
+#define CLOCKS_SLEEP_EN0_CLK_SYS_PLL_USB_BITS              (1u << 15)
+
+#define CLOCKS_SLEEP_EN1_BITS                              0x00007fffu
+#define CLOCKS_SLEEP_EN1_CLK_SYS_TIMER_BITS                (1u << 5)
+#define CLOCKS_SLEEP_EN1_CLK_SYS_USBCTRL_BITS              (1u << 10)
+#define CLOCKS_SLEEP_EN1_CLK_USB_USBCTRL_BITS              (1u << 11)
+#define CLOCKS_SLEEP_EN1_CLK_SYS_WATCHDOG_BITS             (1u << 12)
+#define CLOCKS_SLEEP_EN1_CLK_SYS_XOSC_BITS                 (1u << 14)
+
+#endif /* MOCK_HARDWARE_CLOCKS_H_ */
@@ -0,0 +1,20 @@
+// Host build stand-in for hardware/flash.h
+// Flash is a RAM array in sim.c, mapped at XIP_BASE for reads
+
+#ifndef MOCK_HARDWARE_FLASH_H_
+#define MOCK_HARDWARE_FLASH_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+#define FLASH_PAGE_SIZE        256u
+#define FLASH_SECTOR_SIZE      4096u
+#define PICO_FLASH_SIZE_BYTES  (2u * 1024u * 1024u)
+
+uint8_t* sim_flash_memory(void);
+#define XIP_BASE  ((uintptr_t) sim_flash_memory())
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count);
+
+#endif /* MOCK_HARDWARE_FLASH_H_ */
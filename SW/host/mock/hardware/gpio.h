@@ -0,0 +1,29 @@
+// Host build stand-in for hardware/gpio.h
+// Pins are backed by the simulated switch matrix in sim.c
+
+#ifndef MOCK_HARDWARE_GPIO_H_
+#define MOCK_HARDWARE_GPIO_H_
+
+#include "pico/types.h"
+
+#define GPIO_OUT  1
+#define GPIO_IN   0
+
+#define GPIO_IRQ_EDGE_FALL  0x4u
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_put_masked(uint32_t mask, uint32_t value);
+uint32_t gpio_get_all(void);
+
+// Only GPIO_IRQ_EDGE_FALL, delivered to core1 while it sleeps in __wfe()
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback);
+
+#endif /* MOCK_HARDWARE_GPIO_H_ */
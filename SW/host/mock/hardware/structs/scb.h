@@ -0,0 +1,20 @@
+// Host build stand-in for hardware/structs/scb.h
+// Only the system control register, one per simulated core (sim.c)
+
+#ifndef MOCK_HARDWARE_STRUCTS_SCB_H_
+#define MOCK_HARDWARE_STRUCTS_SCB_H_
+
+#include "pico/types.h"
+
+typedef struct
+{
+  uint32_t scr;
+} armv6m_scb_t;
+
+#define M0PLUS_SCR_SLEEPDEEP_BITS  0x00000004u
+
+// The calling core's SCB, like the core-private register block on the chip
+armv6m_scb_t* sim_scb_hw(void);
+#define scb_hw  (sim_scb_hw())
+
+#endif /* MOCK_HARDWARE_STRUCTS_SCB_H_ */
@@ -0,0 +1,13 @@
+// Host build stand-in for hardware/sync.h
+
+#ifndef MOCK_HARDWARE_SYNC_H_
+#define MOCK_HARDWARE_SYNC_H_
+
+#define __mem_fence_release()  __atomic_thread_fence(__ATOMIC_RELEASE)
+#define __mem_fence_acquire()  __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+// Core1 sleeps until a row edge IRQ or a __sev() from core0, see sim.h
+void __wfe(void);
+void __sev(void);
+
+#endif /* MOCK_HARDWARE_SYNC_H_ */
@@ -0,0 +1,21 @@
+// Host build stand-in for pico/flash.h
+// There is no XIP to protect, the function just runs
+
+#ifndef MOCK_PICO_FLASH_H_
+#define MOCK_PICO_FLASH_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+#define PICO_OK  0
+
+static inline int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms)
+{
+  (void) enter_exit_timeout_ms;
+  func(param);
+  return PICO_OK;
+}
+
+static inline bool flash_safe_execute_core_init(void) { return true; }
+
+#endif /* MOCK_PICO_FLASH_H_ */
@@ -0,0 +1,10 @@
+// Host build stand-in for pico/stdlib.h
+
+#ifndef MOCK_PICO_STDLIB_H_
+#define MOCK_PICO_STDLIB_H_
+
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#endif /* MOCK_PICO_STDLIB_H_ */
@@ -0,0 +1,22 @@
+// Host build stand-in for pico/time.h
+// Time is virtual and kept per simulated core, see sim.h
+
+#ifndef MOCK_PICO_TIME_H_
+#define MOCK_PICO_TIME_H_
+
+#include "pico/types.h"
+
+typedef uint64_t absolute_time_t;
+
+uint64_t time_us_64(void);
+void sleep_us(uint64_t us);
+void busy_wait_until(absolute_time_t t);
+void sleep_until(absolute_time_t t);
+
+static inline uint32_t time_us_32(void) { return (uint32_t) time_us_64(); }
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+
+#endif /* MOCK_PICO_TIME_H_ */
@@ -0,0 +1,12 @@
+// Host build stand-in for the Pico SDK base types
+
+#ifndef MOCK_PICO_TYPES_H_
+#define MOCK_PICO_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+#endif /* MOCK_PICO_TYPES_H_ */
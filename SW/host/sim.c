@@ -0,0 +1,859 @@
+// Host simulation of the firmware, see sim.h
+// Also provides the mock HAL functions declared in mock/.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp/board_api.h"
+#include "hardware/gpio.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+#include "pico/time.h"
+#include "tusb.h"
+
+#include "usb_descriptors.h"
+#include "matrix_scan.h"
+#include "keyboard.h"
+#include "power.h"
+#include "sof_sync.h"
+#include "split_link.h"
+#include "sim.h"
+
+//--------------------------------------------------------------------+
+// Virtual cores
+//--------------------------------------------------------------------+
+
+// core 2: the other half's controller (SPLIT_LINK builds)
+#define SIM_CORES  (SPLIT_LINK ? 3 : 2)
+
+static uint64_t s_clock[SIM_CORES];
+static uint     s_core = 0;
+static bool     s_event[2];   // WFE event flags, set by __sev()
+
+static void core0_pass(void);
+
+uint64_t time_us_64(void)
+{
+  return s_clock[s_core];
+}
+
+// A sleep on core1 (scan settle delays) lets core0 run the passes due before
+// it ends, so core0 never sees a scan result before the time it exists
+void sleep_us(uint64_t us)
+{
+  static bool s_yielding = false;
+  uint64_t end_us = s_clock[s_core] + us;
+
+  if (s_core == 1 && !s_yielding) {
+    s_yielding = true;
+    while (s_clock[0] < end_us) {
+      s_core = 0;
+      core0_pass();
+    }
+    s_core = 1;
+    s_yielding = false;
+  }
+
+  s_clock[s_core] = end_us;
+}
+
+void busy_wait_until(absolute_time_t t)
+{
+  if (s_clock[s_core] < t) s_clock[s_core] = t;
+}
+
+void sleep_until(absolute_time_t t)
+{
+  busy_wait_until(t);
+}
+
+// Core0 sleeps in __wfe() while the bus is suspended (power_task()), so a
+// __sev() from core1 wakes it now rather than at its next scheduled pass
+void __sev(void)
+{
+  s_event[0] = s_event[1] = true;
+
+  if (s_core == 1 && tud_suspended() && s_clock[0] > s_clock[1]) s_clock[0] = s_clock[1];
+}
+
+// Sleep clock enables (power.c gates them while suspended), all on at reset
+static clocks_hw_t s_clocks_hw = { CLOCKS_SLEEP_EN0_BITS, CLOCKS_SLEEP_EN1_BITS };
+clocks_hw_t* const clocks_hw = &s_clocks_hw;
+
+static armv6m_scb_t s_scb[SIM_CORES];
+
+armv6m_scb_t* sim_scb_hw(void)
+{
+  return &s_scb[s_core];
+}
+
+uint32_t board_millis(void)
+{
+  return (uint32_t) (time_us_64() / 1000);
+}
+
+void board_led_write(bool state)
+{
+  (void) state;
+}
+
+//--------------------------------------------------------------------+
+// Switch matrix
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint64_t time_us;
+  uint8_t  key;
+  uint8_t  closed;
+} sim_edge_t;
+
+typedef struct
+{
+  sim_edge_t* edges;
+  size_t count;
+  size_t cap;
+  size_t next;                     // first edge not applied yet
+  bool   unsorted;
+} sim_edges_t;
+
+static sim_edges_t s_edges;        // this half's matrix
+#if SPLIT_LINK
+static sim_edges_t s_left_edges;   // the other half's, key - SPLIT_KEY_FIRST
+static uint64_t s_left_closed = 0;
+#endif
+
+static uint64_t s_closed = 0;      // contacts closed right now
+static uint64_t s_diodeless = 0;   // switches that also conduct row -> column
+static uint32_t s_gpio_out = 0;
+static uint32_t s_gpio_oe = 0;
+static uint32_t s_gpio_pull_down = 0;   // inputs not in here are pulled up
+
+// Line timing: after its level changes a pin reads the old level for its
+// rise / fall time. Rows rise slowly through the weak pull-ups.
+static uint8_t  s_rise_us[32];
+static uint8_t  s_fall_us[32];
+static uint32_t s_level = 0;       // level every pin is settling to
+static uint32_t s_settling = 0;    // pins still reading s_from
+static uint32_t s_from = 0;
+static uint64_t s_settled_us[32];
+
+// Falling edge IRQs: armed pins and their level when last checked
+static uint32_t s_irq_fall = 0;
+static uint32_t s_irq_level = 0;
+static gpio_irq_callback_t s_irq_callback = NULL;
+
+static void edges_add(sim_edges_t* list, uint64_t time_us, uint key, bool closed)
+{
+  if (list->count == list->cap) {
+    list->cap = list->cap ? list->cap * 2 : 1024;
+    list->edges = realloc(list->edges, list->cap * sizeof(sim_edge_t));
+  }
+
+  if (list->count > list->next && time_us < list->edges[list->count - 1].time_us) {
+    list->unsorted = true;
+  }
+
+  list->edges[list->count++] = (sim_edge_t) { time_us, (uint8_t) key, closed };
+}
+
+void sim_key_edge(uint64_t time_us, uint key, bool closed)
+{
+#if SPLIT_LINK
+  if (key >= SPLIT_KEY_FIRST) {
+    edges_add(&s_left_edges, time_us, key - SPLIT_KEY_FIRST, closed);
+    return;
+  }
+#endif
+  edges_add(&s_edges, time_us, key, closed);
+}
+
+static int edge_compare(void const* a, void const* b)
+{
+  sim_edge_t const* ea = a;
+  sim_edge_t const* eb = b;
+
+  if (ea->time_us != eb->time_us) return (ea->time_us < eb->time_us) ? -1 : 1;
+  // keep insertion order for equal times
+  return (ea < eb) ? -1 : 1;
+}
+
+static void edges_sort(sim_edges_t* list)
+{
+  if (!list->unsorted) return;
+  qsort(list->edges + list->next, list->count - list->next, sizeof(sim_edge_t), edge_compare);
+  list->unsorted = false;
+}
+
+// @brief Next edge of a list up to time_us, NULL if none
+static sim_edge_t const* edges_next(sim_edges_t* list, uint64_t time_us)
+{
+  if (list->next == list->count || list->edges[list->next].time_us > time_us) return NULL;
+  return &list->edges[list->next++];
+}
+
+void sim_line_timing(uint gpio, uint rise_us, uint fall_us)
+{
+  s_rise_us[gpio] = (uint8_t) rise_us;
+  s_fall_us[gpio] = (uint8_t) fall_us;
+}
+
+// @brief Level of every pin once settled
+static uint32_t pins_target(void)
+{
+  // Columns currently driven low, in matrix column order
+  uint32_t low_cols = 0;
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    uint32_t bit = 1u << col_pins[col];
+    if ((s_gpio_oe & bit) && !(s_gpio_out & bit)) low_cols |= 1u << col;
+  }
+
+  // Outputs read back their level, inputs follow their pull
+  uint32_t value = (s_gpio_out & s_gpio_oe) | (~s_gpio_oe & ~s_gpio_pull_down);
+
+  // A closed switch pulls its row low through a driven column. A closed
+  // switch without a diode also pulls its column low from a low row, which
+  // reaches further rows (ghost keys); the columns it drives high are not
+  // modeled fighting back.
+  uint32_t low_rows = 0;
+  for (;;) {
+    uint32_t rows = 0;
+    for (uint row = 0; row < NUM_ROWS; ++row) {
+      uint32_t row_keys = (uint32_t) (s_closed >> (row * NUM_COLS)) & ((1u << NUM_COLS) - 1);
+      if (row_keys & low_cols) rows |= 1u << row;
+    }
+    if (rows == low_rows) break;
+    low_rows = rows;
+
+    uint64_t backward = s_closed & s_diodeless;
+    for (uint row = 0; row < NUM_ROWS; ++row) {
+      if (low_rows & (1u << row)) {
+        low_cols |= (uint32_t) (backward >> (row * NUM_COLS)) & ((1u << NUM_COLS) - 1);
+      }
+    }
+  }
+
+  for (uint row = 0; row < NUM_ROWS; ++row) {
+    if (low_rows & (1u << row)) value &= ~(1u << row_pins[row]);
+  }
+
+  return value;
+}
+
+// @brief Pin levels read at time_us
+static uint32_t pins_read(uint64_t time_us)
+{
+  uint32_t value = s_level;
+
+  for (uint32_t pending = s_settling; pending != 0; pending &= pending - 1) {
+    uint gpio = (uint) __builtin_ctz(pending);
+    uint32_t bit = 1u << gpio;
+    if (time_us < s_settled_us[gpio]) {
+      value = (value & ~bit) | (s_from & bit);
+    } else {
+      s_settling &= ~bit;
+    }
+  }
+
+  return value;
+}
+
+// @brief Start the pins whose settled level changed at time_us on their way
+static void pins_update(uint64_t time_us)
+{
+  uint32_t current = pins_read(time_us);
+  uint32_t target = pins_target();
+
+  for (uint32_t changed = target ^ s_level; changed != 0; changed &= changed - 1) {
+    uint gpio = (uint) __builtin_ctz(changed);
+    uint32_t bit = 1u << gpio;
+    uint delay = (target & bit) ? s_rise_us[gpio] : s_fall_us[gpio];
+
+    if (delay == 0 || (current & bit) == (target & bit)) {
+      s_settling &= ~bit;
+    } else {
+      s_settling |= bit;
+      s_from = (s_from & ~bit) | (current & bit);
+      s_settled_us[gpio] = time_us + delay;
+    }
+  }
+
+  s_level = target;
+}
+
+// @brief Apply every contact edge up to the calling core's time
+static void contacts_update(void)
+{
+  uint64_t now = time_us_64();
+  sim_edge_t const* edge;
+
+  while ((edge = edges_next(&s_edges, now)) != NULL) {
+    if (edge->closed) {
+      s_closed |= 1ULL << edge->key;
+    } else {
+      s_closed &= ~(1ULL << edge->key);
+    }
+    pins_update(edge->time_us);
+  }
+}
+
+void sim_diodeless(uint64_t keys)
+{
+  contacts_update();
+  s_diodeless = keys;
+  pins_update(time_us_64());
+}
+
+void gpio_init(uint gpio)
+{
+  contacts_update();
+  s_gpio_oe  &= ~(1u << gpio);
+  s_gpio_out &= ~(1u << gpio);
+  pins_update(time_us_64());
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+  contacts_update();
+  if (out) {
+    s_gpio_oe |= 1u << gpio;
+  } else {
+    s_gpio_oe &= ~(1u << gpio);
+  }
+  pins_update(time_us_64());
+}
+
+void gpio_pull_up(uint gpio)
+{
+  contacts_update();
+  s_gpio_pull_down &= ~(1u << gpio);
+  pins_update(time_us_64());
+}
+
+void gpio_pull_down(uint gpio)
+{
+  contacts_update();
+  s_gpio_pull_down |= 1u << gpio;
+  pins_update(time_us_64());
+}
+
+void gpio_put(uint gpio, bool value)
+{
+  contacts_update();
+  if (value) {
+    s_gpio_out |= 1u << gpio;
+  } else {
+    s_gpio_out &= ~(1u << gpio);
+  }
+  pins_update(time_us_64());
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value)
+{
+  contacts_update();
+  s_gpio_out = (s_gpio_out & ~mask) | (value & mask);
+  pins_update(time_us_64());
+}
+
+uint32_t gpio_get_all(void)
+{
+  contacts_update();
+  return pins_read(time_us_64());
+}
+
+bool gpio_get(uint gpio)
+{
+  return (gpio_get_all() >> gpio) & 1;
+}
+
+// Enabling acknowledges stale edges, as the SDK does
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled)
+{
+  if (!(event_mask & GPIO_IRQ_EDGE_FALL)) return;
+
+  if (enabled) {
+    s_irq_fall |= 1u << gpio;
+    s_irq_level = gpio_get_all();
+  } else {
+    s_irq_fall &= ~(1u << gpio);
+  }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback)
+{
+  s_irq_callback = callback;
+  gpio_set_irq_enabled(gpio, event_mask, enabled);
+}
+
+// @brief Deliver falling edges on armed pins up to the calling core's time
+// Taking an IRQ also ends a __wfe() on that core
+static void gpio_irq_poll(void)
+{
+  if (s_irq_fall == 0 || s_irq_callback == NULL) return;
+
+  uint32_t level = gpio_get_all();
+  uint32_t fell = s_irq_level & ~level & s_irq_fall;
+  s_irq_level = level;
+
+  for (uint gpio = 0; fell != 0; ++gpio, fell >>= 1) {
+    if (fell & 1) {
+      s_irq_callback(gpio, GPIO_IRQ_EDGE_FALL);
+      s_event[s_core] = true;
+    }
+  }
+}
+
+// Core1 sleeps up to the next contact edge, but never past core0's clock, so
+// core0 can __sev() it in time. Core0 sleep is not modeled: it keeps running
+// its passes while suspended.
+void __wfe(void)
+{
+  if (s_core == 1) {
+    gpio_irq_poll();
+
+    if (!s_event[1]) {
+      uint64_t wake_us = s_clock[0] + 1;
+      if (s_edges.next < s_edges.count && s_edges.edges[s_edges.next].time_us < wake_us) {
+        wake_us = s_edges.edges[s_edges.next].time_us;
+      }
+      if (s_clock[1] < wake_us) s_clock[1] = wake_us;
+      gpio_irq_poll();
+    }
+  }
+
+  s_event[s_core] = false;
+}
+
+//--------------------------------------------------------------------+
+// USB device / host
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  bool     busy;
+  uint8_t  report_id;
+  uint16_t len;
+  uint8_t  buf[1 + RAW_HID_REPORT_SIZE];   // report ID (if any) + data, as TinyUSB hands it back
+} sim_endpoint_t;
+
+static sim_endpoint_t s_ep[HID_INSTANCE_COUNT];
+static sim_report_cb_t s_report_cb = NULL;
+
+// OUT reports written by the host, one is delivered per frame
+#define SIM_OUT_QUEUE_SIZE  16
+
+typedef struct
+{
+  uint8_t  instance;
+  uint16_t len;
+  uint8_t  data[RAW_HID_REPORT_SIZE];
+} sim_out_report_t;
+
+static sim_out_report_t s_out[SIM_OUT_QUEUE_SIZE];
+static uint s_out_head = 0, s_out_tail = 0;
+
+bool sim_hid_out(uint8_t instance, uint8_t const* data, uint16_t len)
+{
+  if (s_out_head - s_out_tail >= SIM_OUT_QUEUE_SIZE || len > RAW_HID_REPORT_SIZE) return false;
+
+  sim_out_report_t* out = &s_out[s_out_head++ % SIM_OUT_QUEUE_SIZE];
+  out->instance = instance;
+  out->len = len;
+  memcpy(out->data, data, len);
+  return true;
+}
+
+// Bus suspend: no frames, the host resumes SIM_RESUME_US after a remote wakeup
+static bool     s_bus_suspended = false;
+static bool     s_bus_remote_wakeup_en = false;
+static uint64_t s_resume_us = 0;          // 0 = no resume pending
+static uint64_t s_remote_wakeup_us = 0;
+
+bool tud_mounted(void)       { return true; }
+bool tud_suspended(void)     { return s_bus_suspended; }
+
+// SOF callback on every frame once enabled
+static bool s_sof_enabled = false;
+
+void tud_sof_cb_enable(bool en)
+{
+  s_sof_enabled = en;
+}
+
+bool tud_remote_wakeup(void)
+{
+  if (!s_bus_suspended || !s_bus_remote_wakeup_en || s_resume_us != 0) return false;
+
+  s_remote_wakeup_us = s_clock[0];
+  s_resume_us = s_clock[0] + SIM_RESUME_US;
+  return true;
+}
+
+void sim_usb_suspend(bool remote_wakeup_en)
+{
+  s_bus_suspended = true;
+  s_bus_remote_wakeup_en = remote_wakeup_en;
+  s_remote_wakeup_us = 0;
+
+  // tud_suspend_cb() (main.c)
+  s_core = 0;
+  power_suspend(remote_wakeup_en);
+}
+
+uint64_t sim_remote_wakeup_time(void)
+{
+  return s_remote_wakeup_us;
+}
+
+bool tud_hid_n_ready(uint8_t instance)
+{
+  return instance < HID_INSTANCE_COUNT && !s_ep[instance].busy;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const* report, uint16_t len)
+{
+  if (!tud_hid_n_ready(instance) || len + 1u > sizeof(s_ep[instance].buf)) return false;
+
+  sim_endpoint_t* ep = &s_ep[instance];
+  uint16_t offset = report_id ? 1 : 0;
+
+  ep->buf[0] = report_id;
+  memcpy(ep->buf + offset, report, len);
+  ep->report_id = report_id;
+  ep->len = (uint16_t) (len + offset);
+  ep->busy = true;
+
+  return true;
+}
+
+// @brief Host IN poll on every endpoint and one OUT report, callbacks run on the USB core
+static void usb_frame(uint64_t frame_us)
+{
+  // tud_sof_cb() (main.c)
+  if (s_sof_enabled) sof_sync_frame((uint32_t) (frame_us / SIM_USB_FRAME_US));
+
+  if (s_out_tail != s_out_head) {
+    sim_out_report_t const* out = &s_out[s_out_tail++ % SIM_OUT_QUEUE_SIZE];
+    tud_hid_set_report_cb(out->instance, 0, HID_REPORT_TYPE_INVALID, out->data, out->len);
+  }
+
+  for (uint8_t i = 0; i < HID_INSTANCE_COUNT; ++i) {
+    sim_endpoint_t* ep = &s_ep[i];
+    if (!ep->busy) continue;
+
+    uint16_t offset = ep->report_id ? 1 : 0;
+    if (s_report_cb) {
+      s_report_cb(frame_us, i, ep->report_id, ep->buf + offset, (uint16_t) (ep->len - offset));
+    }
+
+    ep->busy = false;
+    tud_hid_report_complete_cb(i, ep->buf, ep->len);
+  }
+}
+
+//--------------------------------------------------------------------+
+// Flash (NOR: erase sets bytes to 0xff, programming only clears bits)
+//--------------------------------------------------------------------+
+
+#define SIM_FLASH_ERASE_US    45000   // typical 4KB sector erase
+#define SIM_FLASH_PROGRAM_US  800     // typical 256B page program
+
+static uint8_t s_flash[PICO_FLASH_SIZE_BYTES];
+static bool    s_flash_ready = false;
+
+uint8_t* sim_flash_memory(void)
+{
+  if (!s_flash_ready) {
+    memset(s_flash, 0xff, sizeof(s_flash));
+    s_flash_ready = true;
+  }
+  return s_flash;
+}
+
+// Only the calling core's clock moves, core1 is not parked in the simulation
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  memset(sim_flash_memory() + flash_offs, 0xff, count);
+  sleep_us(SIM_FLASH_ERASE_US * (count / FLASH_SECTOR_SIZE));
+}
+
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count)
+{
+  uint8_t* flash = sim_flash_memory() + flash_offs;
+  for (size_t i = 0; i < count; ++i) flash[i] &= data[i];
+  sleep_us(SIM_FLASH_PROGRAM_US * (count / FLASH_PAGE_SIZE));
+}
+
+#if SPLIT_LINK
+//--------------------------------------------------------------------+
+// Split link: UART (8N1 at SPLIT_BAUD) and the other half's controller
+//--------------------------------------------------------------------+
+
+#define SIM_UART_FIFO   32       // TX FIFO, as the RP2040's
+#define SIM_UART_RING   256      // bytes on their way, a power of 2
+#define SIM_BYTE_NS     ((10ULL * 1000000000 + SPLIT_BAUD - 1) / SPLIT_BAUD)
+
+// One direction: each byte with the time its stop bit is received
+typedef struct
+{
+  uint8_t  data[SIM_UART_RING];
+  uint64_t arrive_ns[SIM_UART_RING];
+  uint32_t head, tail;
+} sim_uart_t;
+
+enum { SIM_TO_RIGHT = 0, SIM_TO_LEFT };
+
+static sim_uart_t s_uart[2];
+static uint32_t   s_byte_errors = 0;      // per million bytes
+static uint32_t   s_error_seed = 1;
+
+static split_link_t  s_left;
+static sched_stage_t s_left_stages[] = {
+  { .name = "left scan", .fn = NULL, .period_us = SCAN_PERIOD_US },
+};
+
+void sim_split_byte_errors(uint32_t per_million)
+{
+  s_byte_errors = per_million;
+}
+
+split_link_t const* sim_split_left(void)
+{
+  return &s_left;
+}
+
+static uint sim_uart_read(void* ctx, uint8_t* buf, uint len)
+{
+  sim_uart_t* uart = &s_uart[(uintptr_t) ctx];
+  uint64_t now_ns = time_us_64() * 1000;
+  uint count = 0;
+
+  while (count < len && uart->tail != uart->head && uart->arrive_ns[uart->tail % SIM_UART_RING] <= now_ns) {
+    buf[count++] = uart->data[uart->tail++ % SIM_UART_RING];
+  }
+  return count;
+}
+
+// A byte leaves the FIFO when the one before it has been sent
+static uint sim_uart_write(void* ctx, uint8_t const* buf, uint len)
+{
+  sim_uart_t* uart = &s_uart[1 - (uintptr_t) ctx];
+  uint64_t now_ns = time_us_64() * 1000;
+  uint count = 0;
+
+  while (count < len && uart->head - uart->tail < SIM_UART_RING)
+  {
+    uint64_t start_ns = now_ns;
+    uint32_t queued = 0;
+    if (uart->head != uart->tail) {
+      uint64_t last_ns = uart->arrive_ns[(uart->head - 1) % SIM_UART_RING];
+      if (last_ns > start_ns) start_ns = last_ns;
+      // Bytes not started yet are still in the FIFO
+      if (last_ns > now_ns + SIM_BYTE_NS) queued = (uint32_t) ((last_ns - now_ns) / SIM_BYTE_NS);
+    }
+    if (queued >= SIM_UART_FIFO) break;
+
+    uint8_t byte = buf[count++];
+    if (s_byte_errors != 0) {
+      s_error_seed = s_error_seed * 1103515245u + 12345u;
+      if ((s_error_seed >> 8) % 1000000 < s_byte_errors) byte ^= (uint8_t) (1u << ((s_error_seed >> 4) & 7));
+    }
+    uart->data[uart->head % SIM_UART_RING] = byte;
+    uart->arrive_ns[uart->head % SIM_UART_RING] = start_ns + SIM_BYTE_NS;
+    uart->head++;
+  }
+  return count;
+}
+
+// @brief Time (us, rounded up) the next byte is received, UINT64_MAX if none
+static uint64_t sim_uart_next_us(sim_uart_t const* uart)
+{
+  if (uart->tail == uart->head) return UINT64_MAX;
+  return (uart->arrive_ns[uart->tail % SIM_UART_RING] + 999) / 1000;
+}
+
+// A port's ctx is the direction it reads, it writes the other one
+
+// This half (split_uart.c on the target)
+split_port_t const* split_port(void)
+{
+  static split_port_t const port = { sim_uart_read, sim_uart_write, (void*) (uintptr_t) SIM_TO_RIGHT };
+  return &port;
+}
+
+// The other half's end
+static split_port_t const s_left_port = { sim_uart_read, sim_uart_write, (void*) (uintptr_t) SIM_TO_LEFT };
+
+// The other half's split_scan_task() (keyboard.c): sample its contacts,
+// SIM_LEFT_SCAN_US of column scan, send
+static void left_scan_task(void)
+{
+  uint64_t now = time_us_64();
+  sim_edge_t const* edge;
+
+  while ((edge = edges_next(&s_left_edges, now)) != NULL) {
+    if (edge->closed) {
+      s_left_closed |= 1ULL << edge->key;
+    } else {
+      s_left_closed &= ~(1ULL << edge->key);
+    }
+  }
+
+  uint64_t sample = s_left_closed;
+  busy_wait_until(now + SIM_LEFT_SCAN_US);
+  split_link_send(&s_left, sample, time_us_32());
+}
+
+// @brief One pass of the other half's main loop (main.c, SPLIT_PERIPHERAL), s_core = 2
+// It busy-polls on the target: here it waits for the next stage or the next
+// byte in, but never past core1, which may still send one before that
+static void core2_pass(void)
+{
+  split_link_poll(&s_left, time_us_32());
+  split_link_align(&s_left, &s_left_stages[0], SIM_LEFT_SCAN_US);
+  uint64_t wake_us = scheduler_run(s_left_stages, TU_ARRAY_SIZE(s_left_stages));
+
+  uint64_t rx_us = sim_uart_next_us(&s_uart[SIM_TO_LEFT]);
+  if (rx_us < wake_us) wake_us = rx_us;
+  if (s_left.tx_head != s_left.tx_tail && s_clock[2] + 1 < wake_us) wake_us = s_clock[2] + 1;
+  if (s_clock[1] + 1 < wake_us) wake_us = s_clock[1] + 1;
+  if (wake_us <= s_clock[2]) wake_us = s_clock[2] + 1;
+  busy_wait_until(wake_us);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Cores (mirror the stage tables in main.c)
+//--------------------------------------------------------------------+
+
+static sched_stage_t s_core0_stages[] = {
+  { .name = "report",   .fn = hid_task,       .period_us = REPORT_PERIOD_US    },
+  { .name = "idle",     .fn = idle_task,      .period_us = IDLE_PERIOD_US      },
+};
+
+static sched_stage_t s_core1_stages[] = {
+  { .name = "scan",     .fn = scan_task,      .period_us = SCAN_PERIOD_US      },
+  { .name = "debounce", .fn = debounce_task,  .period_us = DEBOUNCE_PERIOD_US  },
+  { .name = "calib",    .fn = calibrate_task, .period_us = CALIBRATE_PERIOD_US },
+};
+
+static uint64_t s_next_frame_us = SIM_USB_FRAME_US;
+
+void sim_init(sim_report_cb_t report_cb)
+{
+  s_report_cb = report_cb;
+
+  s_core = 0;
+  for (uint row = 0; row < NUM_ROWS; ++row) {
+    if (s_rise_us[row_pins[row]] == 0) s_rise_us[row_pins[row]] = SIM_ROW_RISE_US;
+  }
+  matrix_scan_init();
+  keyboard_init();
+  power_init();
+  sof_sync_init();
+  sof_sync_mount();   // tud_mount_cb() (main.c)
+  scheduler_init(s_core0_stages, TU_ARRAY_SIZE(s_core0_stages));
+
+  // core1 is launched after the matrix init (and its settle calibration)
+  s_clock[1] = s_clock[0];
+  s_core = 1;
+  keyboard_core1_init();
+  scheduler_init(s_core1_stages, TU_ARRAY_SIZE(s_core1_stages));
+
+#if SPLIT_LINK
+  // The other half powers up with this one
+  s_clock[2] = s_clock[0];
+  s_core = 2;
+  s_left_stages[0].fn = left_scan_task;
+  split_link_init(&s_left, &s_left_port, SPLIT_ROLE_PERIPHERAL, time_us_32());
+  scheduler_init(s_left_stages, TU_ARRAY_SIZE(s_left_stages));
+#endif
+
+  s_core = 0;
+}
+
+uint64_t sim_now(void)
+{
+  uint64_t now = s_clock[0];
+  for (uint core = 1; core < SIM_CORES; ++core) {
+    if (s_clock[core] < now) now = s_clock[core];
+  }
+  return now;
+}
+
+void sim_run_until(uint64_t time_us)
+{
+  edges_sort(&s_edges);
+#if SPLIT_LINK
+  edges_sort(&s_left_edges);
+#endif
+
+  while (sim_now() < time_us)
+  {
+#if SPLIT_LINK
+    if (s_clock[2] < s_clock[0] && s_clock[2] < s_clock[1])
+    {
+      s_core = 2;
+      core2_pass();
+      continue;
+    }
+#endif
+    if (s_clock[1] <= s_clock[0])
+    {
+      s_core = 1;
+      if (power_core1_sleep(s_core1_stages, TU_ARRAY_SIZE(s_core1_stages))) continue;
+      sof_sync_align_scan(s_core1_stages, TU_ARRAY_SIZE(s_core1_stages));
+
+      uint64_t next = scheduler_run(s_core1_stages, TU_ARRAY_SIZE(s_core1_stages));
+      if (power_scan_rate_update(&s_core1_stages[0], &s_core1_stages[1])) continue;
+      power_core1_wait(next);
+    }
+    else
+    {
+      s_core = 0;
+      core0_pass();
+    }
+  }
+
+  s_core = 0;
+}
+
+// @brief USB frames due, then one core0 main loop pass (s_core = 0)
+static void core0_pass(void)
+{
+  // Host resume after a remote wakeup, tud_resume_cb() (main.c)
+  if (s_resume_us != 0 && s_resume_us <= s_clock[0]) {
+    s_resume_us = 0;
+    s_bus_suspended = false;
+    power_resume();
+  }
+
+  while (s_next_frame_us <= s_clock[0]) {
+    if (!s_bus_suspended) usb_frame(s_next_frame_us);
+    s_next_frame_us += SIM_USB_FRAME_US;
+  }
+
+  sof_sync_align_report(&s_core0_stages[0]);
+  uint64_t next = scheduler_run(s_core0_stages, TU_ARRAY_SIZE(s_core0_stages));
+  power_task();
+  busy_wait_until((next < s_next_frame_us) ? next : s_next_frame_us);
+}
+
+sched_stage_t const* sim_stages(uint core, uint* count)
+{
+  if (core == 0) {
+    *count = TU_ARRAY_SIZE(s_core0_stages);
+    return s_core0_stages;
+  }
+#if SPLIT_LINK
+  if (core == 2) {
+    *count = TU_ARRAY_SIZE(s_left_stages);
+    return s_left_stages;
+  }
+#endif
+
+  *count = TU_ARRAY_SIZE(s_core1_stages);
+  return s_core1_stages;
+}
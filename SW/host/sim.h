@@ -0,0 +1,88 @@
+// Host simulation of the firmware on Linux
+// Runs the real scan -> debounce -> report code against the mock HAL in mock/:
+// - two virtual cores with their own clocks (sleep_us() advances the caller's)
+// - a switch matrix driven by scripted contact edges (bounce included), rows
+//   rising back high through their pull-ups in SIM_ROW_RISE_US
+//   (sim_line_timing()); switches without a diode give ghost keys (sim_diodeless())
+// - a USB host that reads each busy IN endpoint once per 1ms frame and
+//   writes queued OUT reports (sim_hid_out()), one per frame
+// - flash in RAM (sim_flash_memory()), erased until written
+// - USB suspend / remote wakeup / resume (sim_usb_suspend())
+// - SPLIT_LINK builds: the other half's controller as a third core, its
+//   contacts (keys SPLIT_KEY_FIRST ..) sampled every SIM_LEFT_SCAN_US scan
+//   and sent over a simulated UART (SPLIT_BAUD 8N1, byte errors with
+//   sim_split_byte_errors()) to this half's split_port()
+//
+// Cores are interleaved one scheduler pass at a time, always running the core
+// whose clock is behind. A sleep_us() on core1 (scan settle delays) runs the
+// core0 passes due meanwhile, so a scan result only reaches core0 once it
+// exists; otherwise cross-core timing is exact to within one stage call.
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "pico/types.h"
+#include "scheduler.h"
+#include "split_link.h"
+
+#define SIM_USB_FRAME_US  1000
+
+// Host drives resume for 20ms after a remote wakeup before the bus runs again
+#define SIM_RESUME_US     20000
+
+// Row rise time through the pull-up, unless set with sim_line_timing()
+#define SIM_ROW_RISE_US   2
+
+// The other half's matrix scan, sample to frame queued
+#define SIM_LEFT_SCAN_US  40
+
+// Invoked when the host receives an IN report (data without report ID)
+typedef void (*sim_report_cb_t)(uint64_t time_us, uint8_t instance, uint8_t report_id,
+                                uint8_t const* data, uint16_t len);
+
+// @brief Initialize the firmware side (matrix, core1 state, schedulers)
+void sim_init(sim_report_cb_t report_cb);
+
+// @brief Add a switch contact edge, edges may be added in any order
+// @param key key state bit position (row * NUM_COLS + col), the other half's
+//            from SPLIT_KEY_FIRST (SPLIT_LINK builds)
+void sim_key_edge(uint64_t time_us, uint key, bool closed);
+
+// @brief Switches without a diode from now on (key state bit mask)
+// A closed one also conducts from its row to its column, so three keys on
+// the corners of a rectangle make the fourth read as pressed.
+void sim_diodeless(uint64_t keys);
+
+// @brief Set a pin's rise / fall time (us), call before sim_init()
+// The pin reads its old level for that long after its level changes.
+void sim_line_timing(uint gpio, uint rise_us, uint fall_us);
+
+// @brief Run both cores and the USB host until time_us
+void sim_run_until(uint64_t time_us);
+
+// @brief Queue an OUT report from the host, delivered to tud_hid_set_report_cb() on a later frame
+// @return false if the OUT queue is full
+bool sim_hid_out(uint8_t instance, uint8_t const* data, uint16_t len);
+
+// @brief Suspend the bus now (tud_suspend_cb()), frames stop until the device
+// signals remote wakeup and the host resumes SIM_RESUME_US later
+void sim_usb_suspend(bool remote_wakeup_en);
+
+// @brief Time of the last tud_remote_wakeup() since sim_usb_suspend(), 0 if none
+uint64_t sim_remote_wakeup_time(void);
+
+// @brief Current simulated time (the slower core)
+uint64_t sim_now(void);
+
+// @brief Scheduler stage table of a core (0 = USB core, 1 = scan core, 2 = other half)
+sched_stage_t const* sim_stages(uint core, uint* count);
+
+#if SPLIT_LINK
+// @brief Corrupt one bit of this many bytes per million on the split UART, both ways
+void sim_split_byte_errors(uint32_t per_million);
+
+// @brief The other half's end of the link (this half's: keyboard_split_link())
+split_link_t const* sim_split_left(void);
+#endif
+
+#endif /* SIM_H_ */
@@ -0,0 +1,119 @@
+// kb_sim: replay a key script through the firmware and print the host reports
+//
+// Script lines (blank lines and '#' comments are ignored):
+//   <time_ms> <row> <col> down|up [bounces]
+// bounces adds that many chatter pairs (edges 100us apart) after the edge,
+// so the contact still ends in the requested state.
+//
+// usage: kb_sim [script]   (reads stdin without an argument)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "usb_descriptors.h"
+#include "matrix_scan.h"
+#include "tap_hold.h"
+#include "combo.h"
+#include "sim.h"
+
+#define BOUNCE_STEP_US  100
+#define TAIL_US         50000
+
+static void print_report(uint64_t time_us, uint8_t instance, uint8_t report_id,
+                         uint8_t const* data, uint16_t len)
+{
+  printf("%9.3f ms  itf %u", (double) time_us / 1000.0, instance);
+  if (report_id) printf(" id %u", report_id);
+
+  if (instance == HID_INSTANCE_NKRO && len == sizeof(hid_nkro_report_t))
+  {
+    hid_nkro_report_t const* report = (hid_nkro_report_t const*) data;
+    printf("  mod %02x keys", report->modifier);
+    for (uint kc = 0; kc < NKRO_KEYCODE_COUNT; ++kc) {
+      if (report->bitmap[kc >> 3] & (1u << (kc & 7))) printf(" %02x", kc);
+    }
+  }
+  else if (instance == HID_INSTANCE_AUX && report_id == REPORT_ID_MOUSE && len == sizeof(hid_mouse_report_t))
+  {
+    hid_mouse_report_t const* report = (hid_mouse_report_t const*) data;
+    printf("  buttons %02x x %d y %d wheel %d pan %d", report->buttons, report->x, report->y, report->wheel, report->pan);
+  }
+  else if (instance == HID_INSTANCE_AUX && report_id == REPORT_ID_CONSUMER_CONTROL && len == sizeof(uint16_t))
+  {
+    printf("  usage %04x", data[0] | (data[1] << 8));
+  }
+  else
+  {
+    printf("  data");
+    for (uint16_t i = 0; i < len; ++i) printf(" %02x", data[i]);
+  }
+
+  printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* in = stdin;
+  if (argc > 1 && (in = fopen(argv[1], "r")) == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  uint64_t end_us = 0;
+  char line[128];
+  uint line_no = 0;
+
+  while (fgets(line, sizeof(line), in))
+  {
+    line_no++;
+
+    double t_ms;
+    uint row, col, bounces = 0;
+    char dir[8];
+
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    if (sscanf(line, " %c", dir) != 1) continue;
+
+    if (sscanf(line, "%lf %u %u %7s %u", &t_ms, &row, &col, dir, &bounces) < 4 ||
+        row >= NUM_ROWS || col >= NUM_COLS ||
+        (strcmp(dir, "down") != 0 && strcmp(dir, "up") != 0))
+    {
+      fprintf(stderr, "line %u: expected '<time_ms> <row> <col> down|up [bounces]'\n", line_no);
+      return 1;
+    }
+
+    uint64_t t_us = (uint64_t) (t_ms * 1000.0);
+    uint key = row * NUM_COLS + col;
+    bool closed = (strcmp(dir, "down") == 0);
+
+    // First edge in the requested state, then bounce back and forth
+    for (uint i = 0; i <= 2 * bounces; ++i) {
+      sim_key_edge(t_us + i * BOUNCE_STEP_US, key, (i & 1) ? !closed : closed);
+    }
+
+    uint64_t last_us = t_us + 2 * bounces * BOUNCE_STEP_US;
+    if (last_us > end_us) end_us = last_us;
+  }
+
+  if (in != stdin) fclose(in);
+
+  sim_init(print_report);
+  sim_run_until(end_us + TAIL_US);
+
+  combo_stats_t const* cs = combo_stats();
+  if (cs->combos || cs->failed) {
+    printf("combo: %u sent, %u sent as keys (max %u us to decide), %u without a free virtual key\n",
+           cs->combos, cs->failed, cs->max_wait_us, cs->overflows);
+  }
+
+  tap_hold_stats_t const* th = tap_hold_stats();
+  if (th->taps || th->holds) {
+    printf("tap-hold: %u taps (max %u us to decide), %u holds (max %u us), %u forced by full buffer\n",
+           th->taps, th->max_tap_us, th->holds, th->max_hold_us, th->overflows);
+  }
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+// Key transition event ring (core1 -> core0)
+// head is written only by the producer, tail only by the consumer. The fences
+// make sure the slot contents are visible before the index that publishes them.
+
+#include "key_event.h"
+
+#include "hardware/sync.h"
+
+static key_event_t s_ring[KEY_EVENT_QUEUE_SIZE];
+static volatile uint32_t s_head = 0;  // next slot to write (producer)
+static volatile uint32_t s_tail = 0;  // next slot to read (consumer)
+static volatile uint32_t s_dropped = 0;
+
+bool key_event_push(key_event_t const* event)
+{
+  uint32_t head = s_head;
+
+  if (head - s_tail >= KEY_EVENT_QUEUE_SIZE) {
+    s_dropped++;
+    return false;
+  }
+
+  s_ring[head & (KEY_EVENT_QUEUE_SIZE - 1)] = *event;
+  __mem_fence_release();
+  s_head = head + 1;
+
+  return true;
+}
+
+bool key_event_pop(key_event_t* event)
+{
+  uint32_t tail = s_tail;
+
+  if (tail == s_head) return false;
+  __mem_fence_acquire();
+
+  *event = s_ring[tail & (KEY_EVENT_QUEUE_SIZE - 1)];
+  __mem_fence_release();
+  s_tail = tail + 1;
+
+  return true;
+}
+
+uint32_t key_event_count(void)
+{
+  return s_head - s_tail;
+}
+
+uint32_t key_event_dropped(void)
+{
+  return s_dropped;
+}
@@ -0,0 +1,39 @@
+// Key transition events passed from the scan core (core1) to the USB core (core0)
+// Lock-free single-producer / single-consumer ring: core1 pushes, core0 pops.
+
+#ifndef KEY_EVENT_H_
+#define KEY_EVENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "latency.h"
+
+// Ring capacity, must be a power of 2
+#define KEY_EVENT_QUEUE_SIZE  64
+
+typedef struct
+{
+  uint32_t time_us;   // time_us_32() of the scan that saw the transition
+  uint8_t  key;       // key state bit position (row * NUM_COLS + col)
+  uint8_t  pressed;   // 1 = press, 0 = release
+#if LATENCY_STATS
+  uint32_t commit_us; // time_us_32() when debounce pushed it
+#endif
+} key_event_t;
+
+// @brief Push an event (producer / core1 only)
+// @return false if the ring is full, the event is dropped and counted
+bool key_event_push(key_event_t const* event);
+
+// @brief Pop the oldest event (consumer / core0 only)
+// @return false if the ring is empty
+bool key_event_pop(key_event_t* event);
+
+// @brief Events waiting (consumer / core0 only)
+uint32_t key_event_count(void);
+
+// @brief Number of events dropped because the ring was full
+uint32_t key_event_dropped(void);
+
+#endif /* KEY_EVENT_H_ */
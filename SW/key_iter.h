@@ -0,0 +1,30 @@
+// Sparse iteration over the set bits of a key state word
+// Visits only pressed (or changed) keys, lowest bit position first, so the
+// cost follows the number of set bits instead of the matrix size:
+//
+//   uint64_t keys = action_keycode_keys(word);
+//   uint key;
+//   while (key_iter_next(&keys, &key)) {
+//     ... action_held(64 * word + key).code ...
+//   }
+
+#ifndef KEY_ITER_H_
+#define KEY_ITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+
+// @brief Take the lowest set bit out of *keys
+// @param key receives its bit position (row * NUM_COLS + col)
+// @return false once *keys is empty
+static inline bool key_iter_next(uint64_t* keys, uint* key)
+{
+  if (*keys == 0) return false;
+
+  *key = (uint) __builtin_ctzll(*keys);
+  *keys &= *keys - 1;
+  return true;
+}
+
+#endif /* KEY_ITER_H_ */
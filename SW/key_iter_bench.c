@@ -0,0 +1,92 @@
+// Microbenchmark: full matrix walk vs key_iter_next(), see key_iter_bench.h
+// Both builders fill a 160-bit usage bitmap from the base layer, the same work
+// as build_nkro_report() in keyboard.c.
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "key_iter.h"
+#include "key_iter_bench.h"
+#include "keymap_table.h"
+
+#define BENCH_BITMAP_BYTES  20
+
+static uint8_t const s_pressed_counts[KEY_ITER_BENCH_CASES] = { 0, 1, 3, 6, 10, 20 };
+
+// Keep the builders from being folded into the timing loop
+static volatile uint8_t s_sink;
+
+__attribute__((noinline))
+static void build_walk(uint64_t key_state, uint8_t bitmap[BENCH_BITMAP_BYTES])
+{
+  memset(bitmap, 0, BENCH_BITMAP_BYTES);
+
+  for (uint row = 0; row < NUM_ROWS; ++row) {
+    for (uint col = 0; col < NUM_COLS; ++col) {
+      uint bit_pos = row * NUM_COLS + col;
+      if (!(key_state & (1ULL << bit_pos))) continue;
+
+      key_action_t const* action = &keymap_actions[0][bit_pos];
+      if (action->type == KEY_ACTION_KEY && action->code < BENCH_BITMAP_BYTES * 8) {
+        bitmap[action->code >> 3] |= (uint8_t) (1u << (action->code & 7));
+      }
+    }
+  }
+}
+
+__attribute__((noinline))
+static void build_sparse(uint64_t key_state, uint8_t bitmap[BENCH_BITMAP_BYTES])
+{
+  memset(bitmap, 0, BENCH_BITMAP_BYTES);
+
+  uint64_t keys = key_state & keymap_key_mask[0];
+  uint key;
+  while (key_iter_next(&keys, &key)) {
+    uint8_t kc = keymap_actions[0][key].code;
+    if (kc < BENCH_BITMAP_BYTES * 8) {
+      bitmap[kc >> 3] |= (uint8_t) (1u << (kc & 7));
+    }
+  }
+}
+
+// @brief Key state with the first n keycode keys of the base layer down
+static uint64_t bench_state(uint n)
+{
+  uint64_t state = 0;
+  uint64_t keys = keymap_key_mask[0];
+  uint key;
+
+  while (n-- && key_iter_next(&keys, &key)) {
+    state |= 1ULL << key;
+  }
+  return state;
+}
+
+static uint32_t time_builder(void (*build)(uint64_t, uint8_t*), uint64_t state,
+                             uint64_t (*now_ns)(void), uint iterations)
+{
+  uint8_t bitmap[BENCH_BITMAP_BYTES];
+
+  uint64_t start = now_ns();
+  for (uint i = 0; i < iterations; ++i) {
+    build(state, bitmap);
+    s_sink = bitmap[i % BENCH_BITMAP_BYTES];
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  return (uint32_t) (elapsed / iterations);
+}
+
+void key_iter_bench_run(key_iter_bench_result_t results[KEY_ITER_BENCH_CASES],
+                        uint64_t (*now_ns)(void), uint iterations)
+{
+  for (uint i = 0; i < KEY_ITER_BENCH_CASES; ++i) {
+    uint64_t state = bench_state(s_pressed_counts[i]);
+
+    results[i].pressed   = (uint8_t) __builtin_popcountll(state);
+    results[i].walk_ns   = time_builder(build_walk, state, now_ns, iterations);
+    results[i].sparse_ns = time_builder(build_sparse, state, now_ns, iterations);
+  }
+}
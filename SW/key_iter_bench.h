@@ -0,0 +1,26 @@
+// Microbenchmark: full matrix walk vs key_iter_next() for building a report
+// Runs on the target (KEY_ITER_BENCH build option, results read with the
+// debugger) and on the host (kb_bench).
+
+#ifndef KEY_ITER_BENCH_H_
+#define KEY_ITER_BENCH_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+// Pressed key counts measured: 0, 1, 3, 6, 10, 20
+#define KEY_ITER_BENCH_CASES  6
+
+typedef struct
+{
+  uint8_t  pressed;     // keys down in the test state
+  uint32_t walk_ns;     // per report, testing every matrix position
+  uint32_t sparse_ns;   // per report, visiting only set bits
+} key_iter_bench_result_t;
+
+// @brief Time both report builders on states with 0 .. 20 keys down
+// @param now_ns monotonic clock in ns
+void key_iter_bench_run(key_iter_bench_result_t results[KEY_ITER_BENCH_CASES],
+                        uint64_t (*now_ns)(void), uint iterations);
+
+#endif /* KEY_ITER_BENCH_H_ */
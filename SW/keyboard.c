@@ -0,0 +1,597 @@
+// Keyboard pipeline
+// core1: matrix scan (+ the other half's sample) -> debounce -> key events
+// core0: key events -> key state -> HID reports
+// See keyboard.h for stage periods and debounce settings.
+
+#include <string.h>
+
+#include "bsp/board_api.h"
+#include "tusb.h"
+
+#include "pico/time.h"
+
+#include "usb_descriptors.h"
+#include "matrix_scan.h"
+#include "key_event.h"
+#include "debounce.h"
+#include "ghost.h"
+#include "report_queue.h"
+#include "key_iter.h"
+#include "layer.h"
+#include "action.h"
+#include "tap_hold.h"
+#include "combo.h"
+#include "macro.h"
+#include "mouse_keys.h"
+#include "store.h"
+#include "raw_hid.h"
+#include "latency.h"
+#include "power.h"
+#include "sof_sync.h"
+#include "split_link.h"
+#include "keyboard.h"
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF PROTYPES
+//--------------------------------------------------------------------+
+
+// Keyboard state - 64 bits for up to 60 keys per word (KEY_WORDS, split_link.h)
+// Owned by core0, rebuilt from the key events pushed by core1
+static uint64_t g_key_state[KEY_WORDS];
+
+// Time the last key event was applied, for idle_task()
+// 64 bits: the keyboard may sit untouched for longer than the 32-bit timer wraps
+static uint64_t s_last_event_us = 0;
+
+static keyboard_stats_t s_stats;
+
+uint8_t keyboard_keycode(uint8_t layer, uint key)
+{
+  key_action_t action = keymap_action(layer, key);
+  return (action.type == KEY_ACTION_KEY || action.type == KEY_ACTION_MODIFIER) ? action.code : 0;
+}
+
+uint64_t keyboard_state(uint word)
+{
+  return g_key_state[word];
+}
+
+// @brief Any key down in a key state
+static bool keys_down(uint64_t const state[KEY_WORDS])
+{
+  uint64_t any = 0;
+  for (uint word = 0; word < KEY_WORDS; ++word) any |= state[word];
+  return any != 0;
+}
+
+keyboard_stats_t const* keyboard_stats(void)
+{
+  return &s_stats;
+}
+
+//--------------------------------------------------------------------+
+// Scan / debounce (core1)
+//--------------------------------------------------------------------+
+
+// Latest sample (local matrix ghost filtered, then the other half's), written
+// by scan_task() and read by debounce_task()
+static uint64_t s_raw_state[KEY_WORDS];
+static uint32_t s_raw_time_us = 0;
+
+// Debounced state as last pushed to core0
+static debounce_t s_debounce[KEY_WORDS];
+static uint64_t s_prev_state[KEY_WORDS];
+
+#if SPLIT_LINK
+// Link to the other half, polled by the scan stage only
+static split_link_t s_link;
+
+split_link_t const* keyboard_split_link(void)
+{
+  return &s_link;
+}
+#endif
+
+// @brief Scan stage (core1)
+void scan_task(void)
+{
+  uint32_t start_us = time_us_32();
+#if SPLIT_LINK
+  // Take the samples received since the last scan, then SYNC: the left half
+  // times its next sample to land just before the next scan
+  split_link_poll(&s_link, start_us);
+  split_link_sync(&s_link, power_scan_period());
+#endif
+
+  uint64_t sample;
+  matrix_scan_read(&sample);
+  s_raw_state[0] = ghost_filter(sample);
+#if SPLIT_LINK
+  s_raw_state[1] = split_link_state(&s_link);
+#endif
+  s_raw_time_us = time_us_32();
+
+  // Only a sample with a key down took a full column scan
+  if (sample != 0) sof_sync_scan(s_raw_time_us - start_us);
+  power_scan_sample(keys_down(s_raw_state), s_raw_time_us);
+}
+
+// @brief Debounce stage (core1)
+// Debounce the latest sample and push every debounced key transition to core0
+void debounce_task(void)
+{
+  bool pushed = false;
+
+  for (uint word = 0; word < KEY_WORDS; ++word)
+  {
+    uint64_t state = debounce_update(&s_debounce[word], s_raw_state[word]);
+
+    uint64_t changed = state ^ s_prev_state[word];
+    if (changed == 0) continue;
+
+    uint key;
+    while (key_iter_next(&changed, &key))
+    {
+      key_event_t event = {
+        .time_us = s_raw_time_us,
+        .key     = (uint8_t) (64 * word + key),
+        .pressed = (uint8_t) ((state >> key) & 1)
+      };
+#if LATENCY_STATS
+      event.commit_us = time_us_32();
+#endif
+
+      // If the ring is full keep the old bit, so the transition is retried next time
+      if (key_event_push(&event)) {
+        s_prev_state[word] ^= 1ULL << key;
+      }
+    }
+    pushed = true;
+  }
+
+  if (pushed) sof_sync_commit(time_us_32());
+}
+
+// @brief Settle re-calibration stage (core1)
+// Follows drift (temperature, supply) one line at a time. Runs after the scan
+// in the same pass, so a key down in that scan skips it.
+void calibrate_task(void)
+{
+  if (s_raw_state[0] != 0) return;
+  matrix_scan_calibrate_step();
+}
+
+void keyboard_core1_init(void)
+{
+  ghost_init();
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    debounce_init(&s_debounce[word], DEBOUNCE_MODE, DEBOUNCE_TIME_US / DEBOUNCE_PERIOD_US);
+  }
+#if SPLIT_LINK
+  split_link_init(&s_link, split_port(), SPLIT_ROLE_CONTROLLER, time_us_32());
+#endif
+}
+
+#if SPLIT_PERIPHERAL
+//--------------------------------------------------------------------+
+// Left half: scan and send
+//--------------------------------------------------------------------+
+
+// Time of the last scan, for placing the next one (split_link_align())
+static uint32_t s_split_scan_us = 0;
+
+void keyboard_split_init(void)
+{
+  split_link_init(&s_link, split_port(), SPLIT_ROLE_PERIPHERAL, time_us_32());
+}
+
+void split_scan_task(void)
+{
+  uint32_t start_us = time_us_32();
+  uint64_t sample;
+  matrix_scan_read(&sample);
+  uint32_t now_us = time_us_32();
+  s_split_scan_us = now_us - start_us;
+
+  // Raw: the right half debounces it along with its own keys
+  split_link_send(&s_link, sample, now_us);
+}
+
+void keyboard_split_poll(sched_stage_t* scan)
+{
+  split_link_poll(&s_link, time_us_32());
+  split_link_align(&s_link, scan, s_split_scan_us);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// USB HID (core0)
+//--------------------------------------------------------------------+
+
+// Protocol selected by the host on the boot keyboard interface
+// HID_PROTOCOL_BOOT: keyboard reports go to HID_INSTANCE_KEYBOARD
+// HID_PROTOCOL_REPORT: keyboard reports go to HID_INSTANCE_NKRO
+static uint8_t s_hid_protocol = HID_PROTOCOL_REPORT;
+
+// Keyboard reports (both keyboard interfaces, in order), aux reports and raw HID replies
+static report_queue_t s_keyboard_queue;
+static report_queue_t s_aux_queue;
+static report_queue_t s_raw_queue;
+
+// @brief Build the 8-byte boot keyboard report (6KRO) from the held actions and macro keys
+static void build_boot_report(hid_keyboard_report_t* report)
+{
+  uint8_t key_count = 0;
+
+  memset(report, 0, sizeof(*report));
+  report->modifier = action_modifiers() | macro_modifiers();
+
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    uint64_t keys = action_keycode_keys(word);
+    uint key;
+    while (key_count < 6 && key_iter_next(&keys, &key)) {
+      report->keycode[key_count++] = action_held(64 * word + key).code;
+    }
+  }
+
+  uint8_t const* macro_kc;
+  uint macro_count = macro_keys(&macro_kc);
+  for (uint i = 0; i < macro_count && key_count < 6; ++i) {
+    report->keycode[key_count++] = macro_kc[i];
+  }
+}
+
+// @brief Build the NKRO bitmap report, visiting only keys holding a keycode, plus macro keys
+static void build_nkro_report(hid_nkro_report_t* report)
+{
+  memset(report, 0, sizeof(*report));
+  report->modifier = action_modifiers() | macro_modifiers();
+
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    uint64_t keys = action_keycode_keys(word);
+    uint key;
+    while (key_iter_next(&keys, &key)) {
+      uint8_t kc = action_held(64 * word + key).code;
+      if (kc < NKRO_KEYCODE_COUNT) {
+        report->bitmap[kc >> 3] |= (uint8_t) (1u << (kc & 7));
+      }
+    }
+  }
+
+  uint8_t const* macro_kc;
+  uint macro_count = macro_keys(&macro_kc);
+  for (uint i = 0; i < macro_count; ++i) {
+    uint8_t kc = macro_kc[i];
+    if (kc < NKRO_KEYCODE_COUNT) {
+      report->bitmap[kc >> 3] |= (uint8_t) (1u << (kc & 7));
+    }
+  }
+}
+
+#if LATENCY_STATS
+// Stamps of the keyboard queue slots and of the report in flight per interface
+static latency_stamp_t s_queue_stamp[REPORT_QUEUE_SIZE];
+static latency_stamp_t s_sent_stamp[HID_INSTANCE_COUNT];
+
+// Event being applied by hid_task(), from_event = false outside the event loop
+static latency_stamp_t s_event_stamp;
+#endif
+
+// Last report handed to the keyboard queue, the host starts from an empty report
+static uint8_t s_last_report[REPORT_QUEUE_DATA_MAX];
+static uint8_t s_last_report_len = 0;
+
+// @brief Queue a keyboard report if it differs from the last queued one
+// Boot protocol: 8-byte report on the boot keyboard interface
+// Report protocol: NKRO bitmap on the NKRO interface
+// @return false if the report queue is full
+static bool queue_keyboard_report(void)
+{
+  union {
+    hid_keyboard_report_t boot;
+    hid_nkro_report_t     nkro;
+  } report;
+  uint8_t instance;
+  uint8_t len;
+
+  if (s_hid_protocol == HID_PROTOCOL_BOOT) {
+    build_boot_report(&report.boot);
+    instance = HID_INSTANCE_KEYBOARD;
+    len = sizeof(report.boot);
+  } else {
+    build_nkro_report(&report.nkro);
+    instance = HID_INSTANCE_NKRO;
+    len = sizeof(report.nkro);
+  }
+
+  if (len == s_last_report_len && memcmp(&report, s_last_report, len) == 0) return true;
+
+#if LATENCY_STATS
+  uint32_t slot = s_keyboard_queue.head & (REPORT_QUEUE_SIZE - 1);
+#endif
+  if (!report_queue_push(&s_keyboard_queue, instance, 0, &report, len)) {
+    s_stats.reports_dropped++;
+    return false;
+  }
+#if LATENCY_STATS
+  s_queue_stamp[slot] = s_event_stamp;
+  s_queue_stamp[slot].build_us = time_us_32();
+  if (s_event_stamp.from_event) {
+    latency_record(LATENCY_HANDOFF, s_event_stamp.commit_us, s_queue_stamp[slot].build_us);
+  }
+#endif
+  memcpy(s_last_report, &report, len);
+  s_last_report_len = len;
+
+  return true;
+}
+
+// @brief Queue an aux report (consumer / gamepad) only if it changed
+// Mouse reports carry relative motion and go through mouse_send() instead
+// @return false if the report queue is full
+static bool queue_aux_report(uint8_t report_id, void const* data, uint8_t len)
+{
+  // Last queued payload per report ID
+  static uint8_t last[REPORT_ID_COUNT][REPORT_QUEUE_DATA_MAX];
+
+  if (report_id >= REPORT_ID_COUNT || len > REPORT_QUEUE_DATA_MAX) return false;
+  if (memcmp(last[report_id], data, len) == 0) return true;
+
+  if (!report_queue_push(&s_aux_queue, HID_INSTANCE_AUX, report_id, data, len)) return false;
+  memcpy(last[report_id], data, len);
+
+  return true;
+}
+
+// @brief Queue the consumer control report of the held consumer keys, if it changed
+static void queue_consumer_report(void)
+{
+  uint16_t usage = action_consumer_usage();
+  queue_aux_report(REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage));
+}
+
+// @brief Queue a mouse report from mouse_keys_task() (mouse_keys.h)
+static bool mouse_send(hid_mouse_report_t const* report)
+{
+  return report_queue_push(&s_aux_queue, HID_INSTANCE_AUX, REPORT_ID_MOUSE, report, sizeof(*report));
+}
+
+// @brief Step the mouse keys once the last mouse report has gone out
+// Runs from hid_task() only: with the report stage locked just ahead of the
+// poll (sof_sync.h) each step integrates up to the latest moment before it
+static void mouse_task(void)
+{
+  if (tud_suspended() || report_queue_count(&s_aux_queue) != 0 || !tud_hid_n_ready(HID_INSTANCE_AUX)) return;
+
+  mouse_keys_task(time_us_32());
+}
+
+// @brief Send the oldest report of a queue if its endpoint is free
+// The next one follows from tud_hid_report_complete_cb() on the next poll
+static void send_queued_report(report_queue_t* queue)
+{
+  queued_report_t const* entry = report_queue_peek(queue);
+
+  // skip if hid is not ready yet
+  if (entry == NULL || !tud_hid_n_ready(entry->instance)) return;
+
+  if (tud_hid_n_report(entry->instance, entry->report_id, entry->data, entry->len)) {
+    if (entry->instance != HID_INSTANCE_RAW) s_stats.reports++;
+#if LATENCY_STATS
+    if (queue == &s_keyboard_queue) {
+      latency_stamp_t* stamp = &s_sent_stamp[entry->instance];
+      *stamp = s_queue_stamp[queue->tail & (REPORT_QUEUE_SIZE - 1)];
+      stamp->submit_us = time_us_32();
+      latency_record(LATENCY_QUEUE, stamp->build_us, stamp->submit_us);
+    }
+#endif
+    report_queue_pop(queue);
+  }
+}
+
+// @brief Queue a raw HID reply (raw_hid.h)
+static bool raw_hid_send(uint8_t const report[RAW_HID_SIZE])
+{
+  return report_queue_push(&s_raw_queue, HID_INSTANCE_RAW, 0, report, RAW_HID_SIZE);
+}
+
+// @brief Queue the next macro report once the keyboard queue has drained
+// Runs from hid_task() and after every completed keyboard report, so a macro
+// goes out at one report per poll and key events still get queue space
+static void macro_task(void)
+{
+  if (tud_suspended() || report_queue_count(&s_keyboard_queue) != 0) return;
+
+  uint32_t now_us = time_us_32();
+  while (macro_step(now_us)) {
+    // Steps that leave the report unchanged queue nothing, move on
+    queue_keyboard_report();
+    if (report_queue_count(&s_keyboard_queue) != 0) break;
+  }
+}
+
+// Reports one key event can queue: a failed chord and a tap-hold decision replay their buffers
+#define REPORTS_PER_EVENT_MAX  (TAP_HOLD_BUFFER_SIZE + COMBO_KEYS_MAX + 2)
+
+// @brief Apply a resolved key transition and queue its reports
+// Mouse keys are picked up by mouse_task()
+static void key_output(uint key, bool pressed, key_action_t action)
+{
+  if (pressed) {
+    action_press(key, action);
+  } else {
+    action_release(key);
+  }
+
+  // While suspended only the state is kept, hid_task() catches up after resume
+  if (!tud_suspended()) {
+    queue_keyboard_report();
+    queue_consumer_report();
+  }
+}
+
+void keyboard_init(void)
+{
+  keymap_init();
+  action_init();
+  macro_init();
+  tap_hold_init(key_output);
+  combo_init(tap_hold_event);
+  mouse_keys_init(mouse_send);
+  raw_hid_init(raw_hid_send);
+}
+
+// HID task - report stage, run by the core0 scheduler every REPORT_PERIOD_US
+// Apply key events from core1 and queue one report per change of the held actions
+void hid_task(void)
+{
+  key_event_t event;
+
+#if LATENCY_STATS
+  latency_depth(key_event_count(), report_queue_count(&s_keyboard_queue));
+#endif
+
+  // Stop draining when the report queue could overflow, the rest waits in the event ring
+  while (REPORT_QUEUE_SIZE - report_queue_count(&s_keyboard_queue) >= REPORTS_PER_EVENT_MAX &&
+         key_event_pop(&event))
+  {
+    if (event.pressed) {
+      g_key_state[event.key / 64] |= 1ULL << (event.key % 64);
+    } else {
+      g_key_state[event.key / 64] &= ~(1ULL << (event.key % 64));
+    }
+    s_last_event_us = time_us_64();
+    s_stats.key_events++;
+
+#if LATENCY_STATS
+    s_event_stamp = (latency_stamp_t) { .scan_us = event.time_us, .commit_us = event.commit_us, .from_event = true };
+    latency_record(LATENCY_DEBOUNCE, event.time_us, event.commit_us);
+#endif
+
+    // -> combos -> tap-hold -> held actions -> key_output()
+    combo_event(&event);
+  }
+#if LATENCY_STATS
+  s_event_stamp.from_event = false;
+#endif
+
+  // Chords and tap-hold keys held past their term
+  if (REPORT_QUEUE_SIZE - report_queue_count(&s_keyboard_queue) >= REPORTS_PER_EVENT_MAX) {
+    uint32_t now_us = time_us_32();
+    combo_task(now_us);
+    tap_hold_task(now_us);
+  }
+
+  // Catch up with changes applied while suspended (no-op if unchanged)
+  if (!tud_suspended()) {
+    queue_keyboard_report();
+    queue_consumer_report();
+  }
+
+  macro_task();
+  mouse_task();
+
+  // LED on while a layer above the default layer is active (for debugging layer switch)
+  // Change to keys_down(g_key_state) to test any key press
+  board_led_write(layer_top() != layer_default());
+
+  raw_hid_task(time_us_32());
+
+  send_queued_report(&s_keyboard_queue);
+  send_queued_report(&s_aux_queue);
+  send_queued_report(&s_raw_queue);
+}
+
+// Idle task, run by the core0 scheduler every IDLE_PERIOD_US
+// A flash operation parks both cores for up to one sector erase, so it only
+// runs when no key is held, nothing is left to send and no key has changed
+// for STORE_IDLE_US. A key pressed meanwhile is seen once the operation ends.
+void idle_task(void)
+{
+  if (!store_busy()) return;
+
+  if (keys_down(g_key_state) || macro_busy() || report_queue_count(&s_keyboard_queue) != 0) return;
+  if (time_us_64() - s_last_event_us < STORE_IDLE_US) return;
+
+  store_task();
+}
+
+// Invoked when sent REPORT successfully to host
+// Application can use this to send the next report
+// Each interface has its own endpoint, so only that interface's queue moves on
+// A playing macro queues its next report here once the keyboard queue is empty
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
+{
+  (void) report;
+  (void) len;
+
+  if (instance == HID_INSTANCE_AUX) {
+    send_queued_report(&s_aux_queue);
+  } else if (instance == HID_INSTANCE_RAW) {
+    send_queued_report(&s_raw_queue);
+  } else {
+    sof_sync_poll();
+#if LATENCY_STATS
+    latency_stamp_t const* stamp = &s_sent_stamp[instance];
+    uint32_t now_us = time_us_32();
+    latency_record(LATENCY_USB, stamp->submit_us, now_us);
+    if (stamp->from_event) latency_record(LATENCY_END_TO_END, stamp->scan_us, now_us);
+#endif
+    macro_task();
+    send_queued_report(&s_keyboard_queue);
+  }
+}
+
+// Invoked when received SET_PROTOCOL request
+// protocol is either HID_PROTOCOL_BOOT (0) or HID_PROTOCOL_REPORT (1)
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+  // Only the boot keyboard interface supports the boot protocol
+  if (instance != HID_INSTANCE_KEYBOARD || protocol == s_hid_protocol) return;
+
+  // Queued reports are for the other interface: drop them, release every
+  // key there, and resend the current state on the new one
+  report_queue_clear(&s_keyboard_queue);
+  if (s_last_report_len != 0) {
+    static uint8_t const empty[REPORT_QUEUE_DATA_MAX] = { 0 };
+#if LATENCY_STATS
+    s_queue_stamp[s_keyboard_queue.head & (REPORT_QUEUE_SIZE - 1)] = (latency_stamp_t) { .build_us = time_us_32() };
+#endif
+    report_queue_push(&s_keyboard_queue,
+                      (s_hid_protocol == HID_PROTOCOL_BOOT) ? HID_INSTANCE_KEYBOARD : HID_INSTANCE_NKRO,
+                      0, empty, s_last_report_len);
+  }
+
+  s_hid_protocol = protocol;
+  s_last_report_len = 0;
+}
+
+// Invoked when received GET_REPORT control request
+// Application must fill buffer report's content and return its length.
+// Return zero will cause the stack to STALL request
+// Only the raw interface answers, with its last reply
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
+{
+  (void) report_id;
+  (void) report_type;
+
+  if (instance != HID_INSTANCE_RAW) return 0;
+
+  uint16_t len = (reqlen < RAW_HID_SIZE) ? reqlen : RAW_HID_SIZE;
+  memcpy(buffer, raw_hid_last_reply(), len);
+  return len;
+}
+
+// Invoked when received SET_REPORT control request or
+// received data on OUT endpoint ( Report ID = 0, Type = 0 )
+// Raw interface: one configuration request (raw_hid.h)
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
+{
+  (void) report_id;
+  (void) report_type;
+
+  if (instance == HID_INSTANCE_RAW) {
+    raw_hid_receive(buffer, bufsize);
+  }
+}
+
@@ -0,0 +1,110 @@
+// Keyboard pipeline
+// core1: scan_task() -> debounce_task() -> key events (key_event.h),
+//        calibrate_task() re-measures the matrix settle times while idle
+// core0: hid_task() -> key state -> HID reports (report_queue.h)
+// The stage functions are run by the per-core scheduler tables in main.c.
+// With SPLIT_LINK the scan stage also merges the other half's sample
+// (split_link.h) as key state word 1, debounced with the local matrix; the
+// left half's build (SPLIT_PERIPHERAL) only runs split_scan_task().
+
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+#include "scheduler.h"
+#include "split_link.h"
+
+// Stage periods (us), see scheduler.h
+// core1: matrix scan and debounce
+// core0: HID report, drains events several times per 1ms USB frame so a
+//        change is queued before the next poll
+#ifndef SCAN_PERIOD_US
+#define SCAN_PERIOD_US      250
+#endif
+#ifndef DEBOUNCE_PERIOD_US
+#define DEBOUNCE_PERIOD_US  250
+#endif
+// core1: slower scan and debounce after SCAN_SLOW_AFTER_US without a key down (power.h)
+#ifndef SCAN_SLOW_PERIOD_US
+#define SCAN_SLOW_PERIOD_US 1000
+#endif
+#ifndef SCAN_SLOW_AFTER_US
+#define SCAN_SLOW_AFTER_US  5000000
+#endif
+// core1: settle re-calibration, one matrix line per run while no key is down
+#ifndef CALIBRATE_PERIOD_US
+#define CALIBRATE_PERIOD_US 100000
+#endif
+#ifndef REPORT_PERIOD_US
+#define REPORT_PERIOD_US    250
+#endif
+// core0: deferred work (flash writes), only after STORE_IDLE_US without a key
+#ifndef IDLE_PERIOD_US
+#define IDLE_PERIOD_US      10000
+#endif
+#ifndef STORE_IDLE_US
+#define STORE_IDLE_US       1000000
+#endif
+
+// Debounce: eager (press reported within one scan) with a 5ms lock-out
+#ifndef DEBOUNCE_MODE
+#define DEBOUNCE_MODE     DEBOUNCE_EAGER
+#endif
+#ifndef DEBOUNCE_TIME_US
+#define DEBOUNCE_TIME_US  5000
+#endif
+
+typedef struct
+{
+  uint32_t key_events;       // debounced transitions applied
+  uint32_t reports;          // keyboard and aux reports sent
+  uint32_t reports_dropped;  // keyboard reports lost to a full queue
+} keyboard_stats_t;
+
+// @brief Reset the core0 side (layers, held actions), call before hid_task() runs
+void keyboard_init(void);
+
+// @brief Reset the core1 side (debounce state), call on core1 before its stages run
+void keyboard_core1_init(void);
+
+// @brief Scan stage (core1)
+void scan_task(void);
+
+// @brief Debounce stage (core1)
+void debounce_task(void);
+
+// @brief Settle re-calibration stage (core1), see matrix_scan_calibrate_step()
+void calibrate_task(void);
+
+// @brief Report stage (core0), apply key events and queue HID reports
+void hid_task(void);
+
+// @brief Idle stage (core0), deferred flash writes (store.h) while no key is in use
+void idle_task(void);
+
+// @brief Key state as seen by core0, one word of it (KEY_WORDS)
+uint64_t keyboard_state(uint word);
+
+keyboard_stats_t const* keyboard_stats(void);
+
+// @brief HID keycode of a key on a layer, 0 if none
+// @param key key state bit position (row * NUM_COLS + col)
+uint8_t keyboard_keycode(uint8_t layer, uint key);
+
+#if SPLIT_LINK
+// @brief Right half: the link to the other half (core1 owns it, read-only elsewhere)
+split_link_t const* keyboard_split_link(void);
+
+// @brief Left half: reset the link, call before split_scan_task() runs
+void keyboard_split_init(void);
+
+// @brief Left half: scan stage, sample the matrix and send it to the right half
+void split_scan_task(void);
+
+// @brief Left half: main loop hook, take the right half's SYNCs and move the
+// scan stage to its slot (split_link_align())
+void keyboard_split_poll(sched_stage_t* scan);
+#endif
+
+#endif /* KEYBOARD_H_ */
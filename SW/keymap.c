@@ -0,0 +1,463 @@
+// Runtime keymap, see keymap.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "key_iter.h"
+#include "layer.h"
+#include "tap_hold.h"
+#include "combo.h"
+#include "mouse_keys.h"
+#include "store.h"
+#include "keymap.h"
+#include "keymap_table.h"   // generated from keymap.json, see tools/keymap_gen.py
+
+#define KEYMAP_TAP_HOLD_SLOTS  (KEYMAP_TAP_HOLD_COUNT + KEYMAP_TAP_HOLD_SPARE)
+#define KEYMAP_COMBO_SLOTS     (KEYMAP_COMBO_COUNT + KEYMAP_COMBO_SPARE)
+
+// Record types in the flash store
+enum
+{
+  KEYMAP_RECORD_RESET = 1,    // back to the generated keymap
+  KEYMAP_RECORD_ACTION,       // id = layer << 8 | key, key_action_t
+  KEYMAP_RECORD_LAYER,        // id = layer, key_action_t[KEYMAP_KEYS]
+  KEYMAP_RECORD_TAP_HOLD,     // id = index, key_tap_hold_t
+  KEYMAP_RECORD_COMBO,        // id = index, key mask (8, little endian) + key_action_t
+  KEYMAP_RECORD_SETTING,      // id = keymap_setting_t, uint32_t (little endian)
+};
+
+static key_action_t   s_actions[KEYMAP_NUM_LAYERS][KEYMAP_KEYS];
+static uint64_t       s_transparent[KEYMAP_NUM_LAYERS][KEY_WORDS];
+static key_tap_hold_t s_tap_hold[KEYMAP_TAP_HOLD_SLOTS];
+static uint32_t       s_settings[KEYMAP_SETTING_COUNT];
+
+// Combo slots, and their index by lowest member key (rebuilt on change):
+// s_combos[s_combo_order[s_combo_first[k] .. s_combo_first[k + 1] - 1]] have k as lowest key
+// Combos are made of this half's keys only
+static key_combo_t s_combos[KEYMAP_COMBO_SLOTS];
+static uint16_t    s_combo_order[KEYMAP_COMBO_SLOTS];
+static uint16_t    s_combo_first[KEYMAP_MATRIX_KEYS + 1];
+static uint64_t    s_combo_partners[KEYMAP_MATRIX_KEYS];
+static uint64_t    s_combo_keys;
+
+//--------------------------------------------------------------------+
+// Tables
+//--------------------------------------------------------------------+
+
+// @brief Index the combos by lowest member key (counting sort over the keys)
+static void keymap_combo_index(void)
+{
+  uint16_t count[KEYMAP_MATRIX_KEYS + 1];
+
+  memset(count, 0, sizeof(count));
+  memset(s_combo_partners, 0, sizeof(s_combo_partners));
+  s_combo_keys = 0;
+
+  for (uint i = 0; i < KEYMAP_COMBO_SLOTS; ++i)
+  {
+    uint64_t keys = s_combos[i].keys;
+    if (keys == 0 || (keys >> KEYMAP_MATRIX_KEYS)) continue;
+
+    count[__builtin_ctzll(keys) + 1]++;
+    s_combo_keys |= keys;
+
+    uint64_t members = keys;
+    uint key;
+    while (key_iter_next(&members, &key)) {
+      s_combo_partners[key] |= keys;
+    }
+  }
+
+  s_combo_first[0] = 0;
+  for (uint key = 0; key < KEYMAP_MATRIX_KEYS; ++key) {
+    s_combo_first[key + 1] = (uint16_t) (s_combo_first[key] + count[key + 1]);
+  }
+
+  uint16_t next[KEYMAP_MATRIX_KEYS];
+  memcpy(next, s_combo_first, sizeof(next));
+  for (uint i = 0; i < KEYMAP_COMBO_SLOTS; ++i) {
+    uint64_t keys = s_combos[i].keys;
+    if (keys && !(keys >> KEYMAP_MATRIX_KEYS)) s_combo_order[next[__builtin_ctzll(keys)]++] = (uint16_t) i;
+  }
+}
+
+static void keymap_update_transparent(uint8_t layer, uint key)
+{
+  uint64_t bit = 1ULL << (key % 64);
+
+  if (s_actions[layer][key].type == KEY_ACTION_TRANSPARENT) {
+    s_transparent[layer][key / 64] |= bit;
+  } else {
+    s_transparent[layer][key / 64] &= ~bit;
+  }
+}
+
+// @brief A matrix key of either half
+static bool keymap_key_valid(uint key)
+{
+  return key < KEYMAP_MATRIX_KEYS || (key >= SPLIT_KEY_FIRST && key < KEYMAP_KEYS);
+}
+
+static void keymap_defaults(void)
+{
+  memcpy(s_actions, keymap_actions, sizeof(s_actions));
+  memcpy(s_transparent, keymap_transparent_mask, sizeof(s_transparent));
+
+  memset(s_tap_hold, 0, sizeof(s_tap_hold));
+  memcpy(s_tap_hold, keymap_tap_hold, KEYMAP_TAP_HOLD_COUNT * sizeof(key_tap_hold_t));
+
+  memset(s_combos, 0, sizeof(s_combos));
+  memcpy(s_combos, keymap_combos, KEYMAP_COMBO_COUNT * sizeof(key_combo_t));
+
+  s_settings[KEYMAP_SETTING_DEFAULT_LAYER]   = 0;
+  s_settings[KEYMAP_SETTING_TAP_HOLD_TERM_US] = TAP_HOLD_TERM_US;
+  s_settings[KEYMAP_SETTING_COMBO_TERM_US]   = COMBO_TERM_US;
+  s_settings[KEYMAP_SETTING_MOUSE_SPEED_MIN] = MOUSE_KEYS_SPEED_MIN;
+  s_settings[KEYMAP_SETTING_MOUSE_SPEED_MAX] = MOUSE_KEYS_SPEED_MAX;
+  s_settings[KEYMAP_SETTING_MOUSE_ACCEL_US]  = MOUSE_KEYS_ACCEL_US;
+  s_settings[KEYMAP_SETTING_MOUSE_CURVE]     = MOUSE_KEYS_CURVE;
+  s_settings[KEYMAP_SETTING_MOUSE_WHEEL_SPEED] = MOUSE_KEYS_WHEEL_SPEED;
+}
+
+// @brief The action only refers to layers, tap-hold slots and macros that exist
+static bool keymap_action_valid(key_action_t action)
+{
+  switch (action.type)
+  {
+    case KEY_ACTION_TRANSPARENT:
+    case KEY_ACTION_NONE:
+    case KEY_ACTION_KEY:
+      return true;
+
+    case KEY_ACTION_MODIFIER:
+      return action.code >= HID_KEY_CONTROL_LEFT && action.code <= HID_KEY_GUI_RIGHT;
+
+    case KEY_ACTION_LAYER_MOMENTARY:
+    case KEY_ACTION_LAYER_TOGGLE:
+    case KEY_ACTION_LAYER_ONESHOT:
+    case KEY_ACTION_LAYER_DEFAULT:
+      return action.code < KEYMAP_NUM_LAYERS;
+
+    case KEY_ACTION_TAP_HOLD:
+      return action.code < KEYMAP_TAP_HOLD_SLOTS;
+
+    case KEY_ACTION_MACRO:
+      return action.code < keymap_macro_count();
+
+    case KEY_ACTION_MOUSE:
+      return action.code < MOUSE_KEY_COUNT;
+
+    case KEY_ACTION_CONSUMER:
+      return action.code < CONSUMER_KEY_COUNT;
+
+    default:
+      return false;
+  }
+}
+
+static bool keymap_combo_valid(key_combo_t combo)
+{
+  if (combo.keys == 0) return true;   // unused slot
+
+  uint members = (uint) __builtin_popcountll(combo.keys);
+  if (members < 2 || members > COMBO_KEYS_MAX) return false;
+  if (combo.keys >> KEYMAP_MATRIX_KEYS) return false;
+  if (combo.action.type == KEY_ACTION_TRANSPARENT || combo.action.type == KEY_ACTION_TAP_HOLD) return false;
+  return keymap_action_valid(combo.action);
+}
+
+//--------------------------------------------------------------------+
+// Store records
+//--------------------------------------------------------------------+
+
+// Changes are applied without saving while the store replays them
+static bool apply_action(uint8_t layer, uint key, key_action_t action)
+{
+  if (layer >= KEYMAP_NUM_LAYERS || !keymap_key_valid(key) || !keymap_action_valid(action)) return false;
+
+  s_actions[layer][key] = action;
+  keymap_update_transparent(layer, key);
+  return true;
+}
+
+static bool apply_tap_hold(uint index, key_tap_hold_t entry)
+{
+  if (index >= KEYMAP_TAP_HOLD_SLOTS) return false;
+  if (entry.tap.type == KEY_ACTION_TAP_HOLD || entry.hold.type == KEY_ACTION_TAP_HOLD) return false;
+  if (!keymap_action_valid(entry.tap) || !keymap_action_valid(entry.hold)) return false;
+
+  s_tap_hold[index] = entry;
+  return true;
+}
+
+static bool apply_combo(uint index, key_combo_t combo)
+{
+  if (index >= KEYMAP_COMBO_SLOTS || !keymap_combo_valid(combo)) return false;
+
+  s_combos[index] = combo;
+  keymap_combo_index();
+  return true;
+}
+
+static bool apply_setting(uint id, uint32_t value)
+{
+  if (id >= KEYMAP_SETTING_COUNT) return false;
+  if (id == KEYMAP_SETTING_DEFAULT_LAYER && value >= KEYMAP_NUM_LAYERS) return false;
+  if (id == KEYMAP_SETTING_TAP_HOLD_TERM_US && value > TAP_HOLD_TERM_LIMIT_US) return false;
+  if (id == KEYMAP_SETTING_COMBO_TERM_US && value > COMBO_TERM_LIMIT_US) return false;
+  if ((id == KEYMAP_SETTING_MOUSE_SPEED_MIN || id == KEYMAP_SETTING_MOUSE_SPEED_MAX ||
+       id == KEYMAP_SETTING_MOUSE_WHEEL_SPEED) && value > MOUSE_KEYS_SPEED_LIMIT) return false;
+  if (id == KEYMAP_SETTING_MOUSE_CURVE && (value < 1 || value > MOUSE_KEYS_CURVE_MAX)) return false;
+
+  s_settings[id] = value;
+  return true;
+}
+
+static void keymap_replay(uint8_t type, uint16_t id, uint8_t const* data, uint8_t len)
+{
+  switch (type)
+  {
+    case KEYMAP_RECORD_RESET:
+      keymap_defaults();
+      break;
+
+    case KEYMAP_RECORD_ACTION:
+      if (len == sizeof(key_action_t)) {
+        apply_action((uint8_t) (id >> 8), id & 0xff, (key_action_t) { data[0], data[1] });
+      }
+      break;
+
+    case KEYMAP_RECORD_LAYER:
+      if (len == KEYMAP_KEYS * sizeof(key_action_t)) {
+        for (uint key = 0; key < KEYMAP_KEYS; ++key) {
+          apply_action((uint8_t) id, key, (key_action_t) { data[2 * key], data[2 * key + 1] });
+        }
+      }
+      break;
+
+    case KEYMAP_RECORD_TAP_HOLD:
+      if (len == sizeof(key_tap_hold_t)) {
+        apply_tap_hold(id, (key_tap_hold_t) { { data[0], data[1] }, { data[2], data[3] } });
+      }
+      break;
+
+    case KEYMAP_RECORD_COMBO:
+      if (len == 10) {
+        uint64_t keys = 0;
+        for (uint i = 0; i < 8; ++i) keys |= (uint64_t) data[i] << (8 * i);
+        apply_combo(id, (key_combo_t) { keys, { data[8], data[9] } });
+      }
+      break;
+
+    case KEYMAP_RECORD_SETTING:
+      if (len == 4) {
+        apply_setting(id, (uint32_t) (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24)));
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void encode_combo(uint8_t* data, key_combo_t const* combo)
+{
+  for (uint i = 0; i < 8; ++i) data[i] = (uint8_t) (combo->keys >> (8 * i));
+  data[8] = combo->action.type;
+  data[9] = combo->action.code;
+}
+
+static void encode_u32(uint8_t* data, uint32_t value)
+{
+  for (uint i = 0; i < 4; ++i) data[i] = (uint8_t) (value >> (8 * i));
+}
+
+// @brief Everything that differs from the generated keymap, whole layers at a time
+static void keymap_snapshot(void)
+{
+  uint8_t data[KEYMAP_KEYS * sizeof(key_action_t)];
+
+  for (uint layer = 0; layer < KEYMAP_NUM_LAYERS; ++layer) {
+    if (memcmp(s_actions[layer], keymap_actions[layer], sizeof(s_actions[layer])) != 0) {
+      memcpy(data, s_actions[layer], sizeof(s_actions[layer]));
+      store_snapshot_record(KEYMAP_RECORD_LAYER, (uint16_t) layer, data, sizeof(s_actions[layer]));
+    }
+  }
+
+  for (uint i = 0; i < KEYMAP_TAP_HOLD_SLOTS; ++i) {
+    key_tap_hold_t const* generated = (i < KEYMAP_TAP_HOLD_COUNT) ? &keymap_tap_hold[i] : NULL;
+    key_tap_hold_t unused = { { 0, 0 }, { 0, 0 } };
+    if (memcmp(&s_tap_hold[i], generated ? generated : &unused, sizeof(key_tap_hold_t)) != 0) {
+      store_snapshot_record(KEYMAP_RECORD_TAP_HOLD, (uint16_t) i, &s_tap_hold[i], sizeof(key_tap_hold_t));
+    }
+  }
+
+  uint const generated_combos = KEYMAP_COMBO_COUNT;   // may be 0
+  for (uint i = 0; i < KEYMAP_COMBO_SLOTS; ++i) {
+    key_combo_t generated = (i < generated_combos) ? keymap_combos[i] : (key_combo_t) { 0, { 0, 0 } };
+    if (s_combos[i].keys != generated.keys || s_combos[i].action.type != generated.action.type ||
+        s_combos[i].action.code != generated.action.code) {
+      encode_combo(data, &s_combos[i]);
+      store_snapshot_record(KEYMAP_RECORD_COMBO, (uint16_t) i, data, 10);
+    }
+  }
+
+  uint32_t defaults[KEYMAP_SETTING_COUNT] = {
+    [KEYMAP_SETTING_DEFAULT_LAYER]   = 0,
+    [KEYMAP_SETTING_TAP_HOLD_TERM_US] = TAP_HOLD_TERM_US,
+    [KEYMAP_SETTING_COMBO_TERM_US]   = COMBO_TERM_US,
+    [KEYMAP_SETTING_MOUSE_SPEED_MIN] = MOUSE_KEYS_SPEED_MIN,
+    [KEYMAP_SETTING_MOUSE_SPEED_MAX] = MOUSE_KEYS_SPEED_MAX,
+    [KEYMAP_SETTING_MOUSE_ACCEL_US]  = MOUSE_KEYS_ACCEL_US,
+    [KEYMAP_SETTING_MOUSE_CURVE]     = MOUSE_KEYS_CURVE,
+    [KEYMAP_SETTING_MOUSE_WHEEL_SPEED] = MOUSE_KEYS_WHEEL_SPEED,
+  };
+  for (uint id = 0; id < KEYMAP_SETTING_COUNT; ++id) {
+    if (s_settings[id] != defaults[id]) {
+      encode_u32(data, s_settings[id]);
+      store_snapshot_record(KEYMAP_RECORD_SETTING, (uint16_t) id, data, 4);
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void keymap_init(void)
+{
+  keymap_defaults();
+  store_init(KEYMAP_SIGNATURE, keymap_replay, keymap_snapshot);
+  keymap_combo_index();
+}
+
+void keymap_reset(void)
+{
+  keymap_defaults();
+  keymap_combo_index();
+  layer_refresh();
+
+  // A fresh snapshot drops the old records, the reset record covers a failed one
+  store_append(KEYMAP_RECORD_RESET, 0, NULL, 0);
+  store_compact();
+}
+
+uint8_t keymap_num_layers(void)
+{
+  return KEYMAP_NUM_LAYERS;
+}
+
+uint keymap_tap_hold_slots(void)
+{
+  return KEYMAP_TAP_HOLD_SLOTS;
+}
+
+uint keymap_combo_slots(void)
+{
+  return KEYMAP_COMBO_SLOTS;
+}
+
+uint keymap_macro_count(void)
+{
+  return KEYMAP_MACRO_COUNT;
+}
+
+uint32_t keymap_signature(void)
+{
+  return KEYMAP_SIGNATURE;
+}
+
+key_action_t keymap_action(uint8_t layer, uint key)
+{
+  if (layer >= KEYMAP_NUM_LAYERS || key >= KEYMAP_KEYS) return (key_action_t) { KEY_ACTION_NONE, 0 };
+  return s_actions[layer][key];
+}
+
+uint64_t keymap_transparent(uint8_t layer, uint word)
+{
+  return s_transparent[layer][word];
+}
+
+key_tap_hold_t const* keymap_tap_hold_entry(uint index)
+{
+  return (index < KEYMAP_TAP_HOLD_SLOTS) ? &s_tap_hold[index] : NULL;
+}
+
+key_combo_t const* keymap_combo(uint index)
+{
+  return (index < KEYMAP_COMBO_SLOTS) ? &s_combos[index] : NULL;
+}
+
+key_combo_t const* keymap_combo_match(uint64_t keys)
+{
+  if (keys == 0) return NULL;
+
+  uint lowest = (uint) __builtin_ctzll(keys);
+  if (lowest >= KEYMAP_MATRIX_KEYS) return NULL;
+
+  for (uint i = s_combo_first[lowest]; i < s_combo_first[lowest + 1]; ++i) {
+    key_combo_t const* combo = &s_combos[s_combo_order[i]];
+    if (combo->keys == keys) return combo;
+  }
+  return NULL;
+}
+
+uint64_t keymap_combo_partners(uint key)
+{
+  return (key < KEYMAP_MATRIX_KEYS) ? s_combo_partners[key] : 0;
+}
+
+uint64_t keymap_combo_keys(void)
+{
+  return s_combo_keys;
+}
+
+uint32_t keymap_setting(keymap_setting_t setting)
+{
+  return (setting < KEYMAP_SETTING_COUNT) ? s_settings[setting] : 0;
+}
+
+bool keymap_set_action(uint8_t layer, uint key, key_action_t action)
+{
+  if (!apply_action(layer, key, action)) return false;
+  layer_refresh();
+
+  store_append(KEYMAP_RECORD_ACTION, (uint16_t) (layer << 8 | key), &action, sizeof(action));
+  return true;
+}
+
+bool keymap_set_tap_hold(uint index, key_tap_hold_t entry)
+{
+  if (!apply_tap_hold(index, entry)) return false;
+
+  store_append(KEYMAP_RECORD_TAP_HOLD, (uint16_t) index, &entry, sizeof(entry));
+  return true;
+}
+
+bool keymap_set_combo(uint index, key_combo_t combo)
+{
+  if (index >= KEYMAP_COMBO_SLOTS) return false;
+
+  // Only new changes are refused for a duplicate: a snapshot may write a slot
+  // before clearing the one it duplicated in the generated keymap
+  key_combo_t const* same = keymap_combo_match(combo.keys);
+  if (same != NULL && same != &s_combos[index]) return false;
+  if (!apply_combo(index, combo)) return false;
+
+  uint8_t data[10];
+  encode_combo(data, &combo);
+  store_append(KEYMAP_RECORD_COMBO, (uint16_t) index, data, sizeof(data));
+  return true;
+}
+
+bool keymap_set_setting(keymap_setting_t setting, uint32_t value)
+{
+  if (!apply_setting(setting, value)) return false;
+
+  uint8_t data[4];
+  encode_u32(data, value);
+  store_append(KEYMAP_RECORD_SETTING, (uint16_t) setting, data, sizeof(data));
+  return true;
+}
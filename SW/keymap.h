@@ -0,0 +1,178 @@
+// Keymap action types and runtime keymap (core0)
+// The defaults are generated at build time into keymap_table.h by
+// tools/keymap_gen.py from keymap.json and the KLE layout in HW/.
+// keymap_init() copies them to RAM and replays the changes saved in flash
+// (store.h) on top; keymap_set_*() change the RAM tables and save the change.
+
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "matrix_scan.h"
+#include "split_link.h"
+
+// Keymap entries, indexed by key: this half's matrix, and with SPLIT_LINK the
+// other half's from SPLIT_KEY_FIRST (the virtual keys in between have none)
+#define KEYMAP_MATRIX_KEYS  (NUM_ROWS * NUM_COLS)
+#if SPLIT_LINK
+#define KEYMAP_KEYS         (SPLIT_KEY_FIRST + KEYMAP_MATRIX_KEYS)
+#else
+#define KEYMAP_KEYS         KEYMAP_MATRIX_KEYS
+#endif
+
+typedef enum
+{
+  KEY_ACTION_TRANSPARENT = 0,   // use the next active layer below (keys not listed on a layer)
+  KEY_ACTION_NONE,              // nothing, and hides the layers below
+  KEY_ACTION_KEY,               // code = HID keycode
+  KEY_ACTION_MODIFIER,          // code = HID_KEY_CONTROL_LEFT .. HID_KEY_GUI_RIGHT
+  KEY_ACTION_LAYER_MOMENTARY,   // code = layer, active while held               MO(n)
+  KEY_ACTION_LAYER_TOGGLE,      // code = layer, switched on / off on press       TG(n)
+  KEY_ACTION_LAYER_ONESHOT,     // code = layer, active for the next key press    OSL(n)
+  KEY_ACTION_LAYER_DEFAULT,     // code = layer, becomes the default layer        DF(n)
+  KEY_ACTION_TAP_HOLD,          // code = index into keymap_tap_hold[], see tap_hold.h
+  KEY_ACTION_MACRO,             // code = macro index, played on press (see macro.h)   M(name)
+  KEY_ACTION_MOUSE,             // code = mouse_key_t, see mouse_keys.h                 MS_UP, MS_BTN1, ...
+  KEY_ACTION_CONSUMER,          // code = consumer_key_t, a consumer control usage      VOLUME_UP, ...
+} key_action_type_t;
+
+typedef struct
+{
+  uint8_t type;          // key_action_type_t
+  uint8_t code;
+} key_action_t;
+
+// Dual-role key: tap action if released quickly, hold action otherwise
+typedef struct
+{
+  key_action_t tap;
+  key_action_t hold;
+} key_tap_hold_t;
+
+// Combo: its member keys pressed together send action instead (see combo.h)
+typedef struct
+{
+  uint64_t keys;         // member key mask, 2 to 4 bits of this half's matrix
+  key_action_t action;
+} key_combo_t;
+
+// Macro bytecode ops (keymap_macro_bytecode[]), each followed by one operand byte
+// except MACRO_OP_END
+typedef enum
+{
+  MACRO_OP_END = 0,
+  MACRO_OP_TAP,          // keycode: press, then release in the next report
+  MACRO_OP_SHIFT_TAP,    // keycode: same with left shift
+  MACRO_OP_DOWN,         // keycode (modifiers too): press
+  MACRO_OP_UP,           // keycode: release
+  MACRO_OP_DELAY,        // ms, 1 to 255
+} macro_op_t;
+
+// Codes of KEY_ACTION_MOUSE
+typedef enum
+{
+  MOUSE_KEY_UP = 0,
+  MOUSE_KEY_DOWN,
+  MOUSE_KEY_LEFT,
+  MOUSE_KEY_RIGHT,
+  MOUSE_KEY_WHEEL_UP,
+  MOUSE_KEY_WHEEL_DOWN,
+  MOUSE_KEY_WHEEL_LEFT,
+  MOUSE_KEY_WHEEL_RIGHT,
+  MOUSE_KEY_BUTTON1,     // left
+  MOUSE_KEY_BUTTON2,     // right
+  MOUSE_KEY_BUTTON3,     // middle
+  MOUSE_KEY_BUTTON4,     // back
+  MOUSE_KEY_BUTTON5,     // forward
+  MOUSE_KEY_COUNT
+} mouse_key_t;
+
+// Codes of KEY_ACTION_CONSUMER, the 16-bit usages are looked up in action.c
+typedef enum
+{
+  CONSUMER_KEY_MUTE = 0,
+  CONSUMER_KEY_VOLUME_UP,
+  CONSUMER_KEY_VOLUME_DOWN,
+  CONSUMER_KEY_PLAY_PAUSE,
+  CONSUMER_KEY_STOP,
+  CONSUMER_KEY_NEXT_TRACK,
+  CONSUMER_KEY_PREV_TRACK,
+  CONSUMER_KEY_BRIGHTNESS_UP,
+  CONSUMER_KEY_BRIGHTNESS_DOWN,
+  CONSUMER_KEY_MAIL,
+  CONSUMER_KEY_CALCULATOR,
+  CONSUMER_KEY_MY_COMPUTER,
+  CONSUMER_KEY_WWW_SEARCH,
+  CONSUMER_KEY_WWW_HOME,
+  CONSUMER_KEY_WWW_BACK,
+  CONSUMER_KEY_WWW_FORWARD,
+  CONSUMER_KEY_WWW_REFRESH,
+  CONSUMER_KEY_COUNT
+} consumer_key_t;
+
+// Runtime settings, saved with the keymap
+typedef enum
+{
+  KEYMAP_SETTING_DEFAULT_LAYER = 0,   // layer active at boot
+  KEYMAP_SETTING_TAP_HOLD_TERM_US,    // default TAP_HOLD_TERM_US, at most TAP_HOLD_TERM_LIMIT_US
+  KEYMAP_SETTING_COMBO_TERM_US,       // default COMBO_TERM_US, at most COMBO_TERM_LIMIT_US
+  KEYMAP_SETTING_MOUSE_SPEED_MIN,     // px/s, default MOUSE_KEYS_SPEED_MIN
+  KEYMAP_SETTING_MOUSE_SPEED_MAX,     // px/s, default MOUSE_KEYS_SPEED_MAX
+  KEYMAP_SETTING_MOUSE_ACCEL_US,      // default MOUSE_KEYS_ACCEL_US
+  KEYMAP_SETTING_MOUSE_CURVE,         // default MOUSE_KEYS_CURVE
+  KEYMAP_SETTING_MOUSE_WHEEL_SPEED,   // detents/s, default MOUSE_KEYS_WHEEL_SPEED
+  KEYMAP_SETTING_COUNT
+} keymap_setting_t;
+
+// Slots beyond the generated entries, for tap-hold keys and combos added at runtime
+#define KEYMAP_TAP_HOLD_SPARE  8
+#define KEYMAP_COMBO_SPARE     16
+
+// @brief Load the generated keymap and replay the saved changes (a few ms at most)
+void keymap_init(void);
+
+// @brief Back to the generated keymap, saved as well
+void keymap_reset(void);
+
+uint8_t keymap_num_layers(void);
+uint    keymap_tap_hold_slots(void);
+uint    keymap_combo_slots(void);
+uint    keymap_macro_count(void);
+
+// @brief Checksum of the generated defaults (tools/keymap_gen.py)
+uint32_t keymap_signature(void);
+
+// @brief Action of a key on one layer (may be transparent)
+key_action_t keymap_action(uint8_t layer, uint key);
+
+// @brief Transparent keys of a layer, one key state word (KEY_WORDS)
+uint64_t keymap_transparent(uint8_t layer, uint word);
+
+// @brief Tap-hold entry of a KEY_ACTION_TAP_HOLD code, NULL if out of range
+key_tap_hold_t const* keymap_tap_hold_entry(uint index);
+
+// @brief Combo slot, keys = 0 if unused
+key_combo_t const* keymap_combo(uint index);
+
+// @brief Combo made of exactly these keys, NULL if none
+// Only the combos whose lowest member key is the lowest key of keys are compared
+key_combo_t const* keymap_combo_match(uint64_t keys);
+
+// @brief Keys sharing a combo with key (itself included), 0 if it is in none
+uint64_t keymap_combo_partners(uint key);
+
+// @brief Keys in any combo
+uint64_t keymap_combo_keys(void);
+
+uint32_t keymap_setting(keymap_setting_t setting);
+
+// @brief Change an entry and save it to flash (written when the keyboard is idle)
+// @return false if out of range or the action refers to something missing
+bool keymap_set_action(uint8_t layer, uint key, key_action_t action);
+bool keymap_set_tap_hold(uint index, key_tap_hold_t entry);
+bool keymap_set_combo(uint index, key_combo_t combo);
+bool keymap_set_setting(keymap_setting_t setting, uint32_t value);
+
+#endif /* KEYMAP_H_ */
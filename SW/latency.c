@@ -0,0 +1,36 @@
+// Key-to-host latency histograms, see latency.h
+
+#include <string.h>
+
+#include "latency.h"
+
+static latency_stats_t s_stats;
+
+void latency_record(latency_stage_t stage, uint32_t from_us, uint32_t to_us)
+{
+  int32_t diff = (int32_t) (to_us - from_us);
+  uint32_t us = (diff > 0) ? (uint32_t) diff : 0;
+
+  uint bucket = us ? 32 - __builtin_clz(us) : 0;
+  if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+
+  latency_hist_t* hist = &s_stats.stages[stage];
+  hist->buckets[bucket]++;
+  if (us > hist->max_us) hist->max_us = us;
+}
+
+void latency_depth(uint32_t event_queue, uint32_t report_queue)
+{
+  if (event_queue > s_stats.event_queue_max) s_stats.event_queue_max = event_queue;
+  if (report_queue > s_stats.report_queue_max) s_stats.report_queue_max = report_queue;
+}
+
+void latency_clear(void)
+{
+  memset(&s_stats, 0, sizeof(s_stats));
+}
+
+latency_stats_t const* latency_stats(void)
+{
+  return &s_stats;
+}
@@ -0,0 +1,91 @@
+// Key-to-host latency histograms (core0)
+// Built only with LATENCY_STATS=1 (CMake option LATENCY_STATS); otherwise
+// every call below is an empty inline and the timestamps are not stored.
+//
+// A transition is stamped with time_us_32() (the shared 1us timer, so core1
+// and core0 stamps compare directly) at:
+//   scan      matrix sample that saw it (key_event_t.time_us)
+//   commit    debounce pushed the event (core1)
+//   build     its keyboard report was queued (core0)
+//   submit    the report was handed to TinyUSB
+//   complete  tud_hid_report_complete_cb(), the host has read it
+// Reports not caused by a key event (tap-hold / combo timeouts, macros) only
+// count in the build -> submit and submit -> complete stages.
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+
+#ifndef LATENCY_STATS
+#define LATENCY_STATS  0
+#endif
+
+typedef enum
+{
+  LATENCY_DEBOUNCE = 0,   // scan -> commit
+  LATENCY_HANDOFF,        // commit -> build (event ring + report stage period)
+  LATENCY_QUEUE,          // build -> submit (reports queued ahead)
+  LATENCY_USB,            // submit -> complete (host poll)
+  LATENCY_END_TO_END,     // scan -> complete
+  LATENCY_STAGE_COUNT
+} latency_stage_t;
+
+// log2 buckets: 0 = 0us, n = [2^(n-1), 2^n) us, the last one is open ended (>= 4096us)
+#define LATENCY_BUCKETS  14
+
+typedef struct
+{
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t max_us;
+} latency_hist_t;
+
+typedef struct
+{
+  latency_hist_t stages[LATENCY_STAGE_COUNT];
+  uint32_t event_queue_max;   // deepest key event ring seen by the report stage
+  uint32_t report_queue_max;  // deepest keyboard report queue
+} latency_stats_t;
+
+// Stamps carried by a queued report
+typedef struct
+{
+  uint32_t scan_us;
+  uint32_t commit_us;
+  uint32_t build_us;
+  uint32_t submit_us;
+  bool     from_event;      // scan / commit are valid
+} latency_stamp_t;
+
+#if LATENCY_STATS
+
+// @brief Add one sample, negative durations count as 0
+void latency_record(latency_stage_t stage, uint32_t from_us, uint32_t to_us);
+
+// @brief Track the deepest queues
+void latency_depth(uint32_t event_queue, uint32_t report_queue);
+
+void latency_clear(void);
+
+latency_stats_t const* latency_stats(void);
+
+#else
+
+static inline void latency_record(latency_stage_t stage, uint32_t from_us, uint32_t to_us)
+{
+  (void) stage;
+  (void) from_us;
+  (void) to_us;
+}
+
+static inline void latency_depth(uint32_t event_queue, uint32_t report_queue)
+{
+  (void) event_queue;
+  (void) report_queue;
+}
+
+#endif
+
+#endif /* LATENCY_H_ */
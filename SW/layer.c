@@ -0,0 +1,174 @@
+// Layer stack and effective keymap, see layer.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "key_iter.h"
+#include "layer.h"
+#include "keymap_table.h"   // generated from keymap.json, see tools/keymap_gen.py
+
+#define MATRIX_KEY_MASK  ((1ULL << (NUM_ROWS * NUM_COLS)) - 1)
+
+// Layer masks are 8 bits, keymap_gen.py allows at most 8 layers
+static uint8_t s_default_layer;
+static uint8_t s_toggle;                          // TG(n) layers
+static uint8_t s_momentary[KEYMAP_NUM_LAYERS];    // MO(n) / held OSL(n) keys per layer
+static uint8_t s_oneshot;                         // released OSL(n) waiting for the next key
+static bool    s_oneshot_used;                    // a key was pressed while OSL(n) was held
+
+static uint8_t s_state;                           // active layers the keymap was flattened for
+static key_action_t s_effective[KEYMAP_KEYS];
+
+// @brief Flatten the active layers into s_effective
+// Each layer only fills the keys still unresolved and not transparent on it,
+// so the cost is one pass over the keys, not one per layer. Every key state
+// word holds one half's matrix (KEY_WORDS, split_link.h).
+static void layer_rebuild(void)
+{
+  uint64_t unresolved[KEY_WORDS];
+  uint64_t any = 0;
+
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    unresolved[word] = MATRIX_KEY_MASK;
+    any |= unresolved[word];
+  }
+
+  // Transparent all the way down means nothing
+  memset(s_effective, 0, sizeof(s_effective));
+
+  for (int layer = KEYMAP_NUM_LAYERS - 1; layer >= 0 && any; --layer)
+  {
+    if (!(s_state & (1u << layer))) continue;
+
+    any = 0;
+    for (uint word = 0; word < KEY_WORDS; ++word)
+    {
+      uint64_t transparent = keymap_transparent((uint8_t) layer, word);
+      uint64_t keys = unresolved[word] & ~transparent;
+      unresolved[word] &= transparent;
+      any |= unresolved[word];
+
+      uint key;
+      while (key_iter_next(&keys, &key)) {
+        s_effective[64 * word + key] = keymap_action((uint8_t) layer, 64 * word + key);
+      }
+    }
+  }
+}
+
+// @brief Recompute the active layer mask, flatten again only if it changed
+static void layer_update(void)
+{
+  uint8_t state = (uint8_t) ((1u << s_default_layer) | s_toggle | s_oneshot);
+
+  for (uint layer = 0; layer < KEYMAP_NUM_LAYERS; ++layer) {
+    if (s_momentary[layer]) state |= (uint8_t) (1u << layer);
+  }
+
+  if (state != s_state) {
+    s_state = state;
+    layer_rebuild();
+  }
+}
+
+void layer_init(void)
+{
+  s_default_layer = (uint8_t) keymap_setting(KEYMAP_SETTING_DEFAULT_LAYER);
+  s_toggle = 0;
+  s_oneshot = 0;
+  s_oneshot_used = false;
+  memset(s_momentary, 0, sizeof(s_momentary));
+
+  s_state = (uint8_t) (1u << s_default_layer);
+  layer_rebuild();
+}
+
+void layer_refresh(void)
+{
+  layer_rebuild();
+}
+
+key_action_t layer_action(uint key)
+{
+  return s_effective[key];
+}
+
+void layer_press(key_action_t action)
+{
+  uint8_t bit = (uint8_t) (1u << action.code);
+
+  switch (action.type)
+  {
+    case KEY_ACTION_LAYER_MOMENTARY:
+      s_momentary[action.code]++;
+      break;
+
+    case KEY_ACTION_LAYER_ONESHOT:
+      // Acts as momentary while held, decided on release
+      s_momentary[action.code]++;
+      s_oneshot &= (uint8_t) ~bit;
+      s_oneshot_used = false;
+      break;
+
+    case KEY_ACTION_LAYER_TOGGLE:
+      s_toggle ^= bit;
+      break;
+
+    case KEY_ACTION_LAYER_DEFAULT:
+      s_default_layer = action.code;
+      break;
+
+    default:
+      return;
+  }
+
+  layer_update();
+}
+
+void layer_release(key_action_t action)
+{
+  switch (action.type)
+  {
+    case KEY_ACTION_LAYER_MOMENTARY:
+      if (s_momentary[action.code]) s_momentary[action.code]--;
+      break;
+
+    case KEY_ACTION_LAYER_ONESHOT:
+      if (s_momentary[action.code]) s_momentary[action.code]--;
+      // Tapped on its own: keep the layer for the next key
+      if (!s_oneshot_used) s_oneshot |= (uint8_t) (1u << action.code);
+      break;
+
+    default:
+      return;
+  }
+
+  layer_update();
+}
+
+void layer_key_used(void)
+{
+  s_oneshot_used = true;
+
+  if (s_oneshot) {
+    s_oneshot = 0;
+    layer_update();
+  }
+}
+
+uint8_t layer_state(void)
+{
+  return s_state;
+}
+
+uint8_t layer_top(void)
+{
+  return (uint8_t) (31 - __builtin_clz(s_state));
+}
+
+uint8_t layer_default(void)
+{
+  return s_default_layer;
+}
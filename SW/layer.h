@@ -0,0 +1,39 @@
+// Layer stack and effective keymap (core0)
+// Active layers are a bitmask: the default layer, toggled layers, layers held
+// by momentary / one-shot keys and a pending one-shot layer. Whenever the mask
+// changes the keymap is flattened once (highest active layer first, falling
+// through transparent keys), so looking up a key is a single table read.
+
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+#include "keymap.h"
+
+// @brief Reset to the saved default layer (KEYMAP_SETTING_DEFAULT_LAYER) as the only active layer
+void layer_init(void);
+
+// @brief Flatten the active layers again after the keymap changed
+void layer_refresh(void);
+
+// @brief Effective action of a key for the current layer state
+key_action_t layer_action(uint key);
+
+// @brief Apply a layer action on press / release of the key holding it
+void layer_press(key_action_t action);
+void layer_release(key_action_t action);
+
+// @brief A key other than a layer key was pressed: ends a pending one-shot layer
+void layer_key_used(void);
+
+// @brief Active layers, bit n = layer n
+uint8_t layer_state(void);
+
+// @brief Highest active layer
+uint8_t layer_top(void);
+
+// @brief Current default layer
+uint8_t layer_default(void);
+
+#endif /* LAYER_H_ */
@@ -0,0 +1,146 @@
+// Macro playback, see macro.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "macro.h"
+#include "keymap_table.h"   // generated from keymap.json, see tools/keymap_gen.py
+
+static uint8_t const* s_pc;          // next op, NULL = idle
+static bool     s_tap_down;          // TAP / SHIFT_TAP pressed, release due next
+static bool     s_delay;             // waiting until s_resume_us
+static uint32_t s_resume_us;
+
+static uint8_t  s_queue[MACRO_QUEUE_SIZE];
+static uint32_t s_queue_head, s_queue_tail;
+
+static uint8_t  s_keys[MACRO_KEYS_MAX];
+static uint     s_key_count;
+static uint8_t  s_modifiers;
+
+static bool is_modifier(uint8_t kc)
+{
+  return kc >= HID_KEY_CONTROL_LEFT && kc <= HID_KEY_GUI_RIGHT;
+}
+
+static void key_down(uint8_t kc)
+{
+  if (is_modifier(kc)) {
+    s_modifiers |= (uint8_t) (1u << (kc - HID_KEY_CONTROL_LEFT));
+    return;
+  }
+
+  for (uint i = 0; i < s_key_count; ++i) {
+    if (s_keys[i] == kc) return;
+  }
+  if (s_key_count < MACRO_KEYS_MAX) s_keys[s_key_count++] = kc;
+}
+
+static void key_up(uint8_t kc)
+{
+  if (is_modifier(kc)) {
+    s_modifiers &= (uint8_t) ~(1u << (kc - HID_KEY_CONTROL_LEFT));
+    return;
+  }
+
+  for (uint i = 0; i < s_key_count; ++i) {
+    if (s_keys[i] == kc) {
+      s_keys[i] = s_keys[--s_key_count];
+      return;
+    }
+  }
+}
+
+void macro_init(void)
+{
+  s_pc = NULL;
+  s_tap_down = false;
+  s_delay = false;
+  s_queue_head = s_queue_tail = 0;
+  s_key_count = 0;
+  s_modifiers = 0;
+}
+
+bool macro_play(uint8_t index)
+{
+  if (index >= keymap_macro_count()) return false;
+  if (s_queue_head - s_queue_tail >= MACRO_QUEUE_SIZE) return false;
+
+  s_queue[s_queue_head++ & (MACRO_QUEUE_SIZE - 1)] = index;
+  return true;
+}
+
+bool macro_step(uint32_t now_us)
+{
+  if (s_pc == NULL)
+  {
+    if (s_queue_head == s_queue_tail) return false;
+    s_pc = &keymap_macro_bytecode[keymap_macro_offset[s_queue[s_queue_tail++ & (MACRO_QUEUE_SIZE - 1)]]];
+  }
+
+  if (s_delay) {
+    if ((int32_t) (now_us - s_resume_us) < 0) return false;
+    s_delay = false;
+    s_pc += 2;
+  }
+
+  uint8_t op = s_pc[0];
+  uint8_t arg = s_pc[1];
+
+  switch (op)
+  {
+    case MACRO_OP_TAP:
+    case MACRO_OP_SHIFT_TAP:
+      if (!s_tap_down) {
+        if (op == MACRO_OP_SHIFT_TAP) key_down(HID_KEY_SHIFT_LEFT);
+        key_down(arg);
+        s_tap_down = true;
+        return true;
+      }
+      if (op == MACRO_OP_SHIFT_TAP) key_up(HID_KEY_SHIFT_LEFT);
+      key_up(arg);
+      s_tap_down = false;
+      s_pc += 2;
+      return true;
+
+    case MACRO_OP_DOWN:
+      key_down(arg);
+      s_pc += 2;
+      return true;
+
+    case MACRO_OP_UP:
+      key_up(arg);
+      s_pc += 2;
+      return true;
+
+    case MACRO_OP_DELAY:
+      s_delay = true;
+      s_resume_us = now_us + (uint32_t) arg * 1000;
+      return false;
+
+    default:
+      // MACRO_OP_END: release whatever DOWN left pressed
+      s_pc = NULL;
+      s_key_count = 0;
+      s_modifiers = 0;
+      return true;
+  }
+}
+
+bool macro_busy(void)
+{
+  return s_pc != NULL || s_queue_head != s_queue_tail;
+}
+
+uint macro_keys(uint8_t const** keys)
+{
+  *keys = s_keys;
+  return s_key_count;
+}
+
+uint8_t macro_modifiers(void)
+{
+  return s_modifiers;
+}
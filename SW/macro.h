@@ -0,0 +1,43 @@
+// Macro playback (core0)
+// A KEY_ACTION_MACRO press queues a macro (bytecode from keymap.json, see
+// macro_op_t in keymap.h). Playback never blocks: macro_step() moves the
+// macro on by one report, and keyboard.c only calls it when the keyboard
+// report queue is empty, from hid_task() and from tud_hid_report_complete_cb().
+// A macro so types one report per USB poll, as fast as the host takes them,
+// while key events keep being applied in between. Macro keys are added to
+// the keys held on the matrix when building reports.
+
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+
+// Keycodes a macro can hold down at once (plus modifiers)
+#define MACRO_KEYS_MAX    6
+// Macros waiting behind the one playing, must be a power of 2
+#define MACRO_QUEUE_SIZE  4
+
+// @brief Stop playback and release the macro keys
+void macro_init(void);
+
+// @brief Queue macro index for playback
+// @return false if the index is out of range or the queue is full
+bool macro_play(uint8_t index);
+
+// @brief Play the next bytecode op
+// @return true if the macro keys changed (a report is due), false while idle or in a delay
+bool macro_step(uint32_t now_us);
+
+// @brief A macro is playing or queued
+bool macro_busy(void);
+
+// @brief Keycodes currently held by the macro
+// @return count, keycodes in keys[0 .. count - 1]
+uint macro_keys(uint8_t const** keys);
+
+// @brief Modifier byte held by the macro
+uint8_t macro_modifiers(void);
+
+#endif /* MACRO_H_ */
@@ -22,7 +22,6 @@
  * THE SOFTWARE.
  *
  */
-
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,126 +29,95 @@
 #include "bsp/board_api.h"
 #include "tusb.h"
 
-#include "usb_descriptors.h"
-#include "hardware/gpio.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+
+#include "matrix_scan.h"
+#include "scheduler.h"
+#include "keyboard.h"
+#include "power.h"
+#include "sof_sync.h"
+#include "split_link.h"
+
+#if SPLIT_PERIPHERAL && !SPLIT_LINK
+#error "SPLIT_PERIPHERAL needs SPLIT_LINK"
+#endif
+
+#if KEY_ITER_BENCH
+#include "pico/time.h"
+#include "key_iter_bench.h"
+#endif
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
 //--------------------------------------------------------------------+
 
-// Matrix dimensions
-#define NUM_ROWS 6
-#define NUM_COLS 10
-#define NUM_KEYS 50
-
-// GPIO pin for keyboard as matrix circuit
-#define GPIO_ROW_0 (21)
-#define GPIO_ROW_1 (20)
-#define GPIO_ROW_2 (19)
-#define GPIO_ROW_3 (18)
-#define GPIO_ROW_4 (17)
-#define GPIO_ROW_5 (16)
-
-#define GPIO_COL_0 (4)
-#define GPIO_COL_1 (5)
-#define GPIO_COL_2 (6)
-#define GPIO_COL_3 (7)
-#define GPIO_COL_4 (8)
-#define GPIO_COL_5 (9)
-#define GPIO_COL_6 (3)
-#define GPIO_COL_7 (2)
-#define GPIO_COL_8 (1)
-#define GPIO_COL_9 (0)
-
-// Row and Column GPIO arrays
-static const uint row_pins[NUM_ROWS] = {
-  GPIO_ROW_0, GPIO_ROW_1, GPIO_ROW_2, 
-  GPIO_ROW_3, GPIO_ROW_4, GPIO_ROW_5
+#if !SPLIT_PERIPHERAL
+static void core1_scan_main(void);
+
+static sched_stage_t s_core0_stages[] = {
+  { .name = "report",   .fn = hid_task,       .period_us = REPORT_PERIOD_US    },
+  { .name = "idle",     .fn = idle_task,      .period_us = IDLE_PERIOD_US      },
 };
 
-static const uint col_pins[NUM_COLS] = {
-  GPIO_COL_0, GPIO_COL_1, GPIO_COL_2, GPIO_COL_3, GPIO_COL_4,
-  GPIO_COL_5, GPIO_COL_6, GPIO_COL_7, GPIO_COL_8, GPIO_COL_9
+// Scan and debounce periods are switched by power_scan_rate_update()
+static sched_stage_t s_core1_stages[] = {
+  { .name = "scan",     .fn = scan_task,      .period_us = SCAN_PERIOD_US      },
+  { .name = "debounce", .fn = debounce_task,  .period_us = DEBOUNCE_PERIOD_US  },
+  { .name = "calib",    .fn = calibrate_task, .period_us = CALIBRATE_PERIOD_US },
 };
 
-// Number of layers
-#define NUM_LAYERS 2
-// #define HID_KEY_FN 0xFF  // Custom code for FN key
+#define CORE0_STAGE_COUNT  TU_ARRAY_SIZE(s_core0_stages)
+#define CORE1_STAGE_COUNT  TU_ARRAY_SIZE(s_core1_stages)
+#define CORE0_STAGE_REPORT    0
+#define CORE1_STAGE_SCAN      0
+#define CORE1_STAGE_DEBOUNCE  1
+#endif
 
-// Key to HID keycode mapping table
-// Index = [layer][row][col], Value = HID keycode
-// Based on README.md matrix layout (JIS layout right-hand side)
-static const uint8_t keycode_map[NUM_LAYERS][NUM_ROWS][NUM_COLS] = {
-  // Layer 0 (Base layer)
-  {
-    // ROW0: F4, F5, F6, F7, F8, F9, F10, F11, F12, (empty)
-    { HID_KEY_F4, HID_KEY_F5, HID_KEY_F6, HID_KEY_F7, HID_KEY_F8, 
-      HID_KEY_F9, HID_KEY_F10, HID_KEY_F11, HID_KEY_F12, 0 },
-    
-    // ROW1: 5, 6, 7, 8, 9, 0, -, ^, \, Backspace
-    { HID_KEY_5, HID_KEY_6, HID_KEY_7, HID_KEY_8, HID_KEY_9,
-      HID_KEY_0, HID_KEY_MINUS, HID_KEY_EQUAL, HID_KEY_KANJI3, HID_KEY_BACKSPACE },
-    
-    // ROW2: T, Y, U, I, O, P, @, [, Enter, (empty)
-    { HID_KEY_T, HID_KEY_Y, HID_KEY_U, HID_KEY_I, HID_KEY_O,
-      HID_KEY_P, HID_KEY_BRACKET_LEFT, HID_KEY_BRACKET_RIGHT, HID_KEY_ENTER, 0 },
-    
-    // ROW3: G, H, J, K, L, ;, :, ](む), (empty), (empty)
-    { HID_KEY_G, HID_KEY_H, HID_KEY_J, HID_KEY_K, HID_KEY_L,
-      HID_KEY_SEMICOLON, HID_KEY_APOSTROPHE, HID_KEY_EUROPE_1, 0, 0 },
-    
-    // ROW4: B, N, M, <(,), >(.), /, \(ろ), RShift, (empty), (empty)
-    { HID_KEY_B, HID_KEY_N, HID_KEY_M, HID_KEY_COMMA, HID_KEY_PERIOD,
-      HID_KEY_SLASH, HID_KEY_KANJI1, 0, 0, 0 },
-    
-    // ROW5: Space, 変換, Alt, PrintScreen, Delete, FN, (empty), (empty), (empty), (empty)
-    { HID_KEY_SPACE, HID_KEY_KANJI4, HID_KEY_ALT_RIGHT, HID_KEY_PRINT_SCREEN,
-      HID_KEY_DELETE, 0, 0, 0, 0, 0 }
-  },
-  // Layer 1 (FN layer) - Arrow keys on HJKL, Home/End/PgUp/PgDn, etc.
-  {
-    // ROW0: (empty)...
-    { 0, 0, 0, 0, 0, 
-      0, 0, 0, 0, 0 },
-    
-    // ROW1: (empty)...
-    { 0, 0, 0, 0, 0, 
-      0, 0, 0, 0, 0 },
-    
-    // ROW2: (empty)...
-    { 0, 0, 0, 0, 0, 
-      0, 0, 0, 0, 0 },
-    
-    // ROW3: (empty), (empty), (empty), (empty), (empty), Arrow Up, (empty), (empty), (empty), (empty)
-    { 0, 0, 0, 0, 0,
-      HID_KEY_ARROW_UP, 0, 0, 0, 0 },
-
-    // ROW4: (empty), (empty), (empty), (empty), Arrow Left, Arrow Down, Arrow Right, (empty), (empty), (empty)
-    { 0, 0, 0, 0, HID_KEY_ARROW_LEFT,
-      HID_KEY_ARROW_DOWN, HID_KEY_ARROW_RIGHT, 0, 0, 0 },
-    
-    // ROW5: (empty)... (FN key is handled specially, not via keycode_map)
-    { 0, 0, 0, 0, 0, 
-      0, 0, 0, 0, 0 }
-  }
-};
+#if KEY_ITER_BENCH
+// Report build cost, walk vs sparse iteration (ns per report)
+// Filled once at startup, read it with the debugger
+key_iter_bench_result_t g_key_iter_bench[KEY_ITER_BENCH_CASES];
 
-// Modifier key positions (row * 10 + col)
-#define KEY_POS_RSHIFT  (4 * 10 + 7)  // SW44 - Right Shift
-#define KEY_POS_RALT    (5 * 10 + 2)  // SW47 - Right Alt
-#define KEY_POS_FN      (5 * 10 + 5)  // SW50 - FN key (replaces RCtrl)
+static uint64_t bench_now_ns(void)
+{
+  return time_us_64() * 1000;
+}
+#endif
 
-// Keyboard state - 64 bits for up to 60 keys
-static uint64_t g_key_state = 0;
+#if SPLIT_PERIPHERAL
+// Left half: one core, no USB. Its scan follows the right half's (split_link.h)
+static sched_stage_t s_split_stages[] = {
+  { .name = "scan",     .fn = split_scan_task, .period_us = SCAN_PERIOD_US     },
+};
+
+/*------------- MAIN -------------*/
+int main(void)
+{
+  board_init();
+  matrix_scan_init();
+  keyboard_split_init();
 
-void hid_task(void);
-void keyboard_switch_read(uint64_t* key_state);
+  scheduler_init(s_split_stages, TU_ARRAY_SIZE(s_split_stages));
 
+  // Busy: a SYNC is timed when it is polled
+  while (1)
+  {
+    keyboard_split_poll(&s_split_stages[0]);
+    scheduler_run(s_split_stages, TU_ARRAY_SIZE(s_split_stages));
+  }
+}
+#else
 /*------------- MAIN -------------*/
 int main(void)
 {
   board_init();
 
+#if KEY_ITER_BENCH
+  // Before USB starts, so nothing else runs during the measurement
+  key_iter_bench_run(g_key_iter_bench, bench_now_ns, 20000);
+#endif
+
   // init device stack on configured roothub port
   tud_init(BOARD_TUD_RHPORT);
 
@@ -158,34 +126,35 @@ int main(void)
   }
 
   // GPIO initialization AFTER board_init to ensure our settings are not overwritten
-  // init output pins (columns - active low scan)
-  for (size_t i = 0; i < NUM_COLS; ++i) {
-    gpio_init(col_pins[i]);
-    gpio_set_dir(col_pins[i], GPIO_OUT);
-    gpio_put(col_pins[i], 1);  // Default high (inactive)
-  }
+  matrix_scan_init();
+  keyboard_init();
+  power_init();
+  sof_sync_init();
 
-  // init input pins (rows - pull-up, read low when key pressed)
-  for (size_t i = 0; i < NUM_ROWS; ++i) {
-    gpio_init(row_pins[i]);
-    gpio_set_dir(row_pins[i], GPIO_IN);
-    gpio_pull_up(row_pins[i]);
-  }
+  // core1 owns the matrix scan, core0 only runs USB
+  multicore_launch_core1(core1_scan_main);
+
+  scheduler_init(s_core0_stages, CORE0_STAGE_COUNT);
 
   while (1)
   {
     tud_task(); // tinyusb device task
-    hid_task();
+    sof_sync_align_report(&s_core0_stages[CORE0_STAGE_REPORT]);
+    scheduler_run(s_core0_stages, CORE0_STAGE_COUNT);
+    power_task(); // remote wakeup, or sleep until the next interrupt while suspended
   }
 }
+#endif
 
 //--------------------------------------------------------------------+
 // Device callbacks
 //--------------------------------------------------------------------+
 
 // Invoked when device is mounted
+// SOF callbacks for the frame phase lock (sof_sync.h), a bus reset turns them off
 void tud_mount_cb(void)
 {
+  sof_sync_mount();
 }
 
 // Invoked when device is unmounted
@@ -196,196 +165,56 @@ void tud_umount_cb(void)
 // Invoked when usb bus is suspended
 // remote_wakeup_en : if host allow us to perform remote wakeup
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus
+// Both cores sleep until a row edge or the resume (power.h)
 void tud_suspend_cb(bool remote_wakeup_en)
 {
-  (void) remote_wakeup_en;
+  power_suspend(remote_wakeup_en);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
+  power_resume();
 }
 
-//--------------------------------------------------------------------+
-// USB HID
-//--------------------------------------------------------------------+
-
-// @brief keyboard switch read function
-// Scan the keyboard matrix and return the key states as a bitmask
-// @param key_state Pointer to uint64_t to store the scan results (bit per key)
-void keyboard_switch_read(uint64_t* key_state)
+// Invoked on every start of frame once enabled with tud_sof_cb_enable()
+void tud_sof_cb(uint32_t frame_count)
 {
-  *key_state = 0;
-
-  // Scan each column (output)
-  for (uint col = 0; col < NUM_COLS; ++col) {
-    // Set current column low (active)
-    gpio_put(col_pins[col], 0);
-    
-    // Delay to allow signal to stabilize
-    sleep_us(10);
-
-    // Read all rows (input)
-    for (uint row = 0; row < NUM_ROWS; ++row) {
-      // If row is low, key is pressed (active low with pull-up)
-      if (gpio_get(row_pins[row]) == 0) {
-        // Calculate bit position for this key
-        uint32_t bit_pos = row * NUM_COLS + col;
-        *key_state |= (1ULL << bit_pos);
-      }
-    }
-
-    // Set column back to high (inactive)
-    gpio_put(col_pins[col], 1);
-    
-    // Small delay before next column
-    sleep_us(5);
-  }
+  sof_sync_frame(frame_count);
 }
 
-// Build HID report from key state bitmask
-static void send_hid_report(uint8_t report_id, uint64_t key_state)
-{
-  // skip if hid is not ready yet
-  if (!tud_hid_ready()) return;
-
-  switch(report_id)
-  {
-    case REPORT_ID_KEYBOARD:
-    {
-      static bool has_keyboard_key = false;
-
-      if (key_state != 0)
-      {
-        uint8_t modifier = 0;
-        uint8_t keycode[6] = { 0 };
-        uint8_t key_count = 0;
-        
-        // Determine active layer based on FN key state
-        uint8_t layer = 0;
-        if (key_state & (1ULL << KEY_POS_FN)) {
-          layer = 1; // FN key pressed - switch to layer 1
-        }
-
-        // Check modifier keys and build keycode array
-        for (uint row = 0; row < NUM_ROWS && key_count < 6; ++row) {
-          for (uint col = 0; col < NUM_COLS && key_count < 6; ++col) {
-            uint32_t bit_pos = row * NUM_COLS + col;
-            
-            if (key_state & (1ULL << bit_pos)) {
-              // Check if this is a modifier key or FN key
-              if (bit_pos == KEY_POS_RSHIFT) {
-                modifier |= KEYBOARD_MODIFIER_RIGHTSHIFT;
-              } else if (bit_pos == KEY_POS_RALT) {
-                modifier |= KEYBOARD_MODIFIER_RIGHTALT;
-              } else if (bit_pos == KEY_POS_FN) {
-                // FN key - don't send any keycode, just used for layer switching
-              } else {
-                // Regular key - add to keycode array using current layer
-                uint8_t kc = keycode_map[layer][row][col];
-                if (kc != 0 && key_count < 6) {
-                  keycode[key_count++] = kc;
-                }
-              }
-            }
-          }
-        }
-
-        tud_hid_keyboard_report(REPORT_ID_KEYBOARD, modifier, keycode);
-        has_keyboard_key = true;
-      }
-      else
-      {
-        // send empty key report if previously had key pressed
-        if (has_keyboard_key) {
-          tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
-        }
-        has_keyboard_key = false;
-      }
-    }
-    break;
-
-    case REPORT_ID_MOUSE:
-    {
-      // Mouse report - not used for keyboard only
-      // tud_hid_mouse_report(REPORT_ID_MOUSE, 0x00, 0, 0, 0, 0);
-    }
-    break;
-
-    default: break;
-  }
-}
+#if !SPLIT_PERIPHERAL
+//--------------------------------------------------------------------+
+// Core1
+//--------------------------------------------------------------------+
 
-// HID task - called from main loop
-void hid_task(void)
+// @brief Core1 entry point
+// Run the scan and debounce stages, idling until the next release time.
+// While the bus is suspended and no key is down, sleep with the matrix parked.
+static void core1_scan_main(void)
 {
-  // Poll every 10ms
-  const uint32_t interval_ms = 10;
-  static uint32_t start_ms = 0;
+  // Let core0 park this core while it programs flash (store.c)
+  flash_safe_execute_core_init();
 
-  if (board_millis() - start_ms < interval_ms) return;
-  start_ms += interval_ms;
+  keyboard_core1_init();
+  scheduler_init(s_core1_stages, CORE1_STAGE_COUNT);
 
-  // Read keyboard matrix
-  keyboard_switch_read(&g_key_state);
-
-  // LED on when FN key is pressed (for debugging layer switch)
-  // Change to (g_key_state != 0) to test any key press
-  board_led_write((g_key_state & (1ULL << KEY_POS_FN)) != 0);
-
-  // Remote wakeup
-  if (tud_suspended() && g_key_state != 0)
-  {
-    // Wake up host if we are in suspend mode
-    // and REMOTE_WAKEUP feature is enabled by host
-    tud_remote_wakeup();
-  }
-  else
+  while (1)
   {
-    // Send keyboard report
-    send_hid_report(REPORT_ID_KEYBOARD, g_key_state);
-  }
-}
+    // Suspended with no key down: matrix parked, one sleep per call
+    if (power_core1_sleep(s_core1_stages, CORE1_STAGE_COUNT)) continue;
 
-// Invoked when sent REPORT successfully to host
-// Application can use this to send the next report
-// Note: For composite reports, report[0] is report ID
-void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
-{
-  (void) instance;
-  (void) len;
+    // Scan and debounce finish just before the host polls (sof_sync.h)
+    sof_sync_align_scan(s_core1_stages, CORE1_STAGE_COUNT);
 
-  uint8_t next_report_id = report[0] + 1u;
+    uint64_t next_us = scheduler_run(s_core1_stages, CORE1_STAGE_COUNT);
 
-  if (next_report_id < REPORT_ID_COUNT)
-  {
-    send_hid_report(next_report_id, g_key_state);
-  }
-}
-
-// Invoked when received GET_REPORT control request
-// Application must fill buffer report's content and return its length.
-// Return zero will cause the stack to STALL request
-uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
-{
-  // TODO not Implemented
-  (void) instance;
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
-
-  return 0;
-}
+    // Release times follow a scan rate change
+    if (power_scan_rate_update(&s_core1_stages[CORE1_STAGE_SCAN], &s_core1_stages[CORE1_STAGE_DEBOUNCE])) {
+      continue;
+    }
 
-// Invoked when received SET_REPORT control request or
-// received data on OUT endpoint ( Report ID = 0, Type = 0 )
-void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
-{
-  (void) instance;
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) bufsize;
+    power_core1_wait(next_us);
+  }
 }
-
+#endif
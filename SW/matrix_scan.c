@@ -0,0 +1,548 @@
+// Keyboard matrix scanner
+// See matrix_scan.h for the matrix layout and matrix_scan.pio for the PIO program.
+
+#include "matrix_scan.h"
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+#if MATRIX_SCAN_USE_PIO
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "matrix_scan.pio.h"
+#endif
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF PROTYPES
+//--------------------------------------------------------------------+
+
+// Row and Column GPIO arrays
+const uint row_pins[NUM_ROWS] = {
+  GPIO_ROW_0, GPIO_ROW_1, GPIO_ROW_2,
+  GPIO_ROW_3, GPIO_ROW_4, GPIO_ROW_5
+};
+
+const uint col_pins[NUM_COLS] = {
+  GPIO_COL_0, GPIO_COL_1, GPIO_COL_2, GPIO_COL_3, GPIO_COL_4,
+  GPIO_COL_5, GPIO_COL_6, GPIO_COL_7, GPIO_COL_8, GPIO_COL_9
+};
+
+// Row pins sampled as one word: bit n = GPIO (GPIO_ROW_BASE + n)
+#define ROW_SAMPLE_MASK  ((1u << NUM_ROWS) - 1)
+#define COL_GPIO_MASK    (((1u << NUM_COLS) - 1) << GPIO_COL_BASE)
+
+// Idle probe settle time. Rows start high (idle) and a closed switch pulls its
+// row low through a driven column output, which is fast; the 10us column
+// settle is for rows recovering high through the weak pull-ups.
+#define PROBE_SETTLE_US  2
+
+// Settle calibration: each delay from 0 to CALIB_MAX_US is tried until
+// CALIB_SAMPLES switches in a row all read the new level at that delay
+#define CALIB_MAX_US   20
+#define CALIB_SAMPLES  4
+
+// Calibration lines: NUM_COLS columns (fall and rise), then NUM_ROWS rows (rise)
+#define CALIB_LINES    (NUM_COLS + NUM_ROWS)
+
+static matrix_timing_t s_timing;
+
+// Longest recover delay: rows pulled low by several columns at once (idle
+// probe, park) are back high after it
+static uint32_t s_recover_max_us = MATRIX_RECOVER_US;
+
+// Row sample -> key state bits of column 0 (bit (row * NUM_COLS) per pressed row).
+// Shifting the entry left by the column index places it, so no per-key
+// bit_pos math is needed while scanning.
+static uint64_t s_row_spread[1u << NUM_ROWS];
+
+// Column strobe masks in scan order: GPIO level for "this column low, others high"
+static uint32_t s_col_strobe[NUM_COLS];
+
+static void matrix_scan_tables_init(void)
+{
+  for (uint sample = 0; sample <= ROW_SAMPLE_MASK; ++sample) {
+    uint64_t bits = 0;
+    for (uint row = 0; row < NUM_ROWS; ++row) {
+      if (sample & (1u << (row_pins[row] - GPIO_ROW_BASE))) {
+        bits |= 1ULL << (row * NUM_COLS);
+      }
+    }
+    s_row_spread[sample] = bits;
+  }
+
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    s_col_strobe[col] = COL_GPIO_MASK & ~(1u << col_pins[col]);
+  }
+}
+
+#if MATRIX_SCAN_USE_PIO
+
+// PIO clock: 1 tick = 0.5us, so settle = 5us and recover = 2us per column
+// Frame = 10 * (SETTLE + RECOVER + 5) + 4 ticks = ~88us (~11kHz)
+#define MATRIX_PIO_TICK_HZ  2000000u
+
+// Columns per 32-bit frame word (30 bits used, autopush threshold)
+#define MATRIX_PIO_COLS_PER_WORD  5
+
+static PIO  s_pio = pio0;
+static uint s_sm;
+static uint s_offset;
+static int  s_dma_chan[2];
+
+// Double-buffered frame slots, 2 words each. The DMA write ring wraps within
+// one 8-byte slot, so each slot must be 8-byte aligned.
+static uint32_t s_frame_buf[2][2] __attribute__((aligned(8)));
+
+// Matrix column for each PIO visit (visit 0 = GPIO 9 ... visit 9 = GPIO 0)
+static uint8_t s_visit_col[NUM_COLS];
+
+static void matrix_scan_pio_init(void)
+{
+  // Precompute PIO visit order -> matrix column
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    s_visit_col[(NUM_COLS - 1) - (col_pins[col] - GPIO_COL_BASE)] = (uint8_t) col;
+  }
+
+  s_offset = pio_add_program(s_pio, &matrix_scan_program);
+  s_sm = (uint) pio_claim_unused_sm(s_pio, true);
+
+  float clkdiv = (float) clock_get_hz(clk_sys) / MATRIX_PIO_TICK_HZ;
+  matrix_scan_program_init(s_pio, s_sm, s_offset, GPIO_COL_BASE, GPIO_ROW_BASE, clkdiv);
+
+  // Two channels ping-pong between the frame slots by chaining to each other
+  s_dma_chan[0] = dma_claim_unused_channel(true);
+  s_dma_chan[1] = dma_claim_unused_channel(true);
+
+  for (uint i = 0; i < 2; ++i) {
+    dma_channel_config c = dma_channel_get_default_config((uint) s_dma_chan[i]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 3); // wrap write address every 8 bytes
+    channel_config_set_dreq(&c, pio_get_dreq(s_pio, s_sm, false));
+    channel_config_set_chain_to(&c, (uint) s_dma_chan[i ^ 1]);
+
+    dma_channel_configure((uint) s_dma_chan[i], &c,
+                          s_frame_buf[i],
+                          &s_pio->rxf[s_sm],
+                          2,
+                          false);
+  }
+
+  dma_channel_start((uint) s_dma_chan[0]);
+}
+
+// @brief Convert a raw PIO frame into the key state bitmask
+static uint64_t matrix_scan_pio_frame_to_state(uint32_t const raw[2])
+{
+  uint64_t state = 0;
+
+  for (uint visit = 0; visit < NUM_COLS; ++visit) {
+    uint32_t word  = raw[visit / MATRIX_PIO_COLS_PER_WORD];
+    uint32_t shift = (MATRIX_PIO_COLS_PER_WORD - 1 - (visit % MATRIX_PIO_COLS_PER_WORD)) * NUM_ROWS;
+    // Rows are active low
+    uint32_t rows  = ~(word >> shift) & ROW_SAMPLE_MASK;
+
+    state |= s_row_spread[rows] << s_visit_col[visit];
+  }
+
+  return state;
+}
+
+// @brief Copy the most recently completed frame
+// The channel that is busy owns the slot being written, the other slot holds
+// the last complete frame. A frame takes ~88us, so the copy cannot be overtaken.
+static uint64_t matrix_scan_pio_read(void)
+{
+  uint32_t raw[2];
+  uint slot = dma_channel_is_busy((uint) s_dma_chan[0]) ? 1 : 0;
+
+  raw[0] = s_frame_buf[slot][0];
+  raw[1] = s_frame_buf[slot][1];
+
+  return matrix_scan_pio_frame_to_state(raw);
+}
+
+// @brief Stop the state machine and both DMA channels, columns low
+static void matrix_scan_pio_park(void)
+{
+  pio_sm_set_enabled(s_pio, s_sm, false);
+
+  // Abort both at once, so the chain cannot restart the other channel
+  dma_hw->abort = (1u << s_dma_chan[0]) | (1u << s_dma_chan[1]);
+  while (dma_hw->abort) tight_loop_contents();
+
+  pio_sm_set_pins_with_mask(s_pio, s_sm, 0, COL_GPIO_MASK);
+}
+
+// @brief Restart the frame from column 9 into slot 0, wait until it is complete
+static void matrix_scan_pio_unpark(void)
+{
+  pio_sm_set_pins_with_mask(s_pio, s_sm, COL_GPIO_MASK, COL_GPIO_MASK);
+  pio_sm_clear_fifos(s_pio, s_sm);
+  pio_sm_restart(s_pio, s_sm);
+  pio_sm_exec(s_pio, s_sm, pio_encode_jmp(s_offset));
+
+  for (uint i = 0; i < 2; ++i) {
+    dma_channel_set_write_addr((uint) s_dma_chan[i], s_frame_buf[i], false);
+    dma_channel_set_trans_count((uint) s_dma_chan[i], 2, false);
+  }
+  dma_channel_start((uint) s_dma_chan[0]);
+  pio_sm_set_enabled(s_pio, s_sm, true);
+
+  // Slot 0 holds a frame taken after the wake once channel 0 is done (~88us)
+  while (dma_channel_is_busy((uint) s_dma_chan[0])) tight_loop_contents();
+}
+
+#endif // MATRIX_SCAN_USE_PIO
+
+//--------------------------------------------------------------------+
+// Settle calibration (CPU scan)
+//--------------------------------------------------------------------+
+
+// @brief Fixed delays on every column
+static void matrix_timing_reset(void)
+{
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    s_timing.settle_us[col]  = MATRIX_SETTLE_US;
+    s_timing.recover_us[col] = MATRIX_RECOVER_US;
+  }
+  s_timing.scan_us = NUM_COLS * (MATRIX_SETTLE_US + MATRIX_RECOVER_US);
+  s_recover_max_us = MATRIX_RECOVER_US;
+}
+
+#if !MATRIX_SCAN_USE_PIO && MATRIX_SCAN_CALIBRATE
+
+// Measured delay -> programmed delay
+#define CALIB_MARGIN(us)  ((us) + (us) / 2 + 1)
+
+// Sentinel for a line that did not settle within CALIB_MAX_US
+#define CALIB_NONE  0xff
+
+// Next line for matrix_scan_calibrate_step(), measurements not applied yet
+static uint     s_calib_line = 0;
+static uint16_t s_calib_failures = 0;
+static uint8_t  s_calib_col_fall[NUM_COLS];
+static uint8_t  s_calib_col_rise[NUM_COLS];
+static uint8_t  s_calib_row_rise[NUM_ROWS];
+
+// @brief Switch a line: a column is driven, a row swaps its pull-up for a pull-down
+static void calib_line_set(uint gpio, bool row, bool level)
+{
+  if (!row) {
+    gpio_put(gpio, level);
+  } else if (level) {
+    gpio_pull_up(gpio);
+  } else {
+    gpio_pull_down(gpio);
+  }
+}
+
+// @brief Time for a line to read `level` after it is switched there
+// The line starts from the other level, settled for CALIB_MAX_US each time.
+// @return delay in us, CALIB_NONE if it never read `level` in time
+static uint8_t calib_line_settle(uint gpio, bool row, bool level)
+{
+  for (uint delay = 0; delay <= CALIB_MAX_US; ++delay) {
+    uint n = 0;
+    for (; n < CALIB_SAMPLES; ++n) {
+      calib_line_set(gpio, row, !level);
+      sleep_us(CALIB_MAX_US);
+      calib_line_set(gpio, row, level);
+      sleep_us(delay);
+      if (gpio_get(gpio) != level) break;
+    }
+    if (n == CALIB_SAMPLES) return (uint8_t) delay;
+  }
+
+  // Left at `level`: a column high, a row back on its pull-up
+  return CALIB_NONE;
+}
+
+// @brief Idle probe, the rows a key pulled low are back high on return
+static bool calib_key_down(void)
+{
+  if (keyboard_switch_probe() == 0) return false;
+
+  // The scan may come next
+  sleep_us(s_recover_max_us);
+  return true;
+}
+
+// @brief Measure one line into the pending results
+// A closed switch ties a row to a column and hides its pull-up, so the line is
+// skipped if a key is down before or after the measurement.
+// @return false if skipped
+static bool calib_line_measure(uint line)
+{
+  if (calib_key_down()) return false;
+
+  uint8_t fall = 0, rise;
+  if (line < NUM_COLS) {
+    fall = calib_line_settle(col_pins[line], false, false);
+    rise = calib_line_settle(col_pins[line], false, true);
+  } else {
+    rise = calib_line_settle(row_pins[line - NUM_COLS], true, true);
+  }
+
+  sleep_us(CALIB_MAX_US);
+  if (calib_key_down()) return false;
+
+  if (line < NUM_COLS) {
+    s_calib_col_fall[line] = fall;
+    s_calib_col_rise[line] = rise;
+  } else {
+    s_calib_row_rise[line - NUM_COLS] = rise;
+  }
+  if (fall == CALIB_NONE || rise == CALIB_NONE) s_calib_failures++;
+
+  return true;
+}
+
+// @brief Program the delays from a complete set of measurements
+// Settle covers the column falling, recover covers the column and every row
+// rising (a pressed key holds its row low until the column is released).
+// A line that did not settle keeps the fixed delay for its column(s).
+static void calib_apply(void)
+{
+  uint8_t row_max = 0;
+  for (uint row = 0; row < NUM_ROWS; ++row) {
+    s_timing.row_rise_us[row] = s_calib_row_rise[row];
+    if (s_calib_row_rise[row] > row_max) row_max = s_calib_row_rise[row];
+  }
+
+  uint32_t scan_us = 0;
+  uint32_t recover_max = 0;
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    uint8_t fall = s_calib_col_fall[col];
+    uint8_t rise = (s_calib_col_rise[col] > row_max) ? s_calib_col_rise[col] : row_max;
+
+    s_timing.col_fall_us[col] = fall;
+    s_timing.col_rise_us[col] = s_calib_col_rise[col];
+    s_timing.settle_us[col]   = (fall == CALIB_NONE) ? MATRIX_SETTLE_US  : (uint8_t) CALIB_MARGIN(fall);
+    s_timing.recover_us[col]  = (rise == CALIB_NONE) ? MATRIX_RECOVER_US : (uint8_t) CALIB_MARGIN(rise);
+
+    scan_us += s_timing.settle_us[col] + s_timing.recover_us[col];
+    if (s_timing.recover_us[col] > recover_max) recover_max = s_timing.recover_us[col];
+  }
+
+  s_timing.scan_us = (uint16_t) scan_us;
+  s_timing.failures += s_calib_failures;
+  s_timing.runs++;
+  s_recover_max_us = recover_max;
+
+  s_calib_failures = 0;
+}
+
+#endif // !MATRIX_SCAN_USE_PIO && MATRIX_SCAN_CALIBRATE
+
+bool matrix_scan_calibrate(void)
+{
+#if !MATRIX_SCAN_USE_PIO && MATRIX_SCAN_CALIBRATE
+  s_calib_failures = 0;
+  for (uint line = 0; line < CALIB_LINES; ++line) {
+    if (!calib_line_measure(line)) {
+      s_calib_line = 0;
+      s_calib_failures = 0;
+      return false;
+    }
+  }
+
+  calib_apply();
+  s_calib_line = 0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool matrix_scan_calibrate_step(void)
+{
+#if !MATRIX_SCAN_USE_PIO && MATRIX_SCAN_CALIBRATE
+  if (!calib_line_measure(s_calib_line)) return false;
+
+  if (++s_calib_line == CALIB_LINES) {
+    calib_apply();
+    s_calib_line = 0;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+matrix_timing_t const* matrix_scan_timing(void)
+{
+  return &s_timing;
+}
+
+//--------------------------------------------------------------------+
+// Matrix scanner API
+//--------------------------------------------------------------------+
+
+void matrix_scan_init(void)
+{
+  matrix_scan_tables_init();
+  matrix_timing_reset();
+
+  // init input pins (rows - pull-up, read low when key pressed)
+  for (size_t i = 0; i < NUM_ROWS; ++i) {
+    gpio_init(row_pins[i]);
+    gpio_set_dir(row_pins[i], GPIO_IN);
+    gpio_pull_up(row_pins[i]);
+  }
+
+#if MATRIX_SCAN_USE_PIO
+  // Slots start as "no key pressed" (rows idle high) until the first frame lands
+  for (uint i = 0; i < 2; ++i) {
+    s_frame_buf[i][0] = s_frame_buf[i][1] = 0x3fffffffu;
+  }
+  matrix_scan_pio_init();
+#else
+  // init output pins (columns - active low scan)
+  for (size_t i = 0; i < NUM_COLS; ++i) {
+    gpio_init(col_pins[i]);
+    gpio_set_dir(col_pins[i], GPIO_OUT);
+    gpio_put(col_pins[i], 1);  // Default high (inactive)
+  }
+
+  // Falls back to the fixed delays if a key is held at boot
+  matrix_scan_calibrate();
+#endif
+}
+
+void matrix_scan_read(uint64_t* key_state)
+{
+#if MATRIX_SCAN_USE_PIO
+  *key_state = matrix_scan_pio_read();
+#else
+
+#if MATRIX_SCAN_IDLE_PROBE
+  // No key down (the usual case): one sample instead of NUM_COLS strobes
+  uint32_t rows = keyboard_switch_probe();
+  if (rows == 0) {
+    *key_state = 0;
+    return;
+  }
+
+  // Rows held low by the probe recover before the first column is sampled
+  sleep_us(s_recover_max_us);
+#endif
+
+#if MATRIX_SCAN_WORD_PARALLEL
+  keyboard_switch_read_parallel(key_state);
+#else
+  keyboard_switch_read(key_state);
+#endif
+
+#if MATRIX_SCAN_IDLE_PROBE
+  // Whole rows: the column 0 bit of each active row spread over every column
+  *key_state &= s_row_spread[rows] * ((1u << NUM_COLS) - 1);
+#endif
+
+#endif
+}
+
+void matrix_scan_park(void)
+{
+#if MATRIX_SCAN_USE_PIO
+  matrix_scan_pio_park();
+#else
+  gpio_put_masked(COL_GPIO_MASK, 0);
+#endif
+  sleep_us(PROBE_SETTLE_US);
+}
+
+uint32_t matrix_scan_parked_rows(void)
+{
+  // Rows are active low
+  return ~(gpio_get_all() >> GPIO_ROW_BASE) & ROW_SAMPLE_MASK;
+}
+
+void matrix_scan_unpark(void)
+{
+#if MATRIX_SCAN_USE_PIO
+  matrix_scan_pio_unpark();
+#else
+  gpio_put_masked(COL_GPIO_MASK, COL_GPIO_MASK);
+  sleep_us(s_recover_max_us);
+#endif
+}
+
+uint32_t keyboard_switch_probe(void)
+{
+  // Every column low
+  gpio_put_masked(COL_GPIO_MASK, 0);
+  sleep_us(PROBE_SETTLE_US);
+
+  // Rows are active low
+  uint32_t rows = ~(gpio_get_all() >> GPIO_ROW_BASE) & ROW_SAMPLE_MASK;
+
+  // All columns back to high (inactive)
+  gpio_put_masked(COL_GPIO_MASK, COL_GPIO_MASK);
+
+  return rows;
+}
+
+// @brief keyboard switch read function
+// Scan the keyboard matrix and return the key states as a bitmask
+// @param key_state Pointer to uint64_t to store the scan results (bit per key)
+void keyboard_switch_read(uint64_t* key_state)
+{
+  *key_state = 0;
+
+  // Scan each column (output)
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    // Set current column low (active)
+    gpio_put(col_pins[col], 0);
+
+    // Delay to allow signal to stabilize
+    sleep_us(s_timing.settle_us[col]);
+
+    // Read all rows (input)
+    for (uint row = 0; row < NUM_ROWS; ++row) {
+      // If row is low, key is pressed (active low with pull-up)
+      if (gpio_get(row_pins[row]) == 0) {
+        // Calculate bit position for this key
+        uint32_t bit_pos = row * NUM_COLS + col;
+        *key_state |= (1ULL << bit_pos);
+      }
+    }
+
+    // Set column back to high (inactive)
+    gpio_put(col_pins[col], 1);
+
+    // Small delay before next column
+    sleep_us(s_timing.recover_us[col]);
+  }
+}
+
+// @brief Word-parallel keyboard switch read function
+// Same timing as keyboard_switch_read(), but each column is strobed with one
+// masked write and all rows are captured with one gpio_get_all().
+// @param key_state Pointer to uint64_t to store the scan results (bit per key)
+void keyboard_switch_read_parallel(uint64_t* key_state)
+{
+  uint64_t state = 0;
+
+  for (uint col = 0; col < NUM_COLS; ++col) {
+    // Current column low, all others high
+    gpio_put_masked(COL_GPIO_MASK, s_col_strobe[col]);
+
+    // Delay to allow signal to stabilize
+    sleep_us(s_timing.settle_us[col]);
+
+    // Rows are active low
+    uint32_t rows = ~(gpio_get_all() >> GPIO_ROW_BASE) & ROW_SAMPLE_MASK;
+    state |= s_row_spread[rows] << col;
+
+    // All columns back to high (inactive)
+    gpio_put_masked(COL_GPIO_MASK, COL_GPIO_MASK);
+
+    // Small delay before next column
+    sleep_us(s_timing.recover_us[col]);
+  }
+
+  *key_state = state;
+}
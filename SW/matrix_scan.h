@@ -0,0 +1,132 @@
+// Keyboard matrix scanner
+// 6 rows x 10 columns, columns driven low one at a time, rows pulled up (active low).
+// Key state bit position = row * NUM_COLS + col
+
+#ifndef MATRIX_SCAN_H_
+#define MATRIX_SCAN_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+// Matrix dimensions
+#define NUM_ROWS 6
+#define NUM_COLS 10
+#define NUM_KEYS 50
+
+// GPIO pin for keyboard as matrix circuit
+#define GPIO_ROW_0 (21)
+#define GPIO_ROW_1 (20)
+#define GPIO_ROW_2 (19)
+#define GPIO_ROW_3 (18)
+#define GPIO_ROW_4 (17)
+#define GPIO_ROW_5 (16)
+
+#define GPIO_COL_0 (4)
+#define GPIO_COL_1 (5)
+#define GPIO_COL_2 (6)
+#define GPIO_COL_3 (7)
+#define GPIO_COL_4 (8)
+#define GPIO_COL_5 (9)
+#define GPIO_COL_6 (3)
+#define GPIO_COL_7 (2)
+#define GPIO_COL_8 (1)
+#define GPIO_COL_9 (0)
+
+// Rows and columns each occupy a contiguous GPIO range
+#define GPIO_ROW_BASE  (16)
+#define GPIO_COL_BASE  (0)
+
+// Scanner selection (set from CMake, see MATRIX_SCAN_USE_PIO option)
+// 1: PIO state machine + DMA scans continuously, CPU only picks up finished frames
+// 0: software scan with keyboard_switch_read()
+#ifndef MATRIX_SCAN_USE_PIO
+#define MATRIX_SCAN_USE_PIO 0
+#endif
+
+// CPU scan flavour when PIO is not used (see MATRIX_SCAN_WORD_PARALLEL option)
+// 1: keyboard_switch_read_parallel(), one masked write / one read per column
+// 0: keyboard_switch_read(), one gpio_put / gpio_get per pin
+#ifndef MATRIX_SCAN_WORD_PARALLEL
+#define MATRIX_SCAN_WORD_PARALLEL 1
+#endif
+
+// CPU scan idle probe (see MATRIX_SCAN_IDLE_PROBE option)
+// 1: drive every column low at once and sample the rows first; the column
+//    scan only runs when a row reads low, and only keeps the rows that did
+// 0: always scan every column
+#ifndef MATRIX_SCAN_IDLE_PROBE
+#define MATRIX_SCAN_IDLE_PROBE 1
+#endif
+
+// CPU scan settle calibration (see MATRIX_SCAN_CALIBRATE option)
+// 1: measure the line settle times at boot and again line by line while idle,
+//    scan with the smallest delays that cover them plus a margin
+// 0: fixed MATRIX_SETTLE_US / MATRIX_RECOVER_US on every column
+#ifndef MATRIX_SCAN_CALIBRATE
+#define MATRIX_SCAN_CALIBRATE 1
+#endif
+
+// Fixed column delays (us), also kept when a line does not settle in time
+#define MATRIX_SETTLE_US   10   // column low -> rows sampled
+#define MATRIX_RECOVER_US  5    // column high -> next column low
+
+typedef struct
+{
+  uint8_t  settle_us[NUM_COLS];    // programmed: column low -> rows sampled
+  uint8_t  recover_us[NUM_COLS];   // programmed: column high -> next column
+  uint8_t  col_fall_us[NUM_COLS];  // measured: column pad reads low after the strobe
+  uint8_t  col_rise_us[NUM_COLS];  // measured: column pad reads high after the release
+  uint8_t  row_rise_us[NUM_ROWS];  // measured: row back high through its pull-up
+  uint16_t scan_us;                // sum of the programmed delays, one column scan
+  uint16_t runs;                   // complete calibrations applied
+  uint16_t failures;               // lines that did not settle within the limit
+} matrix_timing_t;
+
+extern const uint row_pins[NUM_ROWS];
+extern const uint col_pins[NUM_COLS];
+
+// @brief Initialize matrix GPIOs and start the selected scanner
+void matrix_scan_init(void);
+
+// @brief Get the latest complete matrix frame from the selected scanner
+// @param key_state Pointer to uint64_t to store the scan results (bit per key)
+void matrix_scan_read(uint64_t* key_state);
+
+// @brief Stop scanning and drive every column low (USB suspend, see power.h)
+// A closed switch then pulls its row low, so row edges can wake the CPU.
+void matrix_scan_park(void);
+
+// @brief Rows pulled low while parked
+// @return row sample bits (bit n = GPIO (GPIO_ROW_BASE + n)), 0 if no key is down
+uint32_t matrix_scan_parked_rows(void);
+
+// @brief Release the columns and restart scanning after matrix_scan_park()
+// Returns once matrix_scan_read() has a fresh frame.
+void matrix_scan_unpark(void);
+
+// @brief Measure every line and program the column delays (boot, blocking)
+// Does nothing if a key is down or with the PIO scanner.
+// @return true if the measured delays are in use
+bool matrix_scan_calibrate(void);
+
+// @brief Measure the next line, program the delays once all lines are done
+// Keeps each call short enough to run between scans (re-check for drift).
+// @return false if it skipped the line because a key is down
+bool matrix_scan_calibrate_step(void);
+
+// @brief Programmed and measured settle times
+matrix_timing_t const* matrix_scan_timing(void);
+
+// @brief Software matrix scan (one column at a time, blocking)
+// @param key_state Pointer to uint64_t to store the scan results (bit per key)
+void keyboard_switch_read(uint64_t* key_state);
+
+// @brief Rows with a closed switch on any column, one sample with every column low
+// @return row sample bits (bit n = GPIO (GPIO_ROW_BASE + n)), 0 if no key is down
+uint32_t keyboard_switch_probe(void);
+
+// @brief Word-parallel software matrix scan (gpio_put_masked / gpio_get_all)
+// @param key_state Pointer to uint64_t to store the scan results (bit per key)
+void keyboard_switch_read_parallel(uint64_t* key_state);
+
+#endif /* MATRIX_SCAN_H_ */
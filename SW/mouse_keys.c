@@ -0,0 +1,191 @@
+// Mouse keys, see mouse_keys.h
+
+#include "tusb.h"
+
+#include "key_iter.h"
+#include "keymap.h"
+#include "action.h"
+#include "mouse_keys.h"
+
+// Fixed point: 1/65536 px (or wheel detent), the truncation of one step is
+// lost for good, so it has to stay far below a pixel over thousands of steps
+#define MOUSE_ONE   65536
+
+// Accumulated motion kept while reports are not taken, at most two full reports
+#define MOUSE_ACC_MAX  (2 * INT8_MAX * MOUSE_ONE)
+
+#define MOUSE_CODE(code)  (1u << (code))
+#define MOUSE_CURSOR_CODES  (MOUSE_CODE(MOUSE_KEY_UP) | MOUSE_CODE(MOUSE_KEY_DOWN) | \
+                             MOUSE_CODE(MOUSE_KEY_LEFT) | MOUSE_CODE(MOUSE_KEY_RIGHT))
+#define MOUSE_WHEEL_CODES   (MOUSE_CODE(MOUSE_KEY_WHEEL_UP) | MOUSE_CODE(MOUSE_KEY_WHEEL_DOWN) | \
+                             MOUSE_CODE(MOUSE_KEY_WHEEL_LEFT) | MOUSE_CODE(MOUSE_KEY_WHEEL_RIGHT))
+#define MOUSE_MOTION_CODES  (MOUSE_CURSOR_CODES | MOUSE_WHEEL_CODES)
+
+enum
+{
+  AXIS_X = 0,
+  AXIS_Y,
+  AXIS_WHEEL,
+  AXIS_PAN,
+  AXIS_COUNT
+};
+
+// Key codes (negative, positive) of each axis, in HID directions
+// (y grows downwards, the wheel upwards, pan to the right)
+static uint8_t const s_axis_codes[AXIS_COUNT][2] = {
+  [AXIS_X]     = { MOUSE_KEY_LEFT,       MOUSE_KEY_RIGHT },
+  [AXIS_Y]     = { MOUSE_KEY_UP,         MOUSE_KEY_DOWN },
+  [AXIS_WHEEL] = { MOUSE_KEY_WHEEL_DOWN, MOUSE_KEY_WHEEL_UP },
+  [AXIS_PAN]   = { MOUSE_KEY_WHEEL_LEFT, MOUSE_KEY_WHEEL_RIGHT },
+};
+
+static mouse_keys_send_t s_send;
+
+static uint16_t s_codes;             // mouse_key_t bits held at the last step
+static uint8_t  s_buttons;           // buttons of the last report taken
+static uint32_t s_step_us;           // last step
+static uint32_t s_cursor_start_us;   // first cursor key of the current motion went down
+static int32_t  s_acc[AXIS_COUNT];   // motion not reported yet (1/MOUSE_ONE)
+static int8_t   s_dir[AXIS_COUNT];   // direction at the last step
+
+static mouse_keys_stats_t s_stats;
+
+void mouse_keys_init(mouse_keys_send_t send)
+{
+  s_send = send;
+  s_codes = 0;
+  s_buttons = 0;
+  s_step_us = 0;
+  s_cursor_start_us = 0;
+  for (uint axis = 0; axis < AXIS_COUNT; ++axis) {
+    s_acc[axis] = 0;
+    s_dir[axis] = 0;
+  }
+  s_stats = (mouse_keys_stats_t) { 0 };
+}
+
+bool mouse_keys_moving(void)
+{
+  return (s_codes & MOUSE_MOTION_CODES) != 0;
+}
+
+mouse_keys_stats_t const* mouse_keys_stats(void)
+{
+  return &s_stats;
+}
+
+// @brief mouse_key_t bits of the held mouse keys (usually 1 - 3 of them)
+static uint16_t held_codes(void)
+{
+  uint16_t codes = 0;
+
+  for (uint word = 0; word < KEY_WORDS; ++word) {
+    uint64_t keys = action_mouse_keys(word);
+    uint key;
+    while (key_iter_next(&keys, &key)) {
+      uint8_t code = action_held(64 * word + key).code;
+      if (code < MOUSE_KEY_COUNT) codes |= (uint16_t) MOUSE_CODE(code);
+    }
+  }
+  return codes;
+}
+
+// @brief Cursor speed (px/s) after held_us on the acceleration curve
+static uint32_t cursor_speed(uint32_t held_us)
+{
+  uint32_t min = keymap_setting(KEYMAP_SETTING_MOUSE_SPEED_MIN);
+  uint32_t max = keymap_setting(KEYMAP_SETTING_MOUSE_SPEED_MAX);
+  uint32_t accel_us = keymap_setting(KEYMAP_SETTING_MOUSE_ACCEL_US);
+  uint32_t curve = keymap_setting(KEYMAP_SETTING_MOUSE_CURVE);
+
+  if (max <= min) return min;
+  if (held_us >= accel_us) return max;
+
+  // (t / accel)^curve in Q16
+  uint32_t f = (uint32_t) (((uint64_t) held_us << 16) / accel_us);
+  uint32_t g = f;
+  for (uint32_t i = 1; i < curve; ++i) {
+    g = (uint32_t) (((uint64_t) g * f) >> 16);
+  }
+  return min + (uint32_t) (((uint64_t) (max - min) * g) >> 16);
+}
+
+// @brief Distance (1/MOUSE_ONE) covered in step_us at speed units/s
+static int32_t step_distance(uint32_t speed, uint32_t step_us)
+{
+  return (int32_t) (((uint64_t) speed * step_us * MOUSE_ONE) / 1000000);
+}
+
+// @brief Whole units of an accumulator for the report, clamped to a report field
+static int8_t take_units(int32_t acc)
+{
+  int32_t units = acc / MOUSE_ONE;   // toward zero, the fraction stays behind
+  if (units > INT8_MAX) units = INT8_MAX;
+  if (units < -INT8_MAX) units = -INT8_MAX;
+  return (int8_t) units;
+}
+
+void mouse_keys_task(uint32_t now_us)
+{
+  uint16_t codes = held_codes();
+  uint8_t buttons = (uint8_t) ((codes >> MOUSE_KEY_BUTTON1) & 0x1f);
+  uint32_t step_us = now_us - s_step_us;
+
+  // Key changes (or buttons the last send() did not take) step at once
+  bool changed = (codes != s_codes || buttons != s_buttons);
+  if (!changed && !((codes & MOUSE_MOTION_CODES) && step_us >= MOUSE_KEYS_STEP_US)) return;
+
+  // A press that starts the motion only nudges by one unit, nothing to integrate yet
+  if (!(s_codes & MOUSE_MOTION_CODES)) step_us = 0;
+  if (step_us > MOUSE_KEYS_STEP_MAX_US) step_us = MOUSE_KEYS_STEP_MAX_US;
+  if ((codes & MOUSE_CURSOR_CODES) && !(s_codes & MOUSE_CURSOR_CODES)) s_cursor_start_us = now_us;
+
+  int8_t dir[AXIS_COUNT];
+  for (uint axis = 0; axis < AXIS_COUNT; ++axis) {
+    dir[axis] = (int8_t) (((codes >> s_axis_codes[axis][1]) & 1) - ((codes >> s_axis_codes[axis][0]) & 1));
+  }
+
+  // Diagonals at the same speed as straight lines: 46341 / 65536 = 1 / sqrt(2)
+  int32_t cursor = step_distance(cursor_speed(now_us - s_cursor_start_us), step_us);
+  if (dir[AXIS_X] && dir[AXIS_Y]) cursor = (int32_t) (((int64_t) cursor * 46341) >> 16);
+  int32_t wheel = step_distance(keymap_setting(KEYMAP_SETTING_MOUSE_WHEEL_SPEED), step_us);
+
+  for (uint axis = 0; axis < AXIS_COUNT; ++axis) {
+    if (dir[axis] == 0) {
+      s_acc[axis] = 0;
+    } else {
+      // A new direction moves one whole unit at once
+      if (dir[axis] != s_dir[axis]) s_acc[axis] = dir[axis] * MOUSE_ONE;
+      s_acc[axis] += dir[axis] * ((axis < AXIS_WHEEL) ? cursor : wheel);
+      if (s_acc[axis] > MOUSE_ACC_MAX) s_acc[axis] = MOUSE_ACC_MAX;
+      if (s_acc[axis] < -MOUSE_ACC_MAX) s_acc[axis] = -MOUSE_ACC_MAX;
+    }
+    s_dir[axis] = dir[axis];
+  }
+
+  s_codes = codes;
+  s_step_us = now_us;
+  if (step_us > s_stats.max_step_us) s_stats.max_step_us = step_us;
+
+  hid_mouse_report_t report = {
+    .buttons = buttons,
+    .x       = take_units(s_acc[AXIS_X]),
+    .y       = take_units(s_acc[AXIS_Y]),
+    .wheel   = take_units(s_acc[AXIS_WHEEL]),
+    .pan     = take_units(s_acc[AXIS_PAN]),
+  };
+
+  // Relative motion goes out every step it moves, the buttons only on change
+  if (report.buttons == s_buttons && report.x == 0 && report.y == 0 && report.wheel == 0 && report.pan == 0) return;
+
+  if (!s_send(&report)) {
+    s_stats.busy++;
+    return;
+  }
+  s_acc[AXIS_X]     -= report.x * MOUSE_ONE;
+  s_acc[AXIS_Y]     -= report.y * MOUSE_ONE;
+  s_acc[AXIS_WHEEL] -= report.wheel * MOUSE_ONE;
+  s_acc[AXIS_PAN]   -= report.pan * MOUSE_ONE;
+  s_buttons = report.buttons;
+  s_stats.steps++;
+}
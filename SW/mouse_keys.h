@@ -0,0 +1,82 @@
+// Mouse keys (core0)
+// KEY_ACTION_MOUSE keys move the cursor, turn the wheel and hold the buttons
+// of the mouse collection on the aux interface (REPORT_ID_MOUSE).
+//
+// Motion is integrated in fixed point (1/65536 px or wheel detent) over the
+// real time between steps, and keyboard.c steps the engine once per USB frame
+// while the aux endpoint is free, so the cursor moves a little every 1ms poll
+// instead of jumping at a coarse repeat rate. The speed follows an
+// acceleration curve from the time the first movement key went down:
+//
+//   speed = min + (max - min) * (t / accel)^curve      (t < accel, else max)
+//
+// with min / max / accel / curve and the wheel rate taken from the keymap
+// settings (KEYMAP_SETTING_MOUSE_*), so they can be changed over raw HID and
+// are saved with the keymap. The first step of a new direction moves one
+// whole pixel (one detent) at once, so a tap nudges the cursor by exactly one.
+// Two movement axes together are scaled by 1/sqrt(2) to keep the speed.
+//
+// A report is only sent when the buttons change or something moves.
+
+#ifndef MOUSE_KEYS_H_
+#define MOUSE_KEYS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "tusb.h"
+
+// Defaults of the KEYMAP_SETTING_MOUSE_* settings
+#ifndef MOUSE_KEYS_SPEED_MIN
+#define MOUSE_KEYS_SPEED_MIN    100     // px/s when a movement key goes down
+#endif
+#ifndef MOUSE_KEYS_SPEED_MAX
+#define MOUSE_KEYS_SPEED_MAX    1600    // px/s after MOUSE_KEYS_ACCEL_US
+#endif
+#ifndef MOUSE_KEYS_ACCEL_US
+#define MOUSE_KEYS_ACCEL_US     800000  // min -> max speed
+#endif
+#ifndef MOUSE_KEYS_CURVE
+#define MOUSE_KEYS_CURVE        2       // exponent, 1 = linear .. MOUSE_KEYS_CURVE_MAX
+#endif
+#ifndef MOUSE_KEYS_WHEEL_SPEED
+#define MOUSE_KEYS_WHEEL_SPEED  20      // detents/s
+#endif
+
+#define MOUSE_KEYS_CURVE_MAX    4
+
+// Fastest setting: one full report (127 px) per 1ms frame
+#define MOUSE_KEYS_SPEED_LIMIT  127000
+
+// Steps while moving: one per 1ms USB frame, a report stage released a
+// little early (sof_sync.h) still counts
+#define MOUSE_KEYS_STEP_US      900
+
+// Longest time integrated in one step, e.g. after the endpoint was busy
+#define MOUSE_KEYS_STEP_MAX_US  20000
+
+// Queues a mouse report on the aux interface
+// @return false if it was not taken, the motion is kept for the next step
+typedef bool (*mouse_keys_send_t)(hid_mouse_report_t const* report);
+
+typedef struct
+{
+  uint32_t steps;         // steps that sent a report
+  uint32_t busy;          // reports not taken by send()
+  uint32_t max_step_us;   // longest time integrated in one step
+} mouse_keys_stats_t;
+
+// @brief Reset, reports go to send
+void mouse_keys_init(mouse_keys_send_t send);
+
+// @brief Integrate the motion since the last step and send a report if anything changed
+// Call from the report stage while the aux endpoint is free. Steps every
+// MOUSE_KEYS_STEP_US while moving, and at once when the mouse keys change.
+void mouse_keys_task(uint32_t now_us);
+
+// @brief A movement or wheel key is held (reports keep coming)
+bool mouse_keys_moving(void);
+
+mouse_keys_stats_t const* mouse_keys_stats(void);
+
+#endif /* MOUSE_KEYS_H_ */
@@ -0,0 +1,246 @@
+// Power manager, see power.h
+// core0 writes s_suspended / s_remote_wakeup_en, core1 writes s_wake_request
+// and s_wake_edge_us. Every flag change that the other core may be sleeping
+// on is followed by __sev().
+
+#include "tusb.h"
+
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/scb.h"
+
+#include "matrix_scan.h"
+#include "split_link.h"
+#include "keyboard.h"
+#include "power.h"
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF PROTYPES
+//--------------------------------------------------------------------+
+
+// Bus state (core0)
+static volatile bool s_suspended = false;
+static volatile bool s_remote_wakeup_en = false;
+
+// Remote wakeup asked by core1, done by core0
+static volatile bool     s_wake_request = false;
+static volatile uint32_t s_wake_edge_us = 0;
+
+// Suspend sleep (core1), s_edge is set by the row edge IRQ
+static bool     s_parked = false;
+static bool     s_armed = false;
+static uint32_t s_sleep_start_us = 0;
+static volatile bool s_edge = false;
+
+// Scan rate (core1)
+static bool     s_keys_down = false;
+static bool     s_slow = false;
+static uint32_t s_active_us = 0;   // last scan with a key down
+
+static power_stats_t s_stats;
+
+// Clocks left running while suspended and both cores sleep: the USB
+// controller and its PLL (resume, reset), IO bank 0 (row edge IRQs), the
+// timer with its watchdog tick, and the bus, clock and reset blocks under
+// them. PIO, DMA, UART, SRAM, XIP and the rest stop until a core wakes.
+#define POWER_SLEEP_EN0  (CLOCKS_SLEEP_EN0_CLK_SYS_CLOCKS_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_BUSCTRL_BITS | \
+                          CLOCKS_SLEEP_EN0_CLK_SYS_BUSFABRIC_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_IO_BITS | \
+                          CLOCKS_SLEEP_EN0_CLK_SYS_VREG_AND_CHIP_RESET_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_PADS_BITS | \
+                          CLOCKS_SLEEP_EN0_CLK_SYS_PLL_SYS_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_PLL_USB_BITS)
+#define POWER_SLEEP_EN1  (CLOCKS_SLEEP_EN1_CLK_SYS_TIMER_BITS | CLOCKS_SLEEP_EN1_CLK_SYS_USBCTRL_BITS | \
+                          CLOCKS_SLEEP_EN1_CLK_USB_USBCTRL_BITS | CLOCKS_SLEEP_EN1_CLK_SYS_WATCHDOG_BITS | \
+                          CLOCKS_SLEEP_EN1_CLK_SYS_XOSC_BITS)
+
+void power_init(void)
+{
+  s_suspended = false;
+  s_remote_wakeup_en = false;
+  s_wake_request = false;
+  s_parked = false;
+  s_edge = false;
+
+  s_keys_down = false;
+  s_slow = false;
+  s_active_us = time_us_32();
+
+  s_stats = (power_stats_t) { 0 };
+}
+
+power_stats_t const* power_stats(void)
+{
+  return &s_stats;
+}
+
+//--------------------------------------------------------------------+
+// USB bus (core0)
+//--------------------------------------------------------------------+
+
+// The sleep enables apply once both cores sleep with SLEEPDEEP set (each
+// core sets its own: core0 here, core1 while parked); waking either core
+// brings every clock back
+void power_suspend(bool remote_wakeup_en)
+{
+  s_remote_wakeup_en = remote_wakeup_en;
+  s_wake_request = false;
+  s_suspended = true;
+  s_stats.suspends++;
+
+  clocks_hw->sleep_en0 = POWER_SLEEP_EN0;
+  clocks_hw->sleep_en1 = POWER_SLEEP_EN1;
+  scb_hw->scr |= M0PLUS_SCR_SLEEPDEEP_BITS;
+}
+
+void power_resume(void)
+{
+  scb_hw->scr &= ~M0PLUS_SCR_SLEEPDEEP_BITS;
+  clocks_hw->sleep_en0 = CLOCKS_SLEEP_EN0_BITS;
+  clocks_hw->sleep_en1 = CLOCKS_SLEEP_EN1_BITS;
+
+  s_suspended = false;
+  __sev();
+}
+
+void power_task(void)
+{
+  if (!s_suspended) return;
+
+  if (s_wake_request) {
+    s_wake_request = false;
+
+    uint32_t latency = time_us_32() - s_wake_edge_us;
+    s_stats.wake_latency_last_us = latency;
+    if (latency > s_stats.wake_latency_max_us) s_stats.wake_latency_max_us = latency;
+
+    tud_remote_wakeup();
+    s_stats.remote_wakeups++;
+    return;
+  }
+
+  // Woken by the USB interrupt (resume) or by core1 (remote wakeup request)
+  __wfe();
+}
+
+//--------------------------------------------------------------------+
+// Scan rate (core1)
+//--------------------------------------------------------------------+
+
+void power_scan_sample(bool keys_down, uint32_t now_us)
+{
+  if (keys_down) {
+    // First key down while suspended but not parked (a key was held at suspend)
+    if (!s_keys_down && s_suspended && s_remote_wakeup_en && !s_wake_request) {
+      s_wake_edge_us = now_us;
+      s_wake_request = true;
+      __sev();
+    }
+    s_active_us = now_us;
+    s_slow = false;
+  } else if (!s_slow && (now_us - s_active_us) >= SCAN_SLOW_AFTER_US) {
+    s_slow = true;
+  }
+
+  if (s_slow) s_stats.slow_scan_us += SCAN_SLOW_PERIOD_US;
+
+  s_keys_down = keys_down;
+}
+
+uint32_t power_scan_period(void)
+{
+  return s_slow ? SCAN_SLOW_PERIOD_US : SCAN_PERIOD_US;
+}
+
+bool power_scan_rate_update(sched_stage_t* scan, sched_stage_t* debounce)
+{
+  uint32_t scan_us     = power_scan_period();
+  uint32_t debounce_us = s_slow ? SCAN_SLOW_PERIOD_US : DEBOUNCE_PERIOD_US;
+
+  if (scan->period_us == scan_us && debounce->period_us == debounce_us) return false;
+
+  scheduler_set_period(scan, scan_us);
+  scheduler_set_period(debounce, debounce_us);
+  return true;
+}
+
+void power_core1_wait(uint64_t until_us)
+{
+  if (s_slow) {
+    sleep_until(from_us_since_boot(until_us));
+  } else {
+    busy_wait_until(from_us_since_boot(until_us));
+  }
+}
+
+//--------------------------------------------------------------------+
+// Suspend sleep (core1)
+//--------------------------------------------------------------------+
+
+// @brief Row edge IRQ (core1), one wake per sleep
+static void row_edge_callback(uint gpio, uint32_t events)
+{
+  (void) gpio;
+  (void) events;
+
+  if (!s_edge) {
+    s_wake_edge_us = time_us_32();
+    s_edge = true;
+    s_stats.wakes++;
+  }
+}
+
+bool power_core1_sleep(sched_stage_t* stages, uint count)
+{
+  if (!s_parked) {
+    if (!s_suspended || s_keys_down) return false;
+#if SPLIT_LINK
+    if (split_link_up(keyboard_split_link())) return false;
+#endif
+
+    s_parked = true;
+    s_armed = s_remote_wakeup_en;
+    s_sleep_start_us = time_us_32();
+    s_stats.sleeps++;
+    s_edge = false;
+    matrix_scan_park();
+    scb_hw->scr |= M0PLUS_SCR_SLEEPDEEP_BITS;
+
+    // Without remote wakeup a key press cannot do anything, only a resume ends the sleep
+    if (s_armed) {
+      for (uint i = 0; i < NUM_ROWS; ++i) {
+        gpio_set_irq_enabled_with_callback(row_pins[i], GPIO_IRQ_EDGE_FALL, true, row_edge_callback);
+      }
+      // A press between the last scan and arming left its row low without an edge
+      if (matrix_scan_parked_rows() != 0) row_edge_callback(0, 0);
+    }
+  }
+
+  if (s_suspended && !s_edge) {
+    __wfe();
+    return true;
+  }
+
+  if (s_armed) {
+    for (uint i = 0; i < NUM_ROWS; ++i) {
+      gpio_set_irq_enabled(row_pins[i], GPIO_IRQ_EDGE_FALL, false);
+    }
+  }
+  // Like the eager debounce, the first contact edge counts: wake the host now
+  // instead of after a scan that may land in the bounce
+  if (s_edge) {
+    s_wake_request = true;
+    __sev();
+  }
+
+  scb_hw->scr &= ~M0PLUS_SCR_SLEEPDEEP_BITS;
+  matrix_scan_unpark();
+  s_parked = false;
+  s_stats.sleep_us += time_us_32() - s_sleep_start_us;
+
+  // Back to the full scan rate, the key that woke us is seen by the first scan
+  s_active_us = time_us_32();
+  s_slow = false;
+  scheduler_resume(stages, count);
+
+  return false;
+}
@@ -0,0 +1,75 @@
+// Power manager
+// - USB suspend: core1 parks the matrix (every column low), arms falling-edge
+//   IRQs on the row pins and sleeps (WFE); core0 sleeps between USB events.
+//   Both sleep with SLEEPDEEP, so while both are asleep only the clocks the
+//   USB controller, the row IRQs and the timer need keep running (SLEEP_EN0/1).
+//   A key pressed while suspended wakes core1, the first scan that sees it
+//   asks core0 for tud_remote_wakeup() (if the host enabled it).
+// - Adaptive scan rate: the scan stage slows to SCAN_SLOW_PERIOD_US after
+//   SCAN_SLOW_AFTER_US without a key down, and returns to SCAN_PERIOD_US on
+//   the first scan that sees one (keyboard.h).
+//
+// Flags cross cores: power_suspend() / power_resume() / power_task() run on
+// core0 (TinyUSB callbacks and main loop), the rest on core1.
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "scheduler.h"
+
+typedef struct
+{
+  uint32_t suspends;             // tud_suspend_cb() calls
+  uint32_t sleeps;               // times core1 parked the matrix and slept
+  uint32_t wakes;                // row edge IRQs that woke core1
+  uint32_t remote_wakeups;       // tud_remote_wakeup() calls
+  uint32_t wake_latency_max_us;  // row edge IRQ -> tud_remote_wakeup()
+  uint32_t wake_latency_last_us;
+  uint64_t sleep_us;             // core1 time asleep with the matrix parked
+  uint64_t slow_scan_us;         // time at SCAN_SLOW_PERIOD_US
+} power_stats_t;
+
+// @brief Reset the state, call before either core's stages run
+void power_init(void);
+
+// @brief USB bus suspended (core0, tud_suspend_cb)
+void power_suspend(bool remote_wakeup_en);
+
+// @brief USB bus resumed (core0, tud_resume_cb), wakes core1
+void power_resume(void);
+
+// @brief Core0 main loop hook: remote wakeup when requested, otherwise sleep
+// until the next interrupt or core1 event while suspended
+void power_task(void);
+
+// @brief Scan result hook (core1, scan_task)
+// @param keys_down true if the sample has any key down
+void power_scan_sample(bool keys_down, uint32_t now_us);
+
+// @brief Scan period (us) of the adaptive scan rate
+uint32_t power_scan_period(void);
+
+// @brief Apply the adaptive scan rate to the core1 stages
+// Slow: scan and debounce both at SCAN_SLOW_PERIOD_US, otherwise their own periods
+// @return true if a period changed, the caller recomputes its next release time
+bool power_scan_rate_update(sched_stage_t* scan, sched_stage_t* debounce);
+
+// @brief Wait for the next core1 release time
+// Busy-waits at the normal rate (exact release), sleeps on the timer while slow
+void power_core1_wait(uint64_t until_us);
+
+// @brief Suspend sleep step (core1 main loop, before its stages)
+// While suspended with no key down: park the matrix, arm the row edge IRQs
+// (only if remote wakeup is enabled) and sleep once per call. On a row edge or
+// a resume the matrix is released and the stages are released at once.
+// With SPLIT_LINK the matrix is not parked while the other half is connected:
+// its keys only come in through the scan stage.
+// @return true while parked, the caller skips its stages and calls again
+bool power_core1_sleep(sched_stage_t* stages, uint count);
+
+power_stats_t const* power_stats(void);
+
+#endif /* POWER_H_ */
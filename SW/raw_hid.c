@@ -0,0 +1,392 @@
+// Raw HID configuration protocol, see raw_hid.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "pico/time.h"
+
+#include "matrix_scan.h"
+#include "keymap.h"
+#include "tap_hold.h"
+#include "combo.h"
+#include "store.h"
+#include "key_event.h"
+#include "latency.h"
+#include "power.h"
+#include "sof_sync.h"
+#include "keyboard.h"
+#include "raw_hid.h"
+
+static raw_hid_send_t s_send;
+static uint8_t  s_reply[RAW_HID_SIZE];
+
+// Counter stream, 0 = off
+static uint32_t s_stream_interval_us;
+static uint32_t s_stream_next_us;
+
+//--------------------------------------------------------------------+
+// Encoding
+//--------------------------------------------------------------------+
+
+static uint16_t get_u16(uint8_t const* p)
+{
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(uint8_t const* p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_u16(uint8_t* p, uint16_t value)
+{
+  p[0] = (uint8_t) value;
+  p[1] = (uint8_t) (value >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t value)
+{
+  for (uint i = 0; i < 4; ++i) p[i] = (uint8_t) (value >> (8 * i));
+}
+
+static void put_combo(uint8_t* p, key_combo_t const* combo)
+{
+  for (uint i = 0; i < 8; ++i) p[i] = (uint8_t) (combo->keys >> (8 * i));
+  p[8] = combo->action.type;
+  p[9] = combo->action.code;
+}
+
+static key_combo_t get_combo(uint8_t const* p)
+{
+  uint64_t keys = 0;
+  for (uint i = 0; i < 8; ++i) keys |= (uint64_t) p[i] << (8 * i);
+  return (key_combo_t) { keys, { p[8], p[9] } };
+}
+
+//--------------------------------------------------------------------+
+// Commands, each fills reply[3..] and returns the status
+//--------------------------------------------------------------------+
+
+static uint8_t cmd_get_info(uint8_t* reply)
+{
+  reply[3] = RAW_HID_PROTOCOL_VERSION;
+  reply[4] = NUM_ROWS;
+  reply[5] = NUM_COLS;
+  reply[6] = keymap_num_layers();
+  reply[7] = (uint8_t) keymap_tap_hold_slots();
+  put_u16(&reply[8], (uint16_t) keymap_combo_slots());
+  reply[10] = (uint8_t) keymap_macro_count();
+  reply[11] = KEYMAP_SETTING_COUNT;
+  put_u32(&reply[12], keymap_signature());
+  put_u32(&reply[16], RAW_HID_CAP_COMBOS | RAW_HID_CAP_MACROS | RAW_HID_CAP_FLASH | RAW_HID_CAP_COUNTERS |
+                     (LATENCY_STATS ? RAW_HID_CAP_LATENCY : 0) |
+                     ((!MATRIX_SCAN_USE_PIO && MATRIX_SCAN_CALIBRATE) ? RAW_HID_CAP_CALIBRATE : 0) |
+                     (SOF_SYNC ? RAW_HID_CAP_SOF_SYNC : 0) |
+                     (SPLIT_LINK ? RAW_HID_CAP_SPLIT : 0));
+  return RAW_HID_OK;
+}
+
+static uint8_t cmd_get_keymap(uint8_t const* request, uint8_t* reply)
+{
+  uint8_t layer = request[2], first = request[3], count = request[4];
+
+  if (layer >= keymap_num_layers() || count > RAW_HID_KEYMAP_MAX ||
+      first + count > KEYMAP_KEYS) return RAW_HID_ERR_ARGUMENT;
+
+  reply[3] = layer;
+  reply[4] = first;
+  reply[5] = count;
+  for (uint i = 0; i < count; ++i) {
+    key_action_t action = keymap_action(layer, first + i);
+    reply[6 + 2 * i]     = action.type;
+    reply[6 + 2 * i + 1] = action.code;
+  }
+  return RAW_HID_OK;
+}
+
+static uint8_t cmd_set_keymap(uint8_t const* request, uint8_t* reply)
+{
+  uint8_t layer = request[2], first = request[3], count = request[4];
+
+  if (count > RAW_HID_KEYMAP_MAX) return RAW_HID_ERR_ARGUMENT;
+
+  uint written = 0;
+  while (written < count &&
+         keymap_set_action(layer, first + written,
+                           (key_action_t) { request[5 + 2 * written], request[5 + 2 * written + 1] })) {
+    written++;
+  }
+
+  reply[3] = (uint8_t) written;
+  return (written == count) ? RAW_HID_OK : RAW_HID_ERR_ARGUMENT;
+}
+
+static uint8_t cmd_get_tap_hold(uint8_t const* request, uint8_t* reply)
+{
+  uint8_t first = request[2], count = request[3];
+
+  if (count > RAW_HID_TAP_HOLD_MAX || first + count > keymap_tap_hold_slots()) return RAW_HID_ERR_ARGUMENT;
+
+  reply[3] = first;
+  reply[4] = count;
+  for (uint i = 0; i < count; ++i) {
+    key_tap_hold_t const* entry = keymap_tap_hold_entry(first + i);
+    uint8_t* p = &reply[5 + 4 * i];
+    p[0] = entry->tap.type;
+    p[1] = entry->tap.code;
+    p[2] = entry->hold.type;
+    p[3] = entry->hold.code;
+  }
+  return RAW_HID_OK;
+}
+
+static uint8_t cmd_set_tap_hold(uint8_t const* request, uint8_t* reply)
+{
+  uint8_t first = request[2], count = request[3];
+
+  if (count > RAW_HID_TAP_HOLD_MAX) return RAW_HID_ERR_ARGUMENT;
+
+  uint written = 0;
+  for (; written < count; ++written) {
+    uint8_t const* p = &request[4 + 4 * written];
+    key_tap_hold_t entry = { { p[0], p[1] }, { p[2], p[3] } };
+    if (!keymap_set_tap_hold(first + written, entry)) break;
+  }
+
+  reply[3] = (uint8_t) written;
+  return (written == count) ? RAW_HID_OK : RAW_HID_ERR_ARGUMENT;
+}
+
+static uint8_t cmd_get_combo(uint8_t const* request, uint8_t* reply)
+{
+  uint16_t first = get_u16(&request[2]);
+  uint8_t count = request[4];
+
+  if (count > RAW_HID_COMBO_MAX || first + count > keymap_combo_slots()) return RAW_HID_ERR_ARGUMENT;
+
+  put_u16(&reply[3], first);
+  reply[5] = count;
+  for (uint i = 0; i < count; ++i) {
+    put_combo(&reply[6 + 10 * i], keymap_combo(first + i));
+  }
+  return RAW_HID_OK;
+}
+
+static uint8_t cmd_set_combo(uint8_t const* request, uint8_t* reply)
+{
+  uint16_t first = get_u16(&request[2]);
+  uint8_t count = request[4];
+
+  if (count > RAW_HID_COMBO_MAX) return RAW_HID_ERR_ARGUMENT;
+
+  uint written = 0;
+  while (written < count && keymap_set_combo(first + written, get_combo(&request[5 + 10 * written]))) {
+    written++;
+  }
+
+  reply[3] = (uint8_t) written;
+  return (written == count) ? RAW_HID_OK : RAW_HID_ERR_ARGUMENT;
+}
+
+static void fill_counters(uint8_t* reply)
+{
+  keyboard_stats_t const* kb = keyboard_stats();
+  tap_hold_stats_t const* th = tap_hold_stats();
+  combo_stats_t const* cs = combo_stats();
+  store_stats_t const* st = store_stats();
+#if LATENCY_STATS
+  latency_stats_t const* lat = latency_stats();
+#endif
+
+  uint32_t counters[RAW_HID_COUNTER_COUNT] = {
+    [RAW_HID_COUNTER_UPTIME_MS]       = (uint32_t) (time_us_64() / 1000),
+    [RAW_HID_COUNTER_KEY_EVENTS]      = kb->key_events,
+    [RAW_HID_COUNTER_REPORTS]         = kb->reports,
+    [RAW_HID_COUNTER_REPORTS_DROPPED] = kb->reports_dropped,
+    [RAW_HID_COUNTER_TAPS]            = th->taps,
+    [RAW_HID_COUNTER_HOLDS]           = th->holds,
+    [RAW_HID_COUNTER_COMBOS]          = cs->combos,
+    [RAW_HID_COUNTER_STORE_SEQ]       = st->seq,
+    [RAW_HID_COUNTER_STORE_PROGRAMS]  = st->programs,
+    [RAW_HID_COUNTER_STORE_ERASES]    = st->erases,
+    [RAW_HID_COUNTER_STORE_FAILURES]  = st->failures,
+    [RAW_HID_COUNTER_EVENTS_DROPPED]  = key_event_dropped(),
+    [RAW_HID_COUNTER_WAKE_LATENCY_MAX] = power_stats()->wake_latency_max_us,
+#if LATENCY_STATS
+    [RAW_HID_COUNTER_EVENT_QUEUE_MAX]  = lat->event_queue_max,
+    [RAW_HID_COUNTER_REPORT_QUEUE_MAX] = lat->report_queue_max,
+#endif
+  };
+
+  for (uint i = 0; i < RAW_HID_COUNTER_COUNT; ++i) {
+    put_u32(&reply[3 + 4 * i], counters[i]);
+  }
+}
+
+#if LATENCY_STATS
+static uint8_t cmd_get_latency(uint8_t const* request, uint8_t* reply)
+{
+  uint8_t stage = request[2];
+  if (stage >= LATENCY_STAGE_COUNT) return RAW_HID_ERR_ARGUMENT;
+
+  latency_hist_t const* hist = &latency_stats()->stages[stage];
+  reply[3] = stage;
+  for (uint i = 0; i < LATENCY_BUCKETS; ++i) {
+    put_u32(&reply[4 + 4 * i], hist->buckets[i]);
+  }
+  put_u32(&reply[4 + 4 * LATENCY_BUCKETS], hist->max_us);
+
+  if (request[3]) latency_clear();
+  return RAW_HID_OK;
+}
+#endif
+
+static uint8_t cmd_get_scan_timing(uint8_t* reply)
+{
+  matrix_timing_t const* timing = matrix_scan_timing();
+  uint8_t* p = &reply[5];
+
+  reply[3] = NUM_COLS;
+  reply[4] = NUM_ROWS;
+  memcpy(p, timing->settle_us, NUM_COLS);    p += NUM_COLS;
+  memcpy(p, timing->recover_us, NUM_COLS);   p += NUM_COLS;
+  memcpy(p, timing->col_fall_us, NUM_COLS);  p += NUM_COLS;
+  memcpy(p, timing->col_rise_us, NUM_COLS);  p += NUM_COLS;
+  memcpy(p, timing->row_rise_us, NUM_ROWS);  p += NUM_ROWS;
+  put_u16(&p[0], timing->scan_us);
+  put_u16(&p[2], timing->runs);
+  put_u16(&p[4], timing->failures);
+  return RAW_HID_OK;
+}
+
+#if SOF_SYNC
+static uint8_t cmd_get_usb_sync(uint8_t* reply)
+{
+  sof_sync_stats_t const* sync = sof_sync_stats();
+
+  put_u32(&reply[3], sync->frames);
+  put_u32(&reply[7], sync->polls);
+  put_u16(&reply[11], (uint16_t) sync->poll_offset_us);
+  put_u16(&reply[13], (uint16_t) sync->scan_us);
+  put_u32(&reply[15], sync->phase_count);
+  put_u16(&reply[19], (uint16_t) (sync->phase_count ? sync->phase_sum_us / sync->phase_count : 0));
+  put_u16(&reply[21], (uint16_t) sync->phase_max_us);
+  return RAW_HID_OK;
+}
+#endif
+
+#if SPLIT_LINK
+static uint8_t cmd_get_split(uint8_t* reply)
+{
+  split_link_t const* link = keyboard_split_link();
+  split_link_stats_t const* stats = split_link_stats(link);
+  uint32_t const counters[] = {
+    stats->frames_tx, stats->frames_rx, stats->deltas, stats->fulls, stats->crc_errors,
+    stats->sequence, stats->retransmits, stats->tx_full, stats->link_down, stats->syncs,
+  };
+
+  reply[3] = split_link_up(link);
+  for (uint i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i) {
+    put_u32(&reply[4 + 4 * i], counters[i]);
+  }
+  return RAW_HID_OK;
+}
+#endif
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void raw_hid_init(raw_hid_send_t send)
+{
+  s_send = send;
+  s_stream_interval_us = 0;
+  memset(s_reply, 0, sizeof(s_reply));
+}
+
+void raw_hid_receive(uint8_t const* data, uint16_t len)
+{
+  uint8_t request[RAW_HID_SIZE] = { 0 };
+  memcpy(request, data, (len < RAW_HID_SIZE) ? len : RAW_HID_SIZE);
+
+  memset(s_reply, 0, sizeof(s_reply));
+  s_reply[0] = request[0];
+  s_reply[1] = request[1];
+
+  uint8_t status;
+  switch (request[0])
+  {
+    case RAW_HID_GET_INFO:      status = cmd_get_info(s_reply);               break;
+    case RAW_HID_GET_KEYMAP:    status = cmd_get_keymap(request, s_reply);    break;
+    case RAW_HID_SET_KEYMAP:    status = cmd_set_keymap(request, s_reply);    break;
+    case RAW_HID_GET_TAP_HOLD:  status = cmd_get_tap_hold(request, s_reply);  break;
+    case RAW_HID_SET_TAP_HOLD:  status = cmd_set_tap_hold(request, s_reply);  break;
+    case RAW_HID_GET_COMBO:     status = cmd_get_combo(request, s_reply);     break;
+    case RAW_HID_SET_COMBO:     status = cmd_set_combo(request, s_reply);     break;
+
+    case RAW_HID_GET_SETTING:
+      s_reply[3] = request[2];
+      put_u32(&s_reply[4], keymap_setting((keymap_setting_t) request[2]));
+      status = (request[2] < KEYMAP_SETTING_COUNT) ? RAW_HID_OK : RAW_HID_ERR_ARGUMENT;
+      break;
+
+    case RAW_HID_SET_SETTING:
+      status = keymap_set_setting((keymap_setting_t) request[2], get_u32(&request[3])) ? RAW_HID_OK : RAW_HID_ERR_ARGUMENT;
+      break;
+
+    case RAW_HID_GET_COUNTERS:
+      fill_counters(s_reply);
+      status = RAW_HID_OK;
+      break;
+
+    case RAW_HID_STREAM_COUNTERS:
+      s_stream_interval_us = get_u16(&request[2]) * 1000u;
+      s_stream_next_us = time_us_32();
+      status = RAW_HID_OK;
+      break;
+
+    case RAW_HID_RESET_KEYMAP:
+      keymap_reset();
+      status = RAW_HID_OK;
+      break;
+
+#if LATENCY_STATS
+    case RAW_HID_GET_LATENCY:   status = cmd_get_latency(request, s_reply);   break;
+#endif
+
+    case RAW_HID_GET_SCAN_TIMING: status = cmd_get_scan_timing(s_reply);    break;
+
+#if SOF_SYNC
+    case RAW_HID_GET_USB_SYNC:  status = cmd_get_usb_sync(s_reply);           break;
+#endif
+
+#if SPLIT_LINK
+    case RAW_HID_GET_SPLIT:     status = cmd_get_split(s_reply);              break;
+#endif
+
+    default:
+      status = RAW_HID_ERR_COMMAND;
+      break;
+  }
+
+  s_reply[2] = status;
+  s_send(s_reply);
+}
+
+void raw_hid_task(uint32_t now_us)
+{
+  if (s_stream_interval_us == 0 || (int32_t) (now_us - s_stream_next_us) < 0) return;
+
+  uint8_t report[RAW_HID_SIZE] = { RAW_HID_GET_COUNTERS, 0, RAW_HID_OK };
+  fill_counters(report);
+
+  // A full queue skips this sample, the stream never waits
+  s_send(report);
+  s_stream_next_us = now_us + s_stream_interval_us;
+}
+
+uint8_t const* raw_hid_last_reply(void)
+{
+  return s_reply;
+}
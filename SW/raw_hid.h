@@ -0,0 +1,104 @@
+// Raw HID configuration protocol (core0)
+// Requests come in as 64-byte OUT / SET_REPORT reports on HID_INSTANCE_RAW,
+// every request gets one 64-byte reply on the raw IN endpoint (also readable
+// with GET_REPORT). The raw interface has its own endpoint and report queue,
+// so replies and counter streams never delay keyboard reports; requests are
+// handled in a few us and flash writes are deferred (store.h).
+//
+// Request:  [0] command  [1] sequence  [2..] arguments
+// Reply:    [0] command  [1] sequence  [2] status  [3..] data
+// Multi-byte values are little endian. Keymap entries are key_action_t as
+// { type, code }. Host side: host/cli.c (kb_cli).
+
+#ifndef RAW_HID_H_
+#define RAW_HID_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bumped on any incompatible change of the layouts below
+#define RAW_HID_PROTOCOL_VERSION  1
+
+#define RAW_HID_SIZE  64
+
+typedef enum
+{
+  RAW_HID_GET_INFO = 0x01,      // -> version, rows, cols, layers, tap-hold slots, combo slots (2),
+                                //    macros, settings, keymap signature (4), capabilities (4)
+  RAW_HID_GET_KEYMAP,           // layer, first key, count -> layer, first key, count, entries
+  RAW_HID_SET_KEYMAP,           // layer, first key, count, entries -> count written
+  RAW_HID_GET_TAP_HOLD,         // first, count -> first, count, { tap, hold } entries
+  RAW_HID_SET_TAP_HOLD,         // first, count, { tap, hold } entries -> count written
+  RAW_HID_GET_COMBO,            // first (2), count -> first (2), count, { keys (8), action } entries
+  RAW_HID_SET_COMBO,            // first (2), count, { keys (8), action } entries -> count written
+  RAW_HID_GET_SETTING,          // id -> id, value (4)
+  RAW_HID_SET_SETTING,          // id, value (4)
+  RAW_HID_GET_COUNTERS,         // -> counters (4 each, raw_hid_counter_t order)
+  RAW_HID_STREAM_COUNTERS,      // interval ms (2), 0 = stop -> GET_COUNTERS replies with sequence 0
+  RAW_HID_RESET_KEYMAP,         // back to the generated keymap
+  RAW_HID_GET_LATENCY,          // stage (latency_stage_t), clear after read -> stage, buckets (4 each), max us (4)
+  RAW_HID_GET_SCAN_TIMING,      // -> cols, rows, settle, recover, col fall, col rise (cols each),
+                                //    row rise (rows), scan us (2), runs (2), failures (2) (matrix_timing_t)
+  RAW_HID_GET_USB_SYNC,         // -> frames (4), polls (4), poll offset us (2), scan us (2),
+                                //    phase count (4), phase avg us (2), phase max us (2) (sof_sync_stats_t)
+  RAW_HID_GET_SPLIT,            // -> up, counters (4 each, split_link_stats_t order), SPLIT_LINK builds
+} raw_hid_command_t;
+
+typedef enum
+{
+  RAW_HID_OK = 0,
+  RAW_HID_ERR_COMMAND,          // unknown command
+  RAW_HID_ERR_ARGUMENT,         // out of range, nothing from the bad entry on was applied
+} raw_hid_status_t;
+
+// Capability bits of RAW_HID_GET_INFO
+#define RAW_HID_CAP_COMBOS      (1u << 0)
+#define RAW_HID_CAP_MACROS      (1u << 1)
+#define RAW_HID_CAP_FLASH       (1u << 2)   // changes are saved
+#define RAW_HID_CAP_COUNTERS    (1u << 3)
+#define RAW_HID_CAP_LATENCY     (1u << 4)   // built with LATENCY_STATS
+#define RAW_HID_CAP_CALIBRATE   (1u << 5)   // CPU scan with settle calibration
+#define RAW_HID_CAP_SOF_SYNC    (1u << 6)   // stages phase-locked to the USB frame
+#define RAW_HID_CAP_SPLIT       (1u << 7)   // keys SPLIT_KEY_FIRST .. are the other half's matrix
+
+// Entries per transfer: 64 bytes minus the headers
+#define RAW_HID_KEYMAP_MAX      29          // (64 - 6) / 2
+#define RAW_HID_TAP_HOLD_MAX    14          // (64 - 5) / 4
+#define RAW_HID_COMBO_MAX       5           // (64 - 6) / 10
+
+typedef enum
+{
+  RAW_HID_COUNTER_UPTIME_MS = 0,
+  RAW_HID_COUNTER_KEY_EVENTS,
+  RAW_HID_COUNTER_REPORTS,
+  RAW_HID_COUNTER_REPORTS_DROPPED,
+  RAW_HID_COUNTER_TAPS,
+  RAW_HID_COUNTER_HOLDS,
+  RAW_HID_COUNTER_COMBOS,
+  RAW_HID_COUNTER_STORE_SEQ,
+  RAW_HID_COUNTER_STORE_PROGRAMS,
+  RAW_HID_COUNTER_STORE_ERASES,
+  RAW_HID_COUNTER_STORE_FAILURES,
+  RAW_HID_COUNTER_EVENTS_DROPPED,   // key events retried because the ring was full
+  RAW_HID_COUNTER_EVENT_QUEUE_MAX,  // 0 without LATENCY_STATS
+  RAW_HID_COUNTER_REPORT_QUEUE_MAX, // 0 without LATENCY_STATS
+  RAW_HID_COUNTER_WAKE_LATENCY_MAX, // us, row edge -> tud_remote_wakeup() (power.h)
+  RAW_HID_COUNTER_COUNT
+} raw_hid_counter_t;
+
+// @brief Send one reply on the raw IN endpoint
+// @return false if it could not be queued
+typedef bool (*raw_hid_send_t)(uint8_t const report[RAW_HID_SIZE]);
+
+void raw_hid_init(raw_hid_send_t send);
+
+// @brief Handle one request report
+void raw_hid_receive(uint8_t const* data, uint16_t len);
+
+// @brief Send streamed counters when due
+void raw_hid_task(uint32_t now_us);
+
+// @brief Last reply, for GET_REPORT
+uint8_t const* raw_hid_last_reply(void);
+
+#endif /* RAW_HID_H_ */
@@ -0,0 +1,35 @@
+// Outgoing HID report queues, see report_queue.h
+
+#include <string.h>
+
+#include "report_queue.h"
+
+bool report_queue_push(report_queue_t* queue, uint8_t instance, uint8_t report_id, void const* data, uint8_t len)
+{
+  if (report_queue_full(queue) || len > REPORT_QUEUE_DATA_MAX) return false;
+
+  queued_report_t* entry = &queue->entries[queue->head & (REPORT_QUEUE_SIZE - 1)];
+  entry->instance  = instance;
+  entry->report_id = report_id;
+  entry->len       = len;
+  memcpy(entry->data, data, len);
+  queue->head++;
+
+  return true;
+}
+
+queued_report_t const* report_queue_peek(report_queue_t const* queue)
+{
+  if (queue->head == queue->tail) return NULL;
+  return &queue->entries[queue->tail & (REPORT_QUEUE_SIZE - 1)];
+}
+
+void report_queue_pop(report_queue_t* queue)
+{
+  if (queue->head != queue->tail) queue->tail++;
+}
+
+void report_queue_clear(report_queue_t* queue)
+{
+  queue->tail = queue->head;
+}
@@ -0,0 +1,55 @@
+// Outgoing HID report queues (core0 only)
+// Reports are queued in the order they were built and released one per
+// endpoint poll, so fast press/release sequences are never merged.
+// One queue per group of interfaces that must keep their relative order.
+
+#ifndef REPORT_QUEUE_H_
+#define REPORT_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Queue depth, must be a power of 2
+#define REPORT_QUEUE_SIZE      32
+// Largest report payload (without report ID), raw HID report = 64 bytes
+#define REPORT_QUEUE_DATA_MAX  64
+
+typedef struct
+{
+  uint8_t instance;   // HID interface instance (HID_INSTANCE_*)
+  uint8_t report_id;  // 0 = no report ID
+  uint8_t len;
+  uint8_t data[REPORT_QUEUE_DATA_MAX];
+} queued_report_t;
+
+typedef struct
+{
+  queued_report_t entries[REPORT_QUEUE_SIZE];
+  uint32_t head;  // next slot to write
+  uint32_t tail;  // oldest report
+} report_queue_t;
+
+// @brief Append a report
+// @return false if the queue is full
+bool report_queue_push(report_queue_t* queue, uint8_t instance, uint8_t report_id, void const* data, uint8_t len);
+
+// @brief Oldest queued report, NULL if empty
+queued_report_t const* report_queue_peek(report_queue_t const* queue);
+
+// @brief Drop the oldest queued report
+void report_queue_pop(report_queue_t* queue);
+
+// @brief Drop every queued report
+void report_queue_clear(report_queue_t* queue);
+
+static inline uint32_t report_queue_count(report_queue_t const* queue)
+{
+  return queue->head - queue->tail;
+}
+
+static inline bool report_queue_full(report_queue_t const* queue)
+{
+  return report_queue_count(queue) >= REPORT_QUEUE_SIZE;
+}
+
+#endif /* REPORT_QUEUE_H_ */
@@ -0,0 +1,86 @@
+// Microsecond stage scheduler, see scheduler.h
+
+#include "pico/time.h"
+#include "scheduler.h"
+
+void scheduler_init(sched_stage_t* stages, uint count)
+{
+  uint64_t now = time_us_64();
+
+  for (uint i = 0; i < count; ++i) {
+    stages[i].next_us     = now;
+    stages[i].runs        = 0;
+    stages[i].misses      = 0;
+    stages[i].max_late_us = 0;
+  }
+}
+
+void scheduler_resume(sched_stage_t* stages, uint count)
+{
+  uint64_t now = time_us_64();
+
+  for (uint i = 0; i < count; ++i) {
+    stages[i].next_us = now;
+  }
+}
+
+void scheduler_set_period(sched_stage_t* stage, uint32_t period_us)
+{
+  stage->next_us = stage->next_us - stage->period_us + period_us;
+  stage->period_us = period_us;
+}
+
+void scheduler_shift(sched_stage_t* stage, int32_t shift_us)
+{
+  stage->next_us += (int64_t) shift_us;
+}
+
+int32_t scheduler_align(sched_stage_t* stage, uint32_t slot_us)
+{
+  int32_t period = (int32_t) stage->period_us;
+  int32_t error = (int32_t) ((uint32_t) stage->next_us - slot_us) % period;
+  if (error > period / 2) error -= period;
+  if (error <= -period / 2) error += period;
+  if (error >= -SCHED_ALIGN_DEADBAND_US && error <= SCHED_ALIGN_DEADBAND_US) return 0;
+
+  int32_t shift = -error / 2;
+  if (shift > period / 8) shift = period / 8;
+  if (shift < -period / 8) shift = -period / 8;
+  if (shift == 0) shift = (error > 0) ? -1 : 1;
+
+  scheduler_shift(stage, shift);
+  return shift;
+}
+
+uint64_t scheduler_run(sched_stage_t* stages, uint count)
+{
+  uint64_t next = UINT64_MAX;
+
+  for (uint i = 0; i < count; ++i) {
+    sched_stage_t* stage = &stages[i];
+    uint64_t now = time_us_64();
+
+    if (now >= stage->next_us) {
+      uint64_t late = now - stage->next_us;
+
+      if (late > stage->max_late_us) {
+        stage->max_late_us = (uint32_t) late;
+      }
+
+      // Started after its own period slot: count the skipped periods and
+      // re-phase instead of running a burst to catch up
+      if (late >= stage->period_us) {
+        stage->misses += (uint32_t) (late / stage->period_us);
+        stage->next_us = now;
+      }
+
+      stage->fn();
+      stage->runs++;
+      stage->next_us += stage->period_us;
+    }
+
+    if (stage->next_us < next) next = stage->next_us;
+  }
+
+  return next;
+}
@@ -0,0 +1,51 @@
+// Microsecond stage scheduler
+// Runs each stage at its own period on the 64-bit hardware timer (time_us_64),
+// independent of the 1ms board_millis() tick. One stage table per core.
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+
+typedef void (*sched_fn_t)(void);
+
+typedef struct
+{
+  const char* name;
+  sched_fn_t  fn;
+  uint32_t    period_us;
+
+  // Runtime state, cleared by scheduler_init()
+  uint64_t    next_us;      // next release time
+  uint32_t    runs;
+  uint32_t    misses;       // whole periods skipped because a run started too late
+  uint32_t    max_late_us;  // worst start delay after the release time
+} sched_stage_t;
+
+// @brief Release every stage now and clear the counters
+void scheduler_init(sched_stage_t* stages, uint count);
+
+// @brief Release every stage now, keeping the counters (after the core slept)
+void scheduler_resume(sched_stage_t* stages, uint count);
+
+// @brief Change a stage period, the pending release moves by the difference
+void scheduler_set_period(sched_stage_t* stage, uint32_t period_us);
+
+// @brief Move the pending release by shift_us (phase adjustment), the period is kept
+void scheduler_shift(sched_stage_t* stage, int32_t shift_us);
+
+// Phase errors within this are left alone by scheduler_align()
+#define SCHED_ALIGN_DEADBAND_US  2
+
+// @brief Step the pending release toward slot_us (modulo the period)
+// Half the error per call, at most 1/8 period: a release moved earlier never
+// starts a whole period late (a scheduler miss)
+// @return the shift applied (us), 0 within SCHED_ALIGN_DEADBAND_US
+int32_t scheduler_align(sched_stage_t* stage, uint32_t slot_us);
+
+// @brief Run every stage whose release time has passed
+// @return earliest next release time (us since boot)
+uint64_t scheduler_run(sched_stage_t* stages, uint count);
+
+#endif /* SCHEDULER_H_ */
@@ -0,0 +1,174 @@
+// USB frame phase lock, see sof_sync.h
+
+#include "sof_sync.h"
+
+#if SOF_SYNC
+
+#include "tusb.h"
+
+#include "pico/time.h"
+
+// Frames without a SOF before the stages run free again
+#define SOF_LOST_FRAMES     3
+
+// USB frame numbers are 11 bits
+#define FRAME_COUNT_MASK    0x7ff
+
+// SOF timing (core0)
+static volatile uint32_t s_frame = 0;     // SOFs seen, 0 = none yet
+static volatile uint32_t s_sof_us = 0;    // estimated time of the last SOF
+static volatile uint32_t s_poll_us = 0;   // estimated keyboard poll in that frame
+static uint32_t s_frame_count = 0;        // USB frame number of the last SOF
+static bool     s_poll_valid = false;
+static uint32_t s_commit_seen = 0;        // last s_commit_us timed against a poll
+
+// Scan timing (core1)
+static volatile uint32_t s_scan_us = SOF_SYNC_SCAN_US_DEFAULT;
+static volatile uint32_t s_commit_us = 0;
+
+// Frame each core last aligned its stages in
+static uint32_t s_scan_frame = 0;
+static uint32_t s_report_frame = 0;
+
+static sof_sync_stats_t s_stats;
+
+void sof_sync_init(void)
+{
+  s_frame = 0;
+  s_poll_valid = false;
+  s_scan_us = SOF_SYNC_SCAN_US_DEFAULT;
+  s_commit_us = 0;
+  s_commit_seen = 0;
+  s_scan_frame = 0;
+  s_report_frame = 0;
+
+  s_stats = (sof_sync_stats_t) { 0 };
+}
+
+sof_sync_stats_t const* sof_sync_stats(void)
+{
+  s_stats.scan_us = s_scan_us;
+  return &s_stats;
+}
+
+// @brief SOFs are coming in, s_sof_us / s_poll_us are current
+static bool sof_locked(uint32_t now_us)
+{
+  return s_frame != 0 && (now_us - s_sof_us) < (SOF_LOST_FRAMES + 1) * SOF_SYNC_FRAME_US;
+}
+
+//--------------------------------------------------------------------+
+// USB timing (core0)
+//--------------------------------------------------------------------+
+
+void sof_sync_mount(void)
+{
+  tud_sof_cb_enable(true);
+}
+
+void sof_sync_frame(uint32_t frame_count)
+{
+  uint32_t now = time_us_32();
+  uint32_t frames = (frame_count - s_frame_count) & FRAME_COUNT_MASK;
+  s_frame_count = frame_count;
+
+  // The callback runs from tud_task(), late by however long the main loop was
+  // busy: a SOF earlier than predicted moves the estimate at once, a later
+  // one only pulls it by 1/16 (the two clocks drift a few ppm apart)
+  uint32_t predicted = s_sof_us + frames * SOF_SYNC_FRAME_US;
+  int32_t error = (int32_t) (now - predicted);
+
+  if (!sof_locked(now) || error < 0) {
+    s_sof_us = now;
+  } else {
+    s_sof_us = predicted + (uint32_t) (error >> 4);
+  }
+  s_poll_us = s_sof_us + s_stats.poll_offset_us;
+
+  s_frame++;
+  s_stats.frames++;
+}
+
+void sof_sync_poll(void)
+{
+  uint32_t now = time_us_32();
+  if (!sof_locked(now)) return;
+
+  // Running average of the poll offset in the frame, wrapped around the SOF
+  uint32_t offset = (now - s_sof_us) % SOF_SYNC_FRAME_US;
+  if (!s_poll_valid) {
+    s_stats.poll_offset_us = offset;
+    s_poll_valid = true;
+  } else {
+    int32_t diff = (int32_t) offset - (int32_t) s_stats.poll_offset_us;
+    if (diff >= SOF_SYNC_FRAME_US / 2) diff -= SOF_SYNC_FRAME_US;
+    if (diff < -SOF_SYNC_FRAME_US / 2) diff += SOF_SYNC_FRAME_US;
+    s_stats.poll_offset_us = (s_stats.poll_offset_us + SOF_SYNC_FRAME_US + (uint32_t) (diff / 8)) % SOF_SYNC_FRAME_US;
+  }
+  s_stats.polls++;
+
+  // Phase latency: the newest debounce commit -> this poll. A commit that
+  // queued no report (a key without a keycode) is not timed.
+  uint32_t commit = s_commit_us;
+  if (commit != s_commit_seen) {
+    s_commit_seen = commit;
+    uint32_t phase = now - commit;
+    if (phase < 2 * SOF_SYNC_FRAME_US) {
+      s_stats.phase_count++;
+      s_stats.phase_sum_us += phase;
+      if (phase > s_stats.phase_max_us) s_stats.phase_max_us = phase;
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// Scan timing (core1)
+//--------------------------------------------------------------------+
+
+void sof_sync_scan(uint32_t scan_us)
+{
+  // Peak with a slow decay: a longer scan counts at once, a shorter one only
+  // pulls it down by 1/16, so one idle stretch does not shrink the lead
+  uint32_t peak = s_scan_us;
+  s_scan_us = (scan_us >= peak) ? scan_us : peak - ((peak - scan_us) >> 4);
+}
+
+void sof_sync_commit(uint32_t now_us)
+{
+  s_commit_us = now_us;
+}
+
+//--------------------------------------------------------------------+
+// Stage phase
+//--------------------------------------------------------------------+
+
+// @brief Move a stage's releases toward slot_us (modulo its period), once per frame
+// @return the shift applied to the stage (us)
+static int32_t align(sched_stage_t* stage, uint32_t slot_us, uint32_t* frame)
+{
+  uint32_t frame_now = s_frame;
+  if (frame_now == *frame || !sof_locked(time_us_32())) return 0;
+  *frame = frame_now;
+
+  return scheduler_align(stage, slot_us);
+}
+
+void sof_sync_align_scan(sched_stage_t* stages, uint count)
+{
+  uint32_t lead = SOF_SYNC_REPORT_LEAD_US + SOF_SYNC_GUARD_US + s_scan_us;
+
+  // Debounce (and the calibration step) follow the scan in the same pass;
+  // left behind, a calibration step could land right before a scan
+  int32_t shift = align(&stages[0], s_poll_us - lead, &s_scan_frame);
+  if (shift == 0) return;
+  for (uint i = 1; i < count; ++i) {
+    scheduler_shift(&stages[i], shift);
+  }
+}
+
+void sof_sync_align_report(sched_stage_t* report)
+{
+  align(report, s_poll_us - SOF_SYNC_REPORT_LEAD_US, &s_report_frame);
+}
+
+#endif // SOF_SYNC
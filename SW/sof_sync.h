@@ -0,0 +1,129 @@
+// USB frame phase lock
+// A change scanned just after the host polled the keyboard endpoint waits for
+// the next 1ms frame. With SOF callbacks enabled, core0 timestamps every
+// start of frame and every completed keyboard IN transfer, and learns where
+// in the frame the host polls. The scan / debounce stages (core1) and the
+// report stage (core0) are then phase-shifted a little every frame so one
+// scan, its debounce commit and the report build finish just before the poll:
+//
+//   SOF ... scan+debounce | report | IN poll          (one frame)
+//           <- scan lead -> <- SOF_SYNC_REPORT_LEAD_US ->
+//
+// The scan lead is the longest recent scan with a key down (a full column
+// scan, the idle probe is much shorter) plus SOF_SYNC_GUARD_US. The other
+// scans of the frame keep the stage period. Without SOFs (not mounted,
+// suspended) the stages run free.
+//
+// Built with SOF_SYNC=1 (CMake option SOF_SYNC, default ON); otherwise every
+// call below is an empty inline. Flags cross cores like power.h: SOF / poll
+// timing is written by core0, scan timing and commit times by core1.
+
+#ifndef SOF_SYNC_H_
+#define SOF_SYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "scheduler.h"
+
+#ifndef SOF_SYNC
+#define SOF_SYNC  1
+#endif
+
+#define SOF_SYNC_FRAME_US         1000
+
+// Report stage release ahead of the poll: hid_task() and the endpoint write
+#define SOF_SYNC_REPORT_LEAD_US   50
+
+// Between the debounce commit and the report stage release
+#define SOF_SYNC_GUARD_US         20
+
+// Full scan time until one has been seen (the uncalibrated CPU scan is ~150us)
+#define SOF_SYNC_SCAN_US_DEFAULT  160
+
+typedef struct
+{
+  uint32_t frames;          // SOF callbacks
+  uint32_t polls;           // keyboard IN transfers timed against the SOF
+  uint32_t poll_offset_us;  // SOF -> keyboard IN completion, running average
+  uint32_t scan_us;         // full scan time used for the scan lead
+  uint32_t phase_count;     // keyboard IN transfers after a debounce commit
+  uint64_t phase_sum_us;    // debounce commit -> IN completion, summed
+  uint32_t phase_max_us;
+} sof_sync_stats_t;
+
+#if SOF_SYNC
+
+// @brief Reset the state, call before either core's stages run
+void sof_sync_init(void);
+
+// @brief Enable the SOF callback (core0, tud_mount_cb, the bus reset clears it)
+void sof_sync_mount(void);
+
+// @brief Start of frame (core0, tud_sof_cb)
+void sof_sync_frame(uint32_t frame_count);
+
+// @brief A keyboard IN transfer completed (core0, tud_hid_report_complete_cb)
+void sof_sync_poll(void);
+
+// @brief Scan hook (core1, scan_task)
+// @param scan_us matrix_scan_read() time, only timed when a key was down
+void sof_sync_scan(uint32_t scan_us);
+
+// @brief Debounce pushed key events (core1, debounce_task)
+void sof_sync_commit(uint32_t now_us);
+
+// @brief Move the scan stage toward its slot, once per frame (core1 main loop,
+// before its stages). The rest of the table moves along and keeps running
+// right after the scan in the same pass.
+// @param stages core1 stage table, the scan stage first
+void sof_sync_align_scan(sched_stage_t* stages, uint count);
+
+// @brief Move the report stage toward its slot, once per frame (core0 main loop)
+void sof_sync_align_report(sched_stage_t* report);
+
+sof_sync_stats_t const* sof_sync_stats(void);
+
+#else
+
+static inline void sof_sync_init(void)
+{
+}
+
+static inline void sof_sync_mount(void)
+{
+}
+
+static inline void sof_sync_frame(uint32_t frame_count)
+{
+  (void) frame_count;
+}
+
+static inline void sof_sync_poll(void)
+{
+}
+
+static inline void sof_sync_scan(uint32_t scan_us)
+{
+  (void) scan_us;
+}
+
+static inline void sof_sync_commit(uint32_t now_us)
+{
+  (void) now_us;
+}
+
+static inline void sof_sync_align_scan(sched_stage_t* stages, uint count)
+{
+  (void) stages;
+  (void) count;
+}
+
+static inline void sof_sync_align_report(sched_stage_t* report)
+{
+  (void) report;
+}
+
+#endif
+
+#endif /* SOF_SYNC_H_ */
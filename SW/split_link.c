@@ -0,0 +1,396 @@
+// Split keyboard link, see split_link.h
+
+#include "split_link.h"
+
+#if SPLIT_LINK
+
+#include <string.h>
+
+#include "crc16.h"
+
+// Frame offsets
+#define FRAME_TYPE_LEN   1
+#define FRAME_SEQ        2
+#define FRAME_PAYLOAD    SPLIT_FRAME_HEAD
+
+#define SYNC_PAYLOAD     3
+#define FULL_PAYLOAD     8
+
+// A delta of this many changed bytes is no shorter than the whole sample
+#define DELTA_BYTES_MAX  (FULL_PAYLOAD - 2)
+
+// @brief Frame around a payload
+// @return frame length
+static uint frame_encode(uint8_t* frame, split_frame_type_t type, uint8_t seq, uint8_t const* payload, uint len)
+{
+  frame[0] = SPLIT_FRAME_START;
+  frame[FRAME_TYPE_LEN] = (uint8_t) (type << 4 | len);
+  frame[FRAME_SEQ] = seq;
+  memcpy(&frame[FRAME_PAYLOAD], payload, len);
+
+  uint16_t crc = crc16(0xffff, &frame[FRAME_TYPE_LEN], 2 + len);
+  frame[FRAME_PAYLOAD + len]     = (uint8_t) crc;
+  frame[FRAME_PAYLOAD + len + 1] = (uint8_t) (crc >> 8);
+  return SPLIT_FRAME_HEAD + len + 2;
+}
+
+void split_link_init(split_link_t* link, split_port_t const* port, split_role_t role, uint32_t now_us)
+{
+  memset(link, 0, sizeof(*link));
+  link->port = port;
+  link->role = role;
+  link->rx_valid_us = now_us;
+  link->need_full = true;
+  link->sent_us = now_us;
+}
+
+bool split_link_up(split_link_t const* link)
+{
+  return link->up;
+}
+
+uint64_t split_link_state(split_link_t const* link)
+{
+  return link->state;
+}
+
+split_link_stats_t const* split_link_stats(split_link_t const* link)
+{
+  return &link->stats;
+}
+
+//--------------------------------------------------------------------+
+// Transmit
+//--------------------------------------------------------------------+
+
+// @brief Push the queued bytes to the port, as many as it takes
+static void tx_flush(split_link_t* link)
+{
+  while (link->tx_head != link->tx_tail)
+  {
+    uint offset = link->tx_tail & (SPLIT_TX_SIZE - 1);
+    uint count = link->tx_head - link->tx_tail;
+    if (count > SPLIT_TX_SIZE - offset) count = SPLIT_TX_SIZE - offset;
+
+    uint taken = link->port->write(link->port->ctx, &link->tx[offset], count);
+    link->tx_tail += taken;
+    if (taken < count) break;
+  }
+}
+
+// @brief Queue a whole frame, or nothing
+static bool tx_queue(split_link_t* link, uint8_t const* frame, uint len)
+{
+  if (SPLIT_TX_SIZE - (link->tx_head - link->tx_tail) < len) {
+    link->stats.tx_full++;
+    return false;
+  }
+
+  for (uint i = 0; i < len; ++i) {
+    link->tx[(link->tx_head + i) & (SPLIT_TX_SIZE - 1)] = frame[i];
+  }
+  link->tx_head += len;
+  link->stats.frames_tx++;
+  return true;
+}
+
+// @brief Left: queue a sample as a delta against the last one queued, or whole
+// The frame is kept for going back to it
+static bool send_sample(split_link_t* link, uint64_t sample, uint32_t now_us, bool full)
+{
+  uint8_t payload[SPLIT_PAYLOAD_MAX];
+  uint len = 0;
+
+  // Every frame kept: the oldest one the right half may still ask for is dropped,
+  // a full sample does not need it
+  bool window_full = (uint8_t) (link->next - link->base) >= SPLIT_HISTORY;
+
+  uint64_t diff = sample ^ link->sent;
+  if (!full && !window_full && diff != 0)
+  {
+    uint8_t mask = 0;
+    len = 1;
+    for (uint i = 0; i < 8; ++i) {
+      uint8_t byte = (uint8_t) (diff >> (8 * i));
+      if (byte == 0) continue;
+      mask |= (uint8_t) (1u << i);
+      payload[len++] = byte;
+    }
+    payload[0] = mask;
+    if (len - 1 > DELTA_BYTES_MAX) full = true;
+  }
+  else
+  {
+    full = true;
+  }
+
+  if (full) {
+    for (uint i = 0; i < FULL_PAYLOAD; ++i) payload[i] = (uint8_t) (sample >> (8 * i));
+    len = FULL_PAYLOAD;
+  }
+
+  uint slot = link->next % SPLIT_HISTORY;
+  uint8_t* frame = link->history[slot];
+  uint frame_len = frame_encode(frame, full ? SPLIT_FRAME_FULL : SPLIT_FRAME_DELTA, link->next, payload, len);
+  if (!tx_queue(link, frame, frame_len)) return false;
+
+  link->history_len[slot] = (uint8_t) frame_len;
+  if (window_full) link->base = link->next;
+  link->next++;
+  link->sent = sample;
+  link->sent_us = now_us;
+
+  if (full) {
+    link->stats.fulls++;
+  } else {
+    link->stats.deltas++;
+  }
+  return true;
+}
+
+void split_link_send(split_link_t* link, uint64_t sample, uint32_t now_us)
+{
+  if (link->role != SPLIT_ROLE_PERIPHERAL) return;
+
+  if (sample != link->sent) {
+    send_sample(link, sample, now_us, false);
+  } else if (now_us - link->sent_us >= SPLIT_KEEPALIVE_US) {
+    send_sample(link, sample, now_us, true);
+  }
+  tx_flush(link);
+}
+
+void split_link_sync(split_link_t* link, uint32_t period_us)
+{
+  if (link->role != SPLIT_ROLE_CONTROLLER) return;
+
+  uint8_t payload[SYNC_PAYLOAD] = {
+    (uint8_t) period_us, (uint8_t) (period_us >> 8),
+    link->need_full ? SPLIT_SYNC_NEED_FULL : 0,
+  };
+  uint8_t frame[SPLIT_FRAME_MAX];
+  uint len = frame_encode(frame, SPLIT_FRAME_SYNC, link->expected, payload, SYNC_PAYLOAD);
+
+  if (tx_queue(link, frame, len)) link->stats.syncs++;
+  tx_flush(link);
+}
+
+//--------------------------------------------------------------------+
+// Receive
+//--------------------------------------------------------------------+
+
+// @brief Right: apply a sample frame in sequence
+// @return true if the sample changed
+static bool receive_sample(split_link_t* link, split_frame_type_t type, uint8_t seq, uint8_t const* payload, uint len)
+{
+  uint64_t state = link->state;
+
+  if (type == SPLIT_FRAME_FULL)
+  {
+    // A whole sample starts over at any seq, except a go-back-N resend of one
+    // already applied: it would roll the state back until the deltas after it
+    // arrive again. Older seqs (the left half restarted) are taken.
+    uint8_t behind = (uint8_t) (link->expected - seq);
+    if (!link->need_full && behind != 0 && behind <= SPLIT_HISTORY) {
+      link->stats.sequence++;
+      return false;
+    }
+
+    state = 0;
+    for (uint i = 0; i < FULL_PAYLOAD; ++i) state |= (uint64_t) payload[i] << (8 * i);
+    link->need_full = false;
+    link->stats.fulls++;
+  }
+  else
+  {
+    if ((uint) __builtin_popcount(payload[0]) != len - 1) {
+      link->stats.crc_errors++;
+      return false;
+    }
+
+    // Only on top of the sample before it: a gap or a frame seen twice waits for go-back-N
+    if (link->need_full || seq != link->expected) {
+      link->stats.sequence++;
+      return false;
+    }
+
+    uint k = 1;
+    for (uint i = 0; i < 8; ++i) {
+      if (payload[0] & (1u << i)) state ^= (uint64_t) payload[k++] << (8 * i);
+    }
+    link->stats.deltas++;
+  }
+
+  link->expected = (uint8_t) (seq + 1);
+
+  bool changed = (state != link->state);
+  link->state = state;
+  return changed;
+}
+
+// @brief Left: the right half's SYNC, acknowledges and asks for the lost frames
+static void receive_sync(split_link_t* link, uint8_t expected, uint8_t const* payload, uint32_t now_us)
+{
+  link->sync_us = now_us;
+  link->sync_count++;
+  link->period_us = (uint16_t) (payload[0] | (payload[1] << 8));
+
+  uint8_t outstanding = (uint8_t) (link->next - link->base);
+  uint8_t acked = (uint8_t) (expected - link->base);
+
+  if ((payload[2] & SPLIT_SYNC_NEED_FULL) || acked > outstanding)
+  {
+    // Lost track (the right half restarted, or asks for a frame no longer kept)
+    send_sample(link, link->sent, now_us, true);
+  }
+  else
+  {
+    link->base = expected;
+
+    // Frames queued before the previous SYNC had time to arrive: go back to the first one missing
+    uint8_t early = (uint8_t) (link->mark - link->base);
+    if (early != 0 && early <= (uint8_t) (link->next - link->base)) {
+      for (uint8_t seq = link->base; seq != link->next; ++seq) {
+        uint slot = seq % SPLIT_HISTORY;
+        if (!tx_queue(link, link->history[slot], link->history_len[slot])) break;
+        link->stats.retransmits++;
+      }
+    }
+  }
+
+  link->mark = link->next;
+}
+
+// @brief A frame passed its CRC
+static bool receive_frame(split_link_t* link, uint32_t now_us)
+{
+  split_frame_type_t type = (split_frame_type_t) (link->rx[FRAME_TYPE_LEN] >> 4);
+  uint len = link->rx[FRAME_TYPE_LEN] & 0x0f;
+  uint8_t seq = link->rx[FRAME_SEQ];
+  uint8_t const* payload = &link->rx[FRAME_PAYLOAD];
+
+  link->stats.frames_rx++;
+  link->rx_valid_us = now_us;
+  link->up = true;
+
+  if (link->role == SPLIT_ROLE_CONTROLLER) {
+    if (type == SPLIT_FRAME_FULL || type == SPLIT_FRAME_DELTA) return receive_sample(link, type, seq, payload, len);
+  } else if (type == SPLIT_FRAME_SYNC) {
+    receive_sync(link, seq, payload, now_us);
+  }
+  return false;
+}
+
+// @brief Payload length a frame header may carry
+static bool header_valid(uint8_t type_len)
+{
+  uint len = type_len & 0x0f;
+
+  switch (type_len >> 4)
+  {
+    case SPLIT_FRAME_FULL:
+      return len == FULL_PAYLOAD;
+
+    case SPLIT_FRAME_DELTA:
+      return len >= 2 && len <= DELTA_BYTES_MAX + 1;
+
+    case SPLIT_FRAME_SYNC:
+      return len == SYNC_PAYLOAD;
+
+    default:
+      return false;
+  }
+}
+
+static bool receive_byte(split_link_t* link, uint8_t byte, uint32_t now_us);
+
+// @brief Drop the frame start, look for another one in the bytes after it
+static bool receive_resync(split_link_t* link, uint32_t now_us)
+{
+  uint8_t bytes[SPLIT_FRAME_MAX];
+  uint count = link->rx_len - 1;
+  memcpy(bytes, &link->rx[1], count);
+  link->rx_len = 0;
+
+  bool changed = false;
+  for (uint i = 0; i < count; ++i) {
+    changed |= receive_byte(link, bytes[i], now_us);
+  }
+  return changed;
+}
+
+// @brief Frame assembly, one byte at a time
+static bool receive_byte(split_link_t* link, uint8_t byte, uint32_t now_us)
+{
+  if (link->rx_len == 0 && byte != SPLIT_FRAME_START) return false;
+
+  link->rx[link->rx_len++] = byte;
+
+  if (link->rx_len == FRAME_TYPE_LEN + 1 && !header_valid(byte)) {
+    link->stats.crc_errors++;
+    return receive_resync(link, now_us);
+  }
+  if (link->rx_len < SPLIT_FRAME_HEAD) return false;
+
+  uint len = link->rx[FRAME_TYPE_LEN] & 0x0f;
+  if (link->rx_len < SPLIT_FRAME_HEAD + len + 2) return false;
+
+  uint16_t crc = crc16(0xffff, &link->rx[FRAME_TYPE_LEN], 2 + len);
+  if (link->rx[FRAME_PAYLOAD + len] != (uint8_t) crc || link->rx[FRAME_PAYLOAD + len + 1] != (uint8_t) (crc >> 8)) {
+    link->stats.crc_errors++;
+    return receive_resync(link, now_us);
+  }
+
+  link->rx_len = 0;
+  return receive_frame(link, now_us);
+}
+
+bool split_link_poll(split_link_t* link, uint32_t now_us)
+{
+  uint8_t buf[32];
+  uint count;
+  bool changed = false;
+
+  while ((count = link->port->read(link->port->ctx, buf, sizeof(buf))) > 0) {
+    for (uint i = 0; i < count; ++i) {
+      changed |= receive_byte(link, buf[i], now_us);
+    }
+  }
+
+  // Quiet for too long: the right half lets go of the other half's keys
+  if (link->up && now_us - link->rx_valid_us >= SPLIT_TIMEOUT_US) {
+    link->up = false;
+    link->stats.link_down++;
+    if (link->role == SPLIT_ROLE_CONTROLLER) {
+      changed |= (link->state != 0);
+      link->state = 0;
+      link->need_full = true;
+    }
+  }
+
+  tx_flush(link);
+  return changed;
+}
+
+//--------------------------------------------------------------------+
+// Phase lock (left)
+//--------------------------------------------------------------------+
+
+void split_link_align(split_link_t* link, sched_stage_t* scan, uint32_t scan_us)
+{
+  if (link->sync_count == link->aligned_count || !link->up || link->period_us == 0) return;
+  link->aligned_count = link->sync_count;
+
+  if (scan->period_us != link->period_us) scheduler_set_period(scan, link->period_us);
+
+  // The right half sends its SYNC as its scan starts; this scan should end
+  // and its sample (a one key delta) arrive a guard before the next one
+  uint32_t right_scan_us = link->sync_us - SPLIT_BYTES_US(SPLIT_FRAME_HEAD + SYNC_PAYLOAD + 2);
+  uint32_t lead_us = scan_us + SPLIT_BYTES_US(SPLIT_FRAME_HEAD + 2 + 2) + SPLIT_GUARD_US;
+  uint32_t slot_us = right_scan_us + link->period_us - lead_us;
+
+  // Half the error per SYNC, like the USB frame lock
+  if (scheduler_align(scan, slot_us) != 0) link->stats.syncs++;
+}
+
+#endif // SPLIT_LINK
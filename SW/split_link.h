@@ -0,0 +1,204 @@
+// Split keyboard link
+// This board is the right half of a JIS split layout. The left half has its
+// own controller (same matrix, same firmware built with SPLIT_PERIPHERAL=1)
+// that scans its switches and sends the raw samples over a full-duplex UART
+// (split_uart.c, SPLIT_BAUD). The right half merges them into key state word
+// 1 ahead of its own debounce, so both halves go through the same debounce,
+// combos, tap-hold and layer resolution and leave as one USB device:
+//
+//   key = SPLIT_KEY_FIRST + row * NUM_COLS + col     (the left half's switch)
+//
+// Frames, both directions (CRC-16/CCITT over type / len, seq and payload):
+//
+//   0xa5 | type << 4 | len | seq | payload[len] | crc lo | crc hi
+//
+//   left -> right  SPLIT_FRAME_FULL   the whole sample (8 bytes, little endian)
+//                  SPLIT_FRAME_DELTA  mask of the changed bytes, then those
+//                                     bytes XORed with the previous sample
+//   right -> left  SPLIT_FRAME_SYNC   seq = next sample seq expected, scan
+//                                     period (2 bytes), SPLIT_SYNC_* flags
+//
+// The left half only sends a sample that changed (one key: a 7 byte delta,
+// 23us at 3 Mbaud), and a full sample every SPLIT_KEEPALIVE_US. Samples are
+// numbered and applied strictly in order: a frame with a bad CRC or out of
+// sequence is dropped, the next SYNC still asks for its seq and the left half
+// goes back to it (go-back-N from the last SPLIT_HISTORY frames, else a full
+// sample). The right half sends a SYNC at the start of every scan; the left
+// half phase-locks its scan to them so a sample lands just before the scan
+// that merges it (split_link_align()), which keeps the link's added latency
+// to one frame plus a guard instead of up to a scan period.
+//
+// The protocol code only moves bytes through a split_port_t, so the host
+// build runs it against the simulated UART (host/sim.c) and against a
+// pseudo-terminal or socket pair (host/link.c).
+//
+// Built with SPLIT_LINK=1 (CMake option SPLIT_LINK, default OFF); otherwise
+// KEY_WORDS is 1 and keyboard.c has no link.
+
+#ifndef SPLIT_LINK_H_
+#define SPLIT_LINK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "scheduler.h"
+
+#ifndef SPLIT_LINK
+#define SPLIT_LINK  0
+#endif
+
+// The left half's build: scan and send, no USB
+#ifndef SPLIT_PERIPHERAL
+#define SPLIT_PERIPHERAL  0
+#endif
+
+// Key state words: 0 = this half's matrix and the virtual keys (action.h),
+// 1 = the other half's matrix
+#if SPLIT_LINK
+#define KEY_WORDS  2
+#else
+#define KEY_WORDS  1
+#endif
+
+// Key of the other half's row 0, col 0
+#define SPLIT_KEY_FIRST  64
+
+#ifndef SPLIT_BAUD
+#define SPLIT_BAUD  3000000
+#endif
+
+// Wire time of n bytes (8N1), rounded up
+#define SPLIT_BYTES_US(n)  ((uint32_t) (((n) * 10ULL * 1000000 + SPLIT_BAUD - 1) / SPLIT_BAUD))
+
+#define SPLIT_FRAME_START    0xa5
+#define SPLIT_FRAME_HEAD     3                            // start, type / len, seq
+#define SPLIT_PAYLOAD_MAX    9
+#define SPLIT_FRAME_MAX      (SPLIT_FRAME_HEAD + SPLIT_PAYLOAD_MAX + 2)
+
+typedef enum
+{
+  SPLIT_FRAME_FULL = 1,
+  SPLIT_FRAME_DELTA,
+  SPLIT_FRAME_SYNC,
+} split_frame_type_t;
+
+// SYNC flags
+#define SPLIT_SYNC_NEED_FULL  (1u << 0)   // no sample to apply a delta to
+
+// Frames the left half keeps for going back to a lost one
+#define SPLIT_HISTORY        8
+
+// Left: a full sample at least this often, so a quiet link is told from a dead one
+#define SPLIT_KEEPALIVE_US   20000
+
+// Nothing valid received for this long: link down, the right half releases
+// the other half's keys and waits for a full sample
+#define SPLIT_TIMEOUT_US     60000
+
+// Left: its sample arrives this long ahead of the right half's scan, on top
+// of its own scan time and the frame
+#define SPLIT_GUARD_US       20
+
+// Transmit ring, a power of 2
+#define SPLIT_TX_SIZE        64
+
+typedef enum
+{
+  SPLIT_ROLE_CONTROLLER = 0,   // right half, USB: receives samples, sends SYNCs
+  SPLIT_ROLE_PERIPHERAL,       // left half: sends samples, follows the SYNCs
+} split_role_t;
+
+// Non-blocking byte transport to the other half
+typedef struct
+{
+  // @return bytes taken (up to len, 0 if none)
+  uint (*read)(void* ctx, uint8_t* buf, uint len);
+  uint (*write)(void* ctx, uint8_t const* buf, uint len);
+  void* ctx;
+} split_port_t;
+
+typedef struct
+{
+  uint32_t frames_tx;      // frames queued, retransmissions included
+  uint32_t frames_rx;      // valid frames received
+  uint32_t deltas;         // samples sent / applied as a delta
+  uint32_t fulls;          // samples sent / applied whole
+  uint32_t crc_errors;     // frames dropped on a bad CRC, header or delta mask
+  uint32_t sequence;       // samples dropped out of sequence
+  uint32_t retransmits;    // left: frames sent again after a SYNC asked for them
+  uint32_t tx_full;        // frames not queued, the ring was full
+  uint32_t link_down;      // times the other half went quiet for SPLIT_TIMEOUT_US
+  uint32_t syncs;          // SYNCs sent (right) / scan phase corrections (left)
+} split_link_stats_t;
+
+typedef struct
+{
+  split_port_t const* port;
+  split_role_t role;
+
+  // Receive: frame being assembled
+  uint8_t  rx[SPLIT_FRAME_MAX];
+  uint     rx_len;
+  uint32_t rx_valid_us;        // last valid frame
+  bool     up;
+
+  // Transmit ring
+  uint8_t  tx[SPLIT_TX_SIZE];
+  uint32_t tx_head, tx_tail;
+
+  // Right: the other half's sample
+  uint64_t state;
+  uint8_t  expected;           // seq of the next sample
+  bool     need_full;
+
+  // Left: samples sent, the frames not acknowledged yet
+  uint64_t sent;               // sample of the last frame queued
+  uint8_t  next;               // seq of the next sample
+  uint8_t  base;               // oldest seq the right half may still ask for
+  uint8_t  mark;               // next at the previous SYNC
+  uint32_t sent_us;            // last sample frame queued
+  uint8_t  history[SPLIT_HISTORY][SPLIT_FRAME_MAX];
+  uint8_t  history_len[SPLIT_HISTORY];
+
+  // Left: the right half's last SYNC
+  uint32_t sync_us;            // its last byte arrived
+  uint32_t sync_count;
+  uint32_t aligned_count;      // sync_count at the last split_link_align()
+  uint16_t period_us;          // right half's scan period
+
+  split_link_stats_t stats;
+} split_link_t;
+
+// @brief Reset a link end, nothing received yet
+void split_link_init(split_link_t* link, split_port_t const* port, split_role_t role, uint32_t now_us);
+
+// @brief Take the received bytes, answer them, and push the queued bytes out
+// Call often: the right half at the start of every scan, the left half in
+// its main loop (a SYNC is timed when it is seen here).
+// @return true if the other half's sample changed (right)
+bool split_link_poll(split_link_t* link, uint32_t now_us);
+
+// @brief Right: the other half's latest sample, 0 while the link is down
+uint64_t split_link_state(split_link_t const* link);
+
+// @brief Right: queue a SYNC, call at the start of every scan
+void split_link_sync(split_link_t* link, uint32_t period_us);
+
+// @brief Left: queue a frame if the sample changed or the keepalive is due
+void split_link_send(split_link_t* link, uint64_t sample, uint32_t now_us);
+
+// @brief Left: move the scan stage toward its slot before the right half's scan,
+// once per SYNC, and follow the right half's scan period
+// @param scan_us the left half's scan time
+void split_link_align(split_link_t* link, sched_stage_t* scan, uint32_t scan_us);
+
+// @brief Valid frames arrive
+bool split_link_up(split_link_t const* link);
+
+split_link_stats_t const* split_link_stats(split_link_t const* link);
+
+// @brief Byte transport of this half, set up on the first call
+// Provided by the platform: split_uart.c on the RP2040, host/sim.c on the host
+split_port_t const* split_port(void);
+
+#endif /* SPLIT_LINK_H_ */
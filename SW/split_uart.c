@@ -0,0 +1,59 @@
+// Split link transport on the RP2040 (split_link.h)
+// UART0 at SPLIT_BAUD 8N1, TX on GPIO 12 and RX on GPIO 13, crossed over to
+// the other half (TX -> RX). The 32 byte hardware FIFOs hold a few frames each
+// way, so read / write never wait.
+
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+
+#include "split_link.h"
+
+#if SPLIT_LINK
+
+#define SPLIT_UART         uart0
+#define SPLIT_GPIO_TX      (12)
+#define SPLIT_GPIO_RX      (13)
+
+static uint split_uart_read(void* ctx, uint8_t* buf, uint len)
+{
+  (void) ctx;
+  uint count = 0;
+
+  while (count < len && uart_is_readable(SPLIT_UART)) {
+    buf[count++] = (uint8_t) uart_getc(SPLIT_UART);
+  }
+  return count;
+}
+
+static uint split_uart_write(void* ctx, uint8_t const* buf, uint len)
+{
+  (void) ctx;
+  uint count = 0;
+
+  while (count < len && uart_is_writable(SPLIT_UART)) {
+    uart_putc_raw(SPLIT_UART, (char) buf[count++]);
+  }
+  return count;
+}
+
+split_port_t const* split_port(void)
+{
+  static split_port_t const port = { split_uart_read, split_uart_write, NULL };
+  static bool initialized = false;
+
+  if (!initialized) {
+    uart_init(SPLIT_UART, SPLIT_BAUD);
+    uart_set_format(SPLIT_UART, 8, 1, UART_PARITY_NONE);
+    uart_set_hw_flow(SPLIT_UART, false, false);
+    uart_set_fifo_enabled(SPLIT_UART, true);
+    gpio_set_function(SPLIT_GPIO_TX, GPIO_FUNC_UART);
+    gpio_set_function(SPLIT_GPIO_RX, GPIO_FUNC_UART);
+
+    // An unplugged cable idles high instead of reading noise as start bits
+    gpio_pull_up(SPLIT_GPIO_RX);
+    initialized = true;
+  }
+  return &port;
+}
+
+#endif // SPLIT_LINK
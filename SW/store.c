@@ -0,0 +1,395 @@
+// Log-structured config store, see store.h
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/time.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+
+#include "crc16.h"
+#include "store.h"
+
+#define STORE_MAGIC         0x534b4745u   // "EGKS"
+#define STORE_HEADER_SIZE   16
+#define STORE_RECORD_HEAD   4             // type, len, id
+#define STORE_RECORD_CRC    2
+#define STORE_TYPE_FREE     0xff
+
+// Longest a flash operation may wait for core1 to park
+#define STORE_LOCKOUT_TIMEOUT_MS  10
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t signature;
+  uint16_t crc;
+  uint16_t reserved;
+} store_header_t;
+
+_Static_assert(sizeof(store_header_t) == STORE_HEADER_SIZE, "store header size");
+
+typedef enum
+{
+  STORE_IDLE = 0,
+  STORE_ERASE,        // erase the snapshot target
+  STORE_PROGRAM,      // program the snapshot pages, header left blank
+  STORE_HEADER,       // program the header, the snapshot becomes live
+} store_phase_t;
+
+static uint32_t         s_signature;
+static store_replay_t   s_replay;
+static store_snapshot_t s_snapshot;
+
+static uint     s_block;          // live block
+static uint32_t s_write;          // next free byte in the live block
+static bool     s_compact;        // snapshot due (buffer overflow, torn record, no live block)
+
+// Records not yet in flash
+static uint8_t  s_pending[STORE_PENDING_SIZE];
+static uint32_t s_pending_len;
+
+// Snapshot being written
+static store_phase_t s_phase;
+static uint8_t  s_image[STORE_BLOCK_SIZE];
+static uint32_t s_image_len;
+static bool     s_image_overflow;
+static uint     s_target;
+static uint32_t s_target_page;
+
+static store_stats_t s_stats;
+
+//--------------------------------------------------------------------+
+// Helpers
+//--------------------------------------------------------------------+
+
+static inline uint32_t record_size(uint8_t len)
+{
+  return (STORE_RECORD_HEAD + len + STORE_RECORD_CRC + 3u) & ~3u;
+}
+
+static uint8_t const* block_data(uint block)
+{
+  return (uint8_t const*) (XIP_BASE + STORE_OFFSET + block * STORE_BLOCK_SIZE);
+}
+
+static uint32_t block_offset(uint block)
+{
+  return STORE_OFFSET + block * STORE_BLOCK_SIZE;
+}
+
+// @brief Encode a record at dst, which has room for record_size(len) bytes
+static void record_encode(uint8_t* dst, uint8_t type, uint16_t id, void const* data, uint8_t len)
+{
+  uint32_t size = record_size(len);
+  memset(dst, 0xff, size);
+
+  dst[0] = type;
+  dst[1] = len;
+  dst[2] = (uint8_t) id;
+  dst[3] = (uint8_t) (id >> 8);
+  if (len) memcpy(dst + STORE_RECORD_HEAD, data, len);
+
+  uint16_t crc = crc16(0xffff, dst, STORE_RECORD_HEAD + len);
+  dst[STORE_RECORD_HEAD + len]     = (uint8_t) crc;
+  dst[STORE_RECORD_HEAD + len + 1] = (uint8_t) (crc >> 8);
+}
+
+static uint16_t header_crc(store_header_t const* header)
+{
+  return crc16(0xffff, (uint8_t const*) header, offsetof(store_header_t, crc));
+}
+
+//--------------------------------------------------------------------+
+// Flash access, both cores parked
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint32_t       offset;
+  uint8_t const* data;
+} store_flash_op_t;
+
+static void flash_program_fn(void* param)
+{
+  store_flash_op_t const* op = (store_flash_op_t const*) param;
+  flash_range_program(op->offset, op->data, FLASH_PAGE_SIZE);
+}
+
+static void flash_erase_fn(void* param)
+{
+  store_flash_op_t const* op = (store_flash_op_t const*) param;
+  flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+}
+
+static bool flash_program_page(uint32_t offset, uint8_t const* page)
+{
+  store_flash_op_t op = { .offset = offset, .data = page };
+  if (flash_safe_execute(flash_program_fn, &op, STORE_LOCKOUT_TIMEOUT_MS) != PICO_OK) return false;
+  s_stats.programs++;
+  return true;
+}
+
+static bool flash_erase_sector(uint32_t offset)
+{
+  store_flash_op_t op = { .offset = offset, .data = NULL };
+  if (flash_safe_execute(flash_erase_fn, &op, STORE_LOCKOUT_TIMEOUT_MS) != PICO_OK) return false;
+  s_stats.erases++;
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Replay
+//--------------------------------------------------------------------+
+
+// @brief Header of a block, NULL if it was never completed
+static store_header_t const* block_header(uint block)
+{
+  store_header_t const* header = (store_header_t const*) block_data(block);
+  if (header->magic != STORE_MAGIC || header->crc != header_crc(header)) return NULL;
+  return header;
+}
+
+// @brief Replay the records of a block
+// @return offset of the first free byte
+static uint32_t block_replay(uint block)
+{
+  uint8_t const* data = block_data(block);
+  uint32_t offset = STORE_HEADER_SIZE;
+
+  while (offset + STORE_RECORD_HEAD <= STORE_BLOCK_SIZE && data[offset] != STORE_TYPE_FREE)
+  {
+    uint8_t len = data[offset + 1];
+    uint32_t size = record_size(len);
+
+    // Torn append: nothing after it can be trusted, rewrite the block
+    // The length is checked first, the CRC of a torn one could lie past the block
+    bool valid = (offset + size <= STORE_BLOCK_SIZE);
+    if (valid) {
+      uint16_t crc = (uint16_t) (data[offset + STORE_RECORD_HEAD + len] |
+                                 (data[offset + STORE_RECORD_HEAD + len + 1] << 8));
+      valid = (crc == crc16(0xffff, data + offset, STORE_RECORD_HEAD + len));
+    }
+    if (!valid) {
+      s_compact = true;
+      return STORE_BLOCK_SIZE;
+    }
+
+    s_replay(data[offset], (uint16_t) (data[offset + 2] | (data[offset + 3] << 8)),
+             data + offset + STORE_RECORD_HEAD, len);
+    s_stats.replay_records++;
+    offset += size;
+  }
+
+  return offset;
+}
+
+void store_init(uint32_t signature, store_replay_t replay, store_snapshot_t snapshot)
+{
+  uint32_t start_us = time_us_32();
+
+  s_signature = signature;
+  s_replay = replay;
+  s_snapshot = snapshot;
+  s_pending_len = 0;
+  s_phase = STORE_IDLE;
+  memset(&s_stats, 0, sizeof(s_stats));
+
+  // Newest completed block, sequence numbers may wrap
+  store_header_t const* newest = NULL;
+  for (uint block = 0; block < STORE_BLOCK_COUNT; ++block)
+  {
+    store_header_t const* header = block_header(block);
+    if (header && (newest == NULL || (int32_t) (header->seq - newest->seq) > 0)) {
+      newest = header;
+      s_block = block;
+    }
+  }
+
+  s_compact = false;
+  if (newest == NULL || newest->signature != signature)
+  {
+    // Nothing saved for these defaults: the first change writes a fresh block
+    s_stats.seq = newest ? newest->seq : 0;
+    if (newest == NULL) s_block = STORE_BLOCK_COUNT - 1;
+    s_write = STORE_BLOCK_SIZE;
+  }
+  else
+  {
+    s_stats.seq = newest->seq;
+    s_write = block_replay(s_block);
+  }
+
+  s_stats.replay_us = time_us_32() - start_us;
+}
+
+//--------------------------------------------------------------------+
+// Writing
+//--------------------------------------------------------------------+
+
+void store_append(uint8_t type, uint16_t id, void const* data, uint8_t len)
+{
+  uint32_t size = record_size(len);
+
+  if (s_pending_len + size > STORE_PENDING_SIZE) {
+    // The snapshot holds every change, the queued records are not needed
+    s_pending_len = 0;
+    s_compact = true;
+    return;
+  }
+
+  record_encode(&s_pending[s_pending_len], type, id, data, len);
+  s_pending_len += size;
+}
+
+void store_snapshot_record(uint8_t type, uint16_t id, void const* data, uint8_t len)
+{
+  uint32_t size = record_size(len);
+
+  if (s_image_len + size > STORE_BLOCK_SIZE) {
+    s_image_overflow = true;
+    return;
+  }
+
+  record_encode(&s_image[s_image_len], type, id, data, len);
+  s_image_len += size;
+}
+
+void store_compact(void)
+{
+  s_compact = true;
+}
+
+bool store_busy(void)
+{
+  return s_phase != STORE_IDLE || s_compact || s_pending_len != 0;
+}
+
+// @brief Build the snapshot image and start writing it to the next block
+static void snapshot_start(void)
+{
+  memset(s_image, 0xff, sizeof(s_image));
+  s_image_len = STORE_HEADER_SIZE;
+  s_image_overflow = false;
+
+  // The snapshot includes everything queued so far
+  s_pending_len = 0;
+  s_compact = false;
+  s_snapshot();
+
+  if (s_image_overflow) {
+    s_stats.failures++;
+    return;
+  }
+
+  s_target = (s_block + 1) % STORE_BLOCK_COUNT;
+  s_target_page = 0;
+  s_phase = STORE_ERASE;
+}
+
+// @brief Program the next page of the snapshot, then its header
+static void snapshot_step(void)
+{
+  uint32_t offset = block_offset(s_target);
+
+  switch (s_phase)
+  {
+    case STORE_ERASE:
+    {
+      // Skip the erase if the block is still blank
+      uint8_t const* data = block_data(s_target);
+      bool blank = true;
+      for (uint32_t i = 0; i < STORE_BLOCK_SIZE && blank; i += 4) {
+        blank = (*(uint32_t const*) (data + i) == 0xffffffffu);
+      }
+      if (blank || flash_erase_sector(offset)) s_phase = STORE_PROGRAM;
+      break;
+    }
+
+    case STORE_PROGRAM:
+    {
+      // Page 0 without the header first, the header goes last
+      static uint8_t page[FLASH_PAGE_SIZE];
+      memcpy(page, &s_image[s_target_page * FLASH_PAGE_SIZE], FLASH_PAGE_SIZE);
+      if (s_target_page == 0) memset(page, 0xff, STORE_HEADER_SIZE);
+
+      if (flash_program_page(offset + s_target_page * FLASH_PAGE_SIZE, page)) {
+        s_target_page++;
+        if (s_target_page * FLASH_PAGE_SIZE >= s_image_len) s_phase = STORE_HEADER;
+      }
+      break;
+    }
+
+    case STORE_HEADER:
+    {
+      static uint8_t page[FLASH_PAGE_SIZE];
+      store_header_t header = {
+        .magic     = STORE_MAGIC,
+        .seq       = s_stats.seq + 1,
+        .signature = s_signature,
+        .reserved  = 0xffff,
+      };
+      header.crc = header_crc(&header);
+
+      memset(page, 0xff, sizeof(page));
+      memcpy(page, &header, sizeof(header));
+
+      if (flash_program_page(offset, page)) {
+        s_stats.seq = header.seq;
+        s_stats.snapshots++;
+        s_block = s_target;
+        s_write = s_image_len;
+        s_phase = STORE_IDLE;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+// @brief Program the page holding the next pending bytes
+static void append_step(void)
+{
+  static uint8_t page[FLASH_PAGE_SIZE];
+
+  uint32_t page_start = s_write & ~(FLASH_PAGE_SIZE - 1u);
+  uint32_t in_page = s_write - page_start;
+  uint32_t count = FLASH_PAGE_SIZE - in_page;
+  if (count > s_pending_len) count = s_pending_len;
+
+  // 0xff leaves the bytes already programmed in this page unchanged
+  memset(page, 0xff, sizeof(page));
+  memcpy(&page[in_page], s_pending, count);
+
+  if (!flash_program_page(block_offset(s_block) + page_start, page)) return;
+
+  s_write += count;
+  s_pending_len -= count;
+  memmove(s_pending, &s_pending[count], s_pending_len);
+}
+
+void store_task(void)
+{
+  if (s_phase != STORE_IDLE) {
+    snapshot_step();
+    return;
+  }
+
+  if (!s_compact && s_pending_len != 0 && s_write + s_pending_len > STORE_BLOCK_SIZE) {
+    s_compact = true;
+  }
+
+  if (s_compact) {
+    snapshot_start();
+  } else if (s_pending_len != 0) {
+    append_step();
+  }
+}
+
+store_stats_t const* store_stats(void)
+{
+  return &s_stats;
+}
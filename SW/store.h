@@ -0,0 +1,73 @@
+// Log-structured config store in the last flash sectors (core0)
+// The store is a ring of STORE_BLOCK_COUNT sectors, only the newest one is
+// live. A block starts with a header (magic, sequence number, signature of
+// the firmware's defaults) followed by records:
+//   type (1), len (1), id (2), payload (len), CRC-16 (2), padded to 4 bytes
+// Records are appended by programming 0xFF over the bytes already written,
+// so a change costs one page program, never an erase. The last record of a
+// (type, id) wins. When the live block is full the current state is written
+// as a snapshot into the next block of the ring, which spreads the erases
+// over all blocks; the old block stays valid until the new header is written.
+//
+// Flash work stalls both cores (XIP is off while programming), so it is
+// never done on a key event: store_append() only queues the record in RAM
+// and store_task() does one page program or one sector erase per call, run
+// by keyboard.c once the keyboard has been idle for a while.
+
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/types.h"
+#include "hardware/flash.h"
+
+#define STORE_BLOCK_COUNT    4
+#define STORE_BLOCK_SIZE     FLASH_SECTOR_SIZE
+#define STORE_OFFSET         (PICO_FLASH_SIZE_BYTES - STORE_BLOCK_COUNT * STORE_BLOCK_SIZE)
+
+// Appended records waiting for flash, a full buffer makes the next store_task() write a snapshot
+#define STORE_PENDING_SIZE   256
+
+// Largest payload of one record
+#define STORE_PAYLOAD_MAX    255
+
+// @brief Replay one saved record
+typedef void (*store_replay_t)(uint8_t type, uint16_t id, uint8_t const* data, uint8_t len);
+
+// @brief Write the whole current state with store_snapshot_record()
+typedef void (*store_snapshot_t)(void);
+
+typedef struct
+{
+  uint32_t seq;              // sequence number of the live block
+  uint32_t replay_records;
+  uint32_t replay_us;        // store_init() time
+  uint32_t programs;         // page programs
+  uint32_t erases;
+  uint32_t snapshots;
+  uint32_t failures;         // snapshot larger than a block, changes kept in RAM only
+} store_stats_t;
+
+// @brief Find the newest block and replay it
+// Blocks written for another signature (different generated defaults) are ignored
+void store_init(uint32_t signature, store_replay_t replay, store_snapshot_t snapshot);
+
+// @brief Queue a record for the live block
+void store_append(uint8_t type, uint16_t id, void const* data, uint8_t len);
+
+// @brief Add a record to the snapshot being built, only from the snapshot callback
+void store_snapshot_record(uint8_t type, uint16_t id, void const* data, uint8_t len);
+
+// @brief Write the whole state again as a snapshot (e.g. after a reset to defaults)
+void store_compact(void);
+
+// @brief Flash work is waiting for store_task()
+bool store_busy(void);
+
+// @brief Do one flash operation, call only while nothing else needs the cores
+void store_task(void);
+
+store_stats_t const* store_stats(void);
+
+#endif /* STORE_H_ */
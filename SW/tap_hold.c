@@ -0,0 +1,149 @@
+// Tap-hold (dual-role) keys, see tap_hold.h
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "matrix_scan.h"
+#include "action.h"
+#include "tap_hold.h"
+
+static tap_hold_output_t s_output;
+
+// Undecided key
+static bool        s_pending;
+static key_event_t s_pending_press;
+static uint8_t     s_pending_index;       // keymap_tap_hold_entry()
+static uint64_t    s_pressed_since[KEY_WORDS];   // keys pressed after it (permissive hold)
+
+// Events after the undecided key, in arrival order
+static key_event_t s_buffer[TAP_HOLD_BUFFER_SIZE];
+static uint        s_buffered;
+
+static tap_hold_stats_t s_stats;
+
+// @brief Pass an event on, or start waiting if it presses a tap-hold key
+static void tap_hold_dispatch(key_event_t const* event)
+{
+  if (!event->pressed) {
+    s_output(event->key, false, (key_action_t) { KEY_ACTION_NONE, 0 });
+    return;
+  }
+
+  key_action_t action = action_resolve(event->key);
+  if (action.type == KEY_ACTION_TAP_HOLD && keymap_tap_hold_entry(action.code) != NULL) {
+    s_pending = true;
+    s_pending_press = *event;
+    s_pending_index = action.code;
+    memset(s_pressed_since, 0, sizeof(s_pressed_since));
+    return;
+  }
+
+  s_output(event->key, true, action);
+}
+
+// @brief Decide the undecided key, then replay the buffered events in order
+static void tap_hold_resolve(bool hold, uint32_t time_us)
+{
+  key_tap_hold_t const* entry = keymap_tap_hold_entry(s_pending_index);
+  uint32_t delay = time_us - s_pending_press.time_us;
+
+  if (hold) {
+    s_stats.holds++;
+    if (delay > s_stats.max_hold_us) s_stats.max_hold_us = delay;
+  } else {
+    s_stats.taps++;
+    if (delay > s_stats.max_tap_us) s_stats.max_tap_us = delay;
+  }
+
+  s_pending = false;
+  s_output(s_pending_press.key, true, hold ? entry->hold : entry->tap);
+
+  // A replayed event may start another undecided key, the rest is buffered again
+  key_event_t replay[TAP_HOLD_BUFFER_SIZE];
+  uint count = s_buffered;
+  memcpy(replay, s_buffer, count * sizeof(key_event_t));
+  s_buffered = 0;
+
+  for (uint i = 0; i < count; ++i) {
+    tap_hold_event(&replay[i]);
+  }
+}
+
+void tap_hold_init(tap_hold_output_t output)
+{
+  s_output = output;
+  s_pending = false;
+  s_buffered = 0;
+  memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void tap_hold_event(key_event_t const* event)
+{
+  if (!s_pending) {
+    tap_hold_dispatch(event);
+    return;
+  }
+
+  // The term may have passed before tap_hold_task() saw it, e.g. press and
+  // release drained together after the report queue was full
+  uint32_t term_us = keymap_setting(KEYMAP_SETTING_TAP_HOLD_TERM_US);
+  if ((int32_t) (event->time_us - s_pending_press.time_us) >= (int32_t) term_us) {
+    tap_hold_resolve(true, s_pending_press.time_us + term_us);
+    tap_hold_event(event);
+    return;
+  }
+
+  uint word = event->key / 64;
+  uint64_t bit = 1ULL << (event->key % 64);
+
+  // Released while undecided: tap, its release follows the replayed events
+  if (!event->pressed && event->key == s_pending_press.key) {
+    tap_hold_resolve(false, event->time_us);
+    tap_hold_event(event);
+    return;
+  }
+
+  if (s_buffered == TAP_HOLD_BUFFER_SIZE) {
+    s_stats.overflows++;
+    tap_hold_resolve(true, event->time_us);
+    tap_hold_event(event);
+    return;
+  }
+
+  s_buffer[s_buffered++] = *event;
+
+  if (event->pressed)
+  {
+    s_pressed_since[word] |= bit;
+    if (TAP_HOLD_POLICY == TAP_HOLD_POLICY_HOLD_ON_OTHER_KEY_PRESS) {
+      tap_hold_resolve(true, event->time_us);
+    }
+  }
+  else if (TAP_HOLD_POLICY == TAP_HOLD_POLICY_PERMISSIVE_HOLD && (s_pressed_since[word] & bit))
+  {
+    // A whole tap of another key inside the undecided one
+    tap_hold_resolve(true, event->time_us);
+  }
+}
+
+void tap_hold_task(uint32_t now_us)
+{
+  // The replay may leave another key undecided that is already past its term
+  // Signed: the event may carry a timestamp a little later than now_us
+  int32_t term_us = (int32_t) keymap_setting(KEYMAP_SETTING_TAP_HOLD_TERM_US);
+
+  while (s_pending && (int32_t) (now_us - s_pending_press.time_us) >= term_us) {
+    tap_hold_resolve(true, now_us);
+  }
+}
+
+bool tap_hold_pending(void)
+{
+  return s_pending;
+}
+
+tap_hold_stats_t const* tap_hold_stats(void)
+{
+  return &s_stats;
+}
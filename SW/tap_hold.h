@@ -0,0 +1,69 @@
+// Tap-hold (dual-role) keys (core0)
+// A KEY_ACTION_TAP_HOLD key is undecided when pressed. Events after it are
+// buffered and replayed in order once it resolves, so they see the layer or
+// modifier that the hold selects. Decisions use the scan timestamps of the
+// events (key_event_t.time_us):
+//   - released before TAP_HOLD_TERM_US                      -> tap
+//   - still held at TAP_HOLD_TERM_US                        -> hold
+//   - TAP_HOLD_POLICY_PERMISSIVE_HOLD: another key pressed
+//     and released while undecided                          -> hold
+//   - TAP_HOLD_POLICY_HOLD_ON_OTHER_KEY_PRESS: another key
+//     pressed while undecided                               -> hold
+// A tap is sent as soon as its release is seen, never after waiting for the term.
+
+#ifndef TAP_HOLD_H_
+#define TAP_HOLD_H_
+
+#include <stdint.h>
+#include "pico/types.h"
+#include "key_event.h"
+#include "keymap.h"
+
+typedef enum
+{
+  TAP_HOLD_POLICY_TERM = 0,                // only the tapping term decides
+  TAP_HOLD_POLICY_PERMISSIVE_HOLD,
+  TAP_HOLD_POLICY_HOLD_ON_OTHER_KEY_PRESS,
+} tap_hold_policy_t;
+
+// Default of KEYMAP_SETTING_TAP_HOLD_TERM_US
+#ifndef TAP_HOLD_TERM_US
+#define TAP_HOLD_TERM_US   200000
+#endif
+
+// Longest setting, the term is compared as a signed time difference
+#define TAP_HOLD_TERM_LIMIT_US  10000000
+#ifndef TAP_HOLD_POLICY
+#define TAP_HOLD_POLICY    TAP_HOLD_POLICY_PERMISSIVE_HOLD
+#endif
+
+// Events buffered while a key is undecided; one more resolves it as hold
+#define TAP_HOLD_BUFFER_SIZE  8
+
+// Resolved transition, action is only meaningful for presses
+typedef void (*tap_hold_output_t)(uint key, bool pressed, key_action_t action);
+
+typedef struct
+{
+  uint32_t taps;
+  uint32_t holds;
+  uint32_t max_tap_us;    // press -> decision, worst case
+  uint32_t max_hold_us;
+  uint32_t overflows;     // holds forced by a full buffer
+} tap_hold_stats_t;
+
+// @brief Reset, resolved transitions go to output
+void tap_hold_init(tap_hold_output_t output);
+
+// @brief Feed a debounced key transition
+void tap_hold_event(key_event_t const* event);
+
+// @brief Resolve an undecided key whose tapping term has passed
+void tap_hold_task(uint32_t now_us);
+
+// @brief A key is waiting for its tap / hold decision
+bool tap_hold_pending(void);
+
+tap_hold_stats_t const* tap_hold_stats(void);
+
+#endif /* TAP_HOLD_H_ */
@@ -0,0 +1,25 @@
+# Keymap table generation, shared by the firmware and the host build
+# keymap_generate(<target>) adds keymap_table.h, generated from keymap.json and
+# the KLE layout by keymap_gen.py, to the target's sources and include path.
+
+find_package(Python3 REQUIRED COMPONENTS Interpreter)
+
+set(KEYMAP_GEN    ${CMAKE_CURRENT_LIST_DIR}/keymap_gen.py)
+set(KEYMAP_SPEC   ${CMAKE_CURRENT_LIST_DIR}/../keymap.json   CACHE FILEPATH "Keymap spec (switch label -> action per layer)")
+set(KEYMAP_LAYOUT ${CMAKE_CURRENT_LIST_DIR}/../../HW/keyboard-layout-editor/ega-right-kb-layout.json CACHE FILEPATH "KLE layout JSON")
+
+function(keymap_generate TARGET)
+    set(OUT_DIR ${CMAKE_CURRENT_BINARY_DIR}/generated)
+    set(OUT_HEADER ${OUT_DIR}/keymap_table.h)
+
+    add_custom_command(
+        OUTPUT ${OUT_HEADER}
+        COMMAND ${CMAKE_COMMAND} -E make_directory ${OUT_DIR}
+        COMMAND Python3::Interpreter ${KEYMAP_GEN} --layout ${KEYMAP_LAYOUT} --keymap ${KEYMAP_SPEC} -o ${OUT_HEADER}
+        DEPENDS ${KEYMAP_GEN} ${KEYMAP_SPEC} ${KEYMAP_LAYOUT}
+        COMMENT "Generating keymap_table.h"
+        VERBATIM)
+
+    target_sources(${TARGET} PRIVATE ${OUT_HEADER})
+    target_include_directories(${TARGET} PUBLIC ${OUT_DIR})
+endfunction()
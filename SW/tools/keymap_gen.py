@@ -0,0 +1,456 @@
+#!/usr/bin/env python3
+"""Generate keymap_table.h from the KLE layout and keymap.json.
+
+Matrix position of a switch comes from the KLE layout: the KLE row index is
+the matrix row, the index of the key within that row is the matrix column
+(property objects such as {"x": 0.5} are skipped).
+
+keymap.json maps switch labels to actions per layer:
+  "F4", "ENTER", ...              plain key, HID_KEY_<name>
+  "SHIFT_RIGHT", "CONTROL_LEFT"   modifier (HID_KEY_CONTROL_LEFT .. HID_KEY_GUI_RIGHT)
+  "MO(n)"                         layer n while held
+  "TG(n)"                         layer n on / off
+  "OSL(n)"                        layer n for the next key press (momentary if held)
+  "DF(n)"                         layer n becomes the default layer
+  "LT(n,KEY)"                     tap: KEY, hold: layer n (see tap_hold.h)
+  "MT(MOD,KEY)"                   tap: KEY, hold: modifier MOD
+  "M(name)"                       play macro name (see below)
+  "MS_UP", "MS_BTN1", ...         mouse keys (MOUSE_KEYS below, see mouse_keys.h)
+  "VOLUME_UP", "PLAY_PAUSE", ...  consumer control (CONSUMER_KEYS below)
+  "TRNS"                          transparent, use the next active layer below
+  "NO"                            nothing, hides the layers below
+Switches not listed on a layer are transparent.
+
+The other half of a split keyboard (split_link.h) has no layout here: its
+switches are named by matrix position, "L<row>C<col>" (e.g. "L2C0"). They
+are emitted under #if SPLIT_LINK as keys SPLIT_KEY_FIRST + row * NUM_COLS + col
+and can't be combo members or diodeless.
+
+Optional "combos": [{"keys": ["SW31", "SW32"], "action": "ESCAPE"}, ...]
+sends action when 2 to 4 switches are pressed together (see combo.h). Any
+action above except LT / MT / TRNS is allowed. keymap.c indexes them by
+lowest member key at startup.
+
+Optional "macros": [{"name": "hello", "steps": ["Hello!", "TAP(ENTER)"]}, ...]
+compiled into bytecode (MACRO_OP_* in keymap.h). Steps:
+  "TAP(KEY)", "DOWN(KEY)", "UP(KEY)"   key or modifier name as above
+  "DELAY(ms)"                          pause playback
+  any other string                     typed as text, JIS (106/109) layout
+
+Optional "diodeless": ["SW12", ...] lists switches without a working diode,
+for the ghost key filter (ghost.h). Emitted as KEYMAP_DIODELESS_MASK, outside
+the signature: it describes the board, not the keymap.
+
+usage: keymap_gen.py --layout <kle.json> --keymap <keymap.json> -o <keymap_table.h>
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+import zlib
+
+NUM_ROWS = 6
+NUM_COLS = 10
+
+# First key of the other half (SPLIT_KEY_FIRST in split_link.h), one key state word up
+SPLIT_KEY_FIRST = 64
+
+MODIFIERS = [
+    "CONTROL_LEFT", "SHIFT_LEFT", "ALT_LEFT", "GUI_LEFT",
+    "CONTROL_RIGHT", "SHIFT_RIGHT", "ALT_RIGHT", "GUI_RIGHT",
+]
+
+TAP_HOLD = re.compile(r"^(LT|MT)\(\s*([A-Z0-9_]+)\s*,\s*([A-Z0-9_]+)\s*\)$")
+KEY_NAME = re.compile(r"^[A-Z0-9_]+$")
+LAYER_ACTION = re.compile(r"^(MO|TG|OSL|DF)\((\d+)\)$")
+MACRO_ACTION = re.compile(r"^M\(([A-Za-z0-9_]+)\)$")
+MACRO_STEP = re.compile(r"^(TAP|DOWN|UP|DELAY)\(([A-Z0-9_]+)\)$")
+LEFT_SWITCH = re.compile(r"^L(\d+)C(\d+)$")
+
+# ASCII -> (HID_KEY_ name, shift) on a JIS keyboard
+JIS_SYMBOLS = {
+    " ": ("SPACE", False), "\n": ("ENTER", False), "\t": ("TAB", False),
+    "!": ("1", True), '"': ("2", True), "#": ("3", True), "$": ("4", True),
+    "%": ("5", True), "&": ("6", True), "'": ("7", True), "(": ("8", True),
+    ")": ("9", True), "-": ("MINUS", False), "=": ("MINUS", True),
+    "^": ("EQUAL", False), "~": ("EQUAL", True), "|": ("KANJI3", True),
+    "@": ("BRACKET_LEFT", False), "`": ("BRACKET_LEFT", True),
+    "[": ("BRACKET_RIGHT", False), "{": ("BRACKET_RIGHT", True),
+    ";": ("SEMICOLON", False), "+": ("SEMICOLON", True),
+    ":": ("APOSTROPHE", False), "*": ("APOSTROPHE", True),
+    "]": ("EUROPE_1", False), "}": ("EUROPE_1", True),
+    ",": ("COMMA", False), "<": ("COMMA", True),
+    ".": ("PERIOD", False), ">": ("PERIOD", True),
+    "/": ("SLASH", False), "?": ("SLASH", True),
+    "\\": ("KANJI1", False), "_": ("KANJI1", True),
+}
+MOUSE_KEYS = {
+    "MS_UP": "UP", "MS_DOWN": "DOWN", "MS_LEFT": "LEFT", "MS_RIGHT": "RIGHT",
+    "MS_WH_UP": "WHEEL_UP", "MS_WH_DOWN": "WHEEL_DOWN",
+    "MS_WH_LEFT": "WHEEL_LEFT", "MS_WH_RIGHT": "WHEEL_RIGHT",
+    "MS_BTN1": "BUTTON1", "MS_BTN2": "BUTTON2", "MS_BTN3": "BUTTON3",
+    "MS_BTN4": "BUTTON4", "MS_BTN5": "BUTTON5",
+}
+# consumer_key_t names (CONSUMER_KEY_<name>), ahead of the HID_KEY_ names
+CONSUMER_KEYS = [
+    "MUTE", "VOLUME_UP", "VOLUME_DOWN", "PLAY_PAUSE", "STOP", "NEXT_TRACK",
+    "PREV_TRACK", "BRIGHTNESS_UP", "BRIGHTNESS_DOWN", "MAIL", "CALCULATOR",
+    "MY_COMPUTER", "WWW_SEARCH", "WWW_HOME", "WWW_BACK", "WWW_FORWARD",
+    "WWW_REFRESH",
+]
+LAYER_TYPES = {
+    "MO":  "KEY_ACTION_LAYER_MOMENTARY",
+    "TG":  "KEY_ACTION_LAYER_TOGGLE",
+    "OSL": "KEY_ACTION_LAYER_ONESHOT",
+    "DF":  "KEY_ACTION_LAYER_DEFAULT",
+}
+
+
+def load_positions(layout_path):
+    """Return {label: (row, col)} from a KLE layout."""
+    with open(layout_path, encoding="utf-8") as f:
+        layout = json.load(f)
+
+    positions = {}
+    rows = [r for r in layout if isinstance(r, list)]
+    for row, keys in enumerate(rows):
+        labels = [k for k in keys if isinstance(k, str)]
+        for col, label in enumerate(labels):
+            label = label.split("\n")[0]
+            if row >= NUM_ROWS or col >= NUM_COLS:
+                sys.exit(f"{layout_path}: {label} at row {row} col {col} is outside the "
+                         f"{NUM_ROWS}x{NUM_COLS} matrix")
+            if label in positions:
+                sys.exit(f"{layout_path}: duplicate switch label {label}")
+            positions[label] = (row, col)
+
+    return positions
+
+
+def switch_key(label, positions):
+    """Return the key of a switch label, None if there is no such switch."""
+    if label in positions:
+        row, col = positions[label]
+        return row * NUM_COLS + col
+
+    m = LEFT_SWITCH.match(label)
+    if m:
+        row, col = int(m.group(1)), int(m.group(2))
+        if row < NUM_ROWS and col < NUM_COLS:
+            return SPLIT_KEY_FIRST + row * NUM_COLS + col
+    return None
+
+
+def key_label(key):
+    """Matrix position of a key as "(row,col)", "L(row,col)" on the other half."""
+    if key >= SPLIT_KEY_FIRST:
+        row, col = divmod(key - SPLIT_KEY_FIRST, NUM_COLS)
+        return f"L({row},{col})"
+    row, col = divmod(key, NUM_COLS)
+    return f"({row},{col})"
+
+
+def parse_action(name, num_layers, where, tap_holds=None, macros=None):
+    """Return (type, code) as C expressions.
+
+    Tap-hold actions are appended to tap_holds (deduplicated) and refer to
+    their index. Macros are looked up by name in macros ({name: index}).
+    """
+    m = MACRO_ACTION.match(name)
+    if m and macros is not None:
+        if m.group(1) not in macros:
+            sys.exit(f"{where}: no macro named {m.group(1)}")
+        return "KEY_ACTION_MACRO", str(macros[m.group(1)])
+
+    m = TAP_HOLD.match(name)
+    if m and tap_holds is not None:
+        kind, hold_arg, tap_arg = m.groups()
+        if kind == "LT":
+            hold = parse_action(f"MO({hold_arg})", num_layers, where)
+        else:
+            if hold_arg not in MODIFIERS:
+                sys.exit(f"{where}: {name} needs a modifier to hold")
+            hold = parse_action(hold_arg, num_layers, where)
+        tap = parse_action(tap_arg, num_layers, where)
+
+        entry = (tap, hold, f"{kind}({hold_arg},{tap_arg})")
+        for index, existing in enumerate(tap_holds):
+            if existing[:2] == entry[:2]:
+                return "KEY_ACTION_TAP_HOLD", str(index)
+        tap_holds.append(entry)
+        return "KEY_ACTION_TAP_HOLD", str(len(tap_holds) - 1)
+
+    m = LAYER_ACTION.match(name)
+    if m:
+        layer = int(m.group(2))
+        if not 0 <= layer < num_layers:
+            sys.exit(f"{where}: {name} refers to a missing layer")
+        return LAYER_TYPES[m.group(1)], str(layer)
+
+    if name == "TRNS":
+        return "KEY_ACTION_TRANSPARENT", "0"
+    if name == "NO":
+        return "KEY_ACTION_NONE", "0"
+
+    if not KEY_NAME.match(name):
+        sys.exit(f"{where}: bad action '{name}'")
+
+    if name in MODIFIERS:
+        return "KEY_ACTION_MODIFIER", f"HID_KEY_{name}"
+    if name in MOUSE_KEYS:
+        return "KEY_ACTION_MOUSE", f"MOUSE_KEY_{MOUSE_KEYS[name]}"
+    if name in CONSUMER_KEYS:
+        return "KEY_ACTION_CONSUMER", f"CONSUMER_KEY_{name}"
+
+    return "KEY_ACTION_KEY", f"HID_KEY_{name}"
+
+
+def compile_macro(steps, where):
+    """Return the bytecode of a macro as [(op, operand, comment)]."""
+    code = []
+    for step in steps:
+        m = MACRO_STEP.match(step)
+        if m:
+            op, arg = m.groups()
+            if op == "DELAY":
+                ms = int(arg)
+                while ms > 0:
+                    code.append(("MACRO_OP_DELAY", str(min(ms, 255)), f"{min(ms, 255)} ms"))
+                    ms -= 255
+            else:
+                if not KEY_NAME.match(arg) or arg in ("TRNS", "NO"):
+                    sys.exit(f"{where}: bad key in {step}")
+                code.append((f"MACRO_OP_{op}", f"HID_KEY_{arg}", step))
+            continue
+
+        for char in step:
+            if char.isascii() and char.isalpha():
+                key, shift = char.upper(), char.isupper()
+            elif char.isascii() and char.isdigit():
+                key, shift = char, False
+            elif char in JIS_SYMBOLS:
+                key, shift = JIS_SYMBOLS[char]
+            else:
+                sys.exit(f"{where}: can't type {char!r}")
+            op = "MACRO_OP_SHIFT_TAP" if shift else "MACRO_OP_TAP"
+            code.append((op, f"HID_KEY_{key}", repr(char)))
+
+    code.append(("MACRO_OP_END", None, "end"))
+    return code
+
+
+def generate(layout_path, keymap_path):
+    positions = load_positions(layout_path)
+
+    with open(keymap_path, encoding="utf-8") as f:
+        keymap = json.load(f)
+
+    layers = keymap["layers"]
+    num_layers = len(layers)
+    if not 0 < num_layers <= 8:
+        sys.exit(f"{keymap_path}: need 1 to 8 layers")
+
+    # Macros first, keys and combos refer to them by name
+    macros = {}
+    macro_code = []
+    for index, macro in enumerate(keymap.get("macros", [])):
+        if macro["name"] in macros:
+            sys.exit(f"{keymap_path}: duplicate macro {macro['name']}")
+        macros[macro["name"]] = index
+        macro_code.append(compile_macro(macro["steps"], f"{keymap_path}: macro {macro['name']}"))
+    if len(macros) > 256:
+        sys.exit(f"{keymap_path}: at most 256 macros")
+
+    # actions[layer][key] = (type, code, label)
+    actions = []
+    tap_holds = []
+    for index, layer in enumerate(layers):
+        table = {}
+        for label, name in layer["keys"].items():
+            where = f"{keymap_path}: layer {layer['name']} {label}"
+            key = switch_key(label, positions)
+            if key is None:
+                sys.exit(f"{where}: no such switch in {layout_path}")
+            action = parse_action(name, num_layers, where, tap_holds, macros)
+            if action[0] != "KEY_ACTION_TRANSPARENT":
+                table[key] = action + (label,)
+        actions.append(table)
+
+    # combos[] = (mask, type, code, text), sorted by lowest member key
+    combos = []
+    for index, combo in enumerate(keymap.get("combos", [])):
+        where = f"{keymap_path}: combo {index}"
+        labels = combo["keys"]
+        if not 2 <= len(set(labels)) == len(labels) <= 4:
+            sys.exit(f"{where}: needs 2 to 4 different switches")
+        mask = 0
+        for label in labels:
+            if label not in positions:
+                sys.exit(f"{where}: no such switch {label} in {layout_path} (combos are of this half's switches)")
+            row, col = positions[label]
+            mask |= 1 << (row * NUM_COLS + col)
+        if any(c[0] == mask for c in combos):
+            sys.exit(f"{where}: same switches as another combo")
+        type_, code = parse_action(combo["action"], num_layers, where, macros=macros)
+        if type_ == "KEY_ACTION_TRANSPARENT":
+            sys.exit(f"{where}: combo action can't be TRNS")
+        combos.append((mask, type_, code, f"{'+'.join(labels)} -> {combo['action']}"))
+    combos.sort(key=lambda c: ((c[0] & -c[0]).bit_length(), c[0]))
+
+    out = []
+    out.append("// Generated by tools/keymap_gen.py, do not edit")
+    out.append(f"// from {os.path.basename(layout_path)} and {os.path.basename(keymap_path)}")
+    out.append("")
+    out.append("#ifndef KEYMAP_TABLE_H_")
+    out.append("#define KEYMAP_TABLE_H_")
+    out.append("")
+    out.append('#include "keymap.h"')
+    out.append("")
+    out.append(f"#if NUM_ROWS != {NUM_ROWS} || NUM_COLS != {NUM_COLS}")
+    out.append("#error keymap_table.h was generated for a different matrix size")
+    out.append("#endif")
+    out.append("")
+    out.append(f"#define KEYMAP_NUM_LAYERS  {num_layers}")
+    out.append("")
+
+    # Actions, indexed by key state bit position
+    out.append("// [layer][row * NUM_COLS + col], keys not listed are KEY_ACTION_TRANSPARENT")
+    out.append("// The other half's keys follow from SPLIT_KEY_FIRST (split_link.h)")
+    out.append("static const key_action_t keymap_actions[KEYMAP_NUM_LAYERS][KEYMAP_KEYS] = {")
+    for index, table in enumerate(actions):
+        out.append(f"  // {layers[index]['name']}")
+        out.append("  {")
+        left = False
+        for key in sorted(table):
+            type_, code, label = table[key]
+            if key >= SPLIT_KEY_FIRST and not left:
+                out.append("#if SPLIT_LINK")
+                left = True
+            out.append(f"    [{key:3}] = {{ {type_ + ',':28} {code:22} }},  // {label} {key_label(key)}")
+        if left:
+            out.append("#endif")
+        out.append("  },")
+    out.append("};")
+    out.append("")
+
+    # Bitmasks per action class, of one key state word
+    def mask_of(table, predicate, word=0):
+        mask = 0
+        for key, action in table.items():
+            if key // 64 == word and predicate(action):
+                mask |= 1 << (key % 64)
+        return mask
+
+    out.append(f"#define KEYMAP_TAP_HOLD_COUNT  {len(tap_holds)}")
+    out.append("")
+    out.append("// Tap-hold keys, indexed by the code of KEY_ACTION_TAP_HOLD")
+    out.append("static const key_tap_hold_t keymap_tap_hold[] = {")
+    for (tap, hold, text) in tap_holds:
+        out.append(f"  {{ .tap = {{ {tap[0]}, {tap[1]} }}, .hold = {{ {hold[0]}, {hold[1]} }} }},  // {text}")
+    if not tap_holds:
+        out.append("  { .tap = { KEY_ACTION_NONE, 0 }, .hold = { KEY_ACTION_NONE, 0 } },  // unused")
+    out.append("};")
+    out.append("")
+
+    out.append(f"#define KEYMAP_COMBO_COUNT  {len(combos)}")
+    out.append("")
+    out.append("// Combos, sorted by lowest member key")
+    out.append("static const key_combo_t keymap_combos[] = {")
+    for (mask, type_, code, text) in combos:
+        out.append(f"  {{ 0x{mask:016x}ULL, {{ {type_ + ',':28} {code:22} }} }},  // {text}")
+    if not combos:
+        out.append("  { 0, { KEY_ACTION_NONE, 0 } },  // unused")
+    out.append("};")
+    out.append("")
+
+    out.append(f"#define KEYMAP_MACRO_COUNT  {len(macro_code)}")
+    out.append("")
+    out.append("// Macro bytecode, see macro_op_t")
+    out.append("static const uint8_t keymap_macro_bytecode[] = {")
+    offsets = []
+    size = 0
+    for index, code in enumerate(macro_code):
+        offsets.append(size)
+        out.append(f"  // {keymap['macros'][index]['name']}")
+        for (op, operand, comment) in code:
+            item = f"{op}," if operand is None else f"{op + ',':20} {operand},"
+            out.append(f"  {item:44} // {comment}")
+            size += 1 if operand is None else 2
+    if not macro_code:
+        out.append("  MACRO_OP_END,  // unused")
+    if size > 0xffff:
+        sys.exit(f"{keymap_path}: macros take {size} bytes, at most 65535")
+    out.append("};")
+    out.append("")
+    out.append("// Start of each macro in keymap_macro_bytecode[], indexed by the code of KEY_ACTION_MACRO")
+    out.append("static const uint16_t keymap_macro_offset[] = {")
+    for index, offset in enumerate(offsets):
+        out.append(f"  {offset:5},  // {keymap['macros'][index]['name']}")
+    if not offsets:
+        out.append("  0,  // unused")
+    out.append("};")
+    out.append("")
+
+    out.append("// Keys of this half producing a keycode")
+    out.append("static const uint64_t keymap_key_mask[KEYMAP_NUM_LAYERS] = {")
+    for index, table in enumerate(actions):
+        mask = mask_of(table, lambda a: a[0] == "KEY_ACTION_KEY")
+        out.append(f"  0x{mask:016x}ULL,  // {layers[index]['name']}")
+    out.append("};")
+    out.append("")
+
+    out.append("// Transparent keys per key state word, used to flatten the active layers (see layer.c)")
+    out.append("static const uint64_t keymap_transparent_mask[KEYMAP_NUM_LAYERS][KEY_WORDS] = {")
+    all_keys = (1 << (NUM_ROWS * NUM_COLS)) - 1
+    for index, table in enumerate(actions):
+        out.append(f"  // {layers[index]['name']}")
+        out.append("  {")
+        out.append(f"    0x{all_keys & ~mask_of(table, lambda a: True):016x}ULL,")
+        out.append("#if SPLIT_LINK")
+        out.append(f"    0x{all_keys & ~mask_of(table, lambda a: True, 1):016x}ULL,")
+        out.append("#endif")
+        out.append("  },")
+    out.append("};")
+    out.append("")
+    # Changes saved in flash only apply on top of the same defaults (see keymap.c)
+    signature = zlib.crc32("\n".join(out[2:]).encode("utf-8"))
+    out.append("// Checksum of the tables above, tags the changes saved in flash")
+    out.append(f"#define KEYMAP_SIGNATURE  0x{signature:08x}u")
+    out.append("")
+
+    diodeless = 0
+    for label in keymap.get("diodeless", []):
+        if label not in positions:
+            sys.exit(f"{keymap_path}: diodeless: no such switch {label} in {layout_path} (this half only)")
+        row, col = positions[label]
+        diodeless |= 1 << (row * NUM_COLS + col)
+    out.append("// Switches without a working diode (keymap.json \"diodeless\"), see ghost.h")
+    out.append(f"#define KEYMAP_DIODELESS_MASK  0x{diodeless:016x}ULL")
+    if diodeless:
+        out.append("#if !GHOST_DETECT")
+        out.append("#warning keymap.json lists diodeless switches, build with GHOST_DETECT=ON to filter ghost keys")
+        out.append("#endif")
+    out.append("")
+    out.append("#endif /* KEYMAP_TABLE_H_ */")
+    out.append("")
+
+    return "\n".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--layout", required=True, help="KLE layout JSON")
+    parser.add_argument("--keymap", required=True, help="keymap spec JSON")
+    parser.add_argument("-o", "--output", required=True, help="header to write")
+    args = parser.parse_args()
+
+    text = generate(args.layout, args.keymap)
+
+    with open(args.output, "w", encoding="utf-8") as f:
+        f.write(text)
+
+
+if __name__ == "__main__":
+    main()
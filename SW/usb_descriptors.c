@@ -55,7 +55,7 @@ tusb_desc_device_t const desc_device =
 
     .idVendor           = USB_VID,
     .idProduct          = USB_PID,
-    .bcdDevice          = 0x0100,
+    .bcdDevice          = 0x0300,  // bumped when the interface layout changes
 
     .iManufacturer      = 0x01,
     .iProduct           = 0x02,
@@ -75,21 +75,40 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+uint8_t const desc_hid_report_keyboard[] =
+{
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+uint8_t const desc_hid_report_nkro[] =
+{
+  TUD_HID_REPORT_DESC_NKRO()
+};
+
+uint8_t const desc_hid_report_aux[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
   TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
   TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
   TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD          ))
 };
 
+uint8_t const desc_hid_report_raw[] =
+{
+  TUD_HID_REPORT_DESC_GENERIC_INOUT(RAW_HID_REPORT_SIZE)
+};
+
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  switch (instance)
+  {
+    case HID_INSTANCE_KEYBOARD: return desc_hid_report_keyboard;
+    case HID_INSTANCE_NKRO:     return desc_hid_report_nkro;
+    case HID_INSTANCE_RAW:      return desc_hid_report_raw;
+    default:                    return desc_hid_report_aux;
+  }
 }
 
 //--------------------------------------------------------------------+
@@ -98,13 +117,21 @@ uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 
 enum
 {
-  ITF_NUM_HID,
+  ITF_NUM_KEYBOARD = HID_INSTANCE_KEYBOARD,
+  ITF_NUM_NKRO     = HID_INSTANCE_NKRO,
+  ITF_NUM_AUX      = HID_INSTANCE_AUX,
+  ITF_NUM_RAW      = HID_INSTANCE_RAW,
   ITF_NUM_TOTAL
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+// Every interface but the raw one is IN only
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + (HID_INSTANCE_COUNT - 1) * TUD_HID_DESC_LEN + TUD_HID_INOUT_DESC_LEN)
 
-#define EPNUM_HID   0x81
+#define EPNUM_KEYBOARD  0x81
+#define EPNUM_NKRO      0x82
+#define EPNUM_AUX       0x83
+#define EPNUM_RAW_OUT   0x04
+#define EPNUM_RAW_IN    0x84
 
 uint8_t const desc_configuration[] =
 {
@@ -112,7 +139,14 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  // Boot keyboard: BIOS / boot protocol hosts use this one, 8-byte reports
+  TUD_HID_DESCRIPTOR(ITF_NUM_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report_keyboard), EPNUM_KEYBOARD, 8, 1),
+  // NKRO keyboard: used while the boot keyboard is in report protocol
+  TUD_HID_DESCRIPTOR(ITF_NUM_NKRO, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_nkro), EPNUM_NKRO, CFG_TUD_HID_EP_BUFSIZE, 1),
+  // Mouse / consumer control / gamepad
+  TUD_HID_DESCRIPTOR(ITF_NUM_AUX, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_aux), EPNUM_AUX, CFG_TUD_HID_EP_BUFSIZE, 1),
+  // Raw HID (vendor page): configuration requests on OUT, replies and counters on IN
+  TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_RAW, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_raw), EPNUM_RAW_OUT, EPNUM_RAW_IN, CFG_TUD_HID_EP_BUFSIZE, 1)
 };
 
 #if TUD_OPT_HIGH_SPEED
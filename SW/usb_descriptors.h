@@ -25,13 +25,64 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+// HID interface instances, in configuration descriptor order
+// Each has its own IN endpoint, so keyboard reports never wait behind others
 enum
 {
-  REPORT_ID_KEYBOARD = 1,
-  REPORT_ID_MOUSE,
+  HID_INSTANCE_KEYBOARD = 0,  // boot keyboard, 8-byte report, no report ID
+  HID_INSTANCE_NKRO,          // NKRO keyboard, no report ID
+  HID_INSTANCE_AUX,           // mouse / consumer control / gamepad
+  HID_INSTANCE_RAW,           // vendor raw HID, configuration protocol (raw_hid.h)
+  HID_INSTANCE_COUNT
+};
+
+// Report IDs of the auxiliary interface
+enum
+{
+  REPORT_ID_MOUSE = 1,
   REPORT_ID_CONSUMER_CONTROL,
   REPORT_ID_GAMEPAD,
   REPORT_ID_COUNT
 };
 
+// Raw HID reports in both directions, no report ID
+#define RAW_HID_REPORT_SIZE  64
+
+// NKRO keyboard: one bit per HID usage 0x00 .. (NKRO_KEYCODE_COUNT - 1)
+// Covers every key on this board including the JIS keys (KANJI1-5 = 0x87-0x8B)
+#define NKRO_KEYCODE_COUNT  160
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t modifier;                          // Keyboard modifier (KEYBOARD_MODIFIER_* masks)
+  uint8_t bitmap[NKRO_KEYCODE_COUNT / 8];    // bit (kc % 8) of byte (kc / 8) = keycode kc pressed
+} hid_nkro_report_t;
+
+// NKRO Keyboard Report Descriptor Template
+#define TUD_HID_REPORT_DESC_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP     )                    ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD )                    ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION )                    ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD )                     ,\
+      HID_USAGE_MIN    ( 224                                    )  ,\
+      HID_USAGE_MAX    ( 231                                    )  ,\
+      HID_LOGICAL_MIN  ( 0                                      )  ,\
+      HID_LOGICAL_MAX  ( 1                                      )  ,\
+      HID_REPORT_COUNT ( 8                                      )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+    /* Key bitmap, one bit per usage */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD )                     ,\
+      HID_USAGE_MIN    ( 0                                      )  ,\
+      HID_USAGE_MAX    ( NKRO_KEYCODE_COUNT - 1                 )  ,\
+      HID_LOGICAL_MIN  ( 0                                      )  ,\
+      HID_LOGICAL_MAX  ( 1                                      )  ,\
+      HID_REPORT_COUNT ( NKRO_KEYCODE_COUNT                     )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+  HID_COLLECTION_END \
+
 #endif /* USB_DESCRIPTORS_H_ */